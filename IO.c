@@ -1,19 +1,257 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <termios.h>
+#include <poll.h>
 #include "IO.h"
+#include "parser.h"
+#include "complete.h"
+#include "jobs.h"
 
 #define BUFLEN 1024
 static char buffer[BUFLEN];
 static const char* PROMPT = "咩~咩 > ";
+// Before the next lines of a command.
+static const char* MORE_PROMPT = "> ";
+static const char* prompt;
 
-const char* fetch() {
+static struct termios cooked;
+
+// Turn off canonical mode and echo so that we see every key,
+// the signals keep working as before.
+static int enable_raw(void) {
+    if (!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &cooked) < 0) {
+        return -1;
+    }
+    struct termios raw = cooked;
+    raw.c_lflag &= ~(ECHO | ICANON | IEXTEN);
+    raw.c_iflag &= ~(IXON | ICRNL);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static void disable_raw(void) {
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &cooked);
+}
+
+static int read_key(void) {
+    unsigned char c;
+    ssize_t n;
+    do {
+        n = read(STDIN_FILENO, &c, 1);
+        // Retry when interrupted by a signal.
+    } while (n < 0 && errno == EINTR);
+    return n <= 0 ? EOF : c;
+}
+
+// Returned by read_event when a child exited, the line is drawn again.
+#define KEY_REDRAW (-2)
+
+// Wait for a key or for a background job to finish, so a finished job is
+// reported while the prompt waits instead of after the next command.
+static int read_event(void) {
+    struct pollfd fds[2] = {
+        { .fd = STDIN_FILENO, .events = POLLIN },
+        { .fd = jobs_fd(), .events = POLLIN }
+    };
+    while (fds[1].fd >= 0 && !(fds[0].revents & (POLLIN | POLLHUP | POLLERR))) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (fds[1].revents & POLLIN) {
+            printf("\r\x1b[K");
+            jobs_notify();
+            return KEY_REDRAW;
+        }
+    }
+    return read_key();
+}
+
+// Number of columns taken by the bytes, counting one per UTF-8 character.
+static size_t columns(const char* s, size_t n) {
+    size_t cols = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (((unsigned char)s[i] & 0xC0) != 0x80) cols++;
+    }
+    return cols;
+}
+
+static void refresh(size_t len, size_t pos) {
+    printf("\r%s", prompt);
+    fwrite(buffer, 1, len, stdout);
+    printf("\x1b[K");
+    size_t back = columns(buffer + pos, len - pos);
+    if (back > 0) {
+        printf("\x1b[%zuD", back);
+    }
+    fflush(stdout);
+}
+
+static int is_separator(char c) {
+    return c == ' ' || c == '\t' || c == '<' || c == '>' || c == '|' || c == '&' || c == ';';
+}
+
+// Insert the text at the cursor, returns the new cursor.
+static size_t insert(size_t* len, size_t pos, const char* text, size_t n) {
+    if (*len + n >= BUFLEN) return pos;
+    memmove(buffer + pos + n, buffer + pos, *len - pos);
+    memcpy(buffer + pos, text, n);
+    *len += n;
+    return pos + n;
+}
+
+static void list_candidates(const Candidates* cands) {
+    printf("\r\n");
+    for (size_t i = 0; i < cands->n; ++i) {
+        printf("%s  ", candidate(cands, i));
+    }
+    printf("\r\n");
+}
+
+static size_t complete(size_t* len, size_t pos) {
+    size_t start = pos;
+    while (start > 0 && !is_separator(buffer[start - 1])) start--;
+
+    // A word is a command if only separators lie before it.
+    size_t before = start;
+    while (before > 0 && (buffer[before - 1] == ' ' || buffer[before - 1] == '\t')) before--;
+    int command = before == 0 || buffer[before - 1] == '|' ||
+        buffer[before - 1] == ';' || buffer[before - 1] == '&';
+
+    char word[BUFLEN];
+    memcpy(word, buffer + start, pos - start);
+    word[pos - start] = '\0';
+
+    Candidates cands = {0};
+    if (command && strchr(word, '/') == NULL) {
+        complete_command(word, &cands);
+    } else {
+        complete_file(word, &cands);
+    }
+
+    if (cands.n > 0) {
+        // Longest common prefix of all the candidates.
+        const char* first = candidate(&cands, 0);
+        size_t common = strlen(first);
+        for (size_t i = 1; i < cands.n && common > 0; ++i) {
+            const char* other = candidate(&cands, i);
+            size_t k = 0;
+            while (k < common && first[k] == other[k]) k++;
+            common = k;
+        }
+        size_t typed = pos - start;
+        if (common > typed) {
+            pos = insert(len, pos, first + typed, common - typed);
+        }
+        if (cands.n == 1) {
+            if (first[common - 1] != '/') pos = insert(len, pos, " ", 1);
+        } else if (common == typed) {
+            list_candidates(&cands);
+        }
+    }
+    delete_candidates(&cands);
+    return pos;
+}
+
+// Line editing on a terminal.
+static const char* edit(void) {
+    size_t len = 0;
+    size_t pos = 0;
+    refresh(len, pos);
+    while (1) {
+        int c = read_event();
+        switch (c) {
+            case KEY_REDRAW:
+                break;
+            case EOF:
+            case 4: // Ctrl-D
+                if (c == 4 && len > 0) {
+                    if (pos < len) {
+                        memmove(buffer + pos, buffer + pos + 1, len - pos - 1);
+                        len--;
+                    }
+                    break;
+                }
+                disable_raw();
+                perror("Failed getting char");
+                exit(-1);
+            case '\r':
+            case '\n':
+                buffer[len] = 0;
+                printf("\r\n");
+                return buffer;
+            case '\t':
+                pos = complete(&len, pos);
+                break;
+            case 127: // Backspace
+            case 8:
+                if (pos > 0) {
+                    // Remove the whole UTF-8 character.
+                    size_t from = pos - 1;
+                    while (from > 0 && ((unsigned char)buffer[from] & 0xC0) == 0x80) from--;
+                    memmove(buffer + from, buffer + pos, len - pos);
+                    len -= pos - from;
+                    pos = from;
+                }
+                break;
+            case 1: // Ctrl-A
+                pos = 0;
+                break;
+            case 5: // Ctrl-E
+                pos = len;
+                break;
+            case 21: // Ctrl-U
+                memmove(buffer, buffer + pos, len - pos);
+                len -= pos;
+                pos = 0;
+                break;
+            case 27: { // Escape sequence
+                int a = read_key();
+                int b = read_key();
+                if (a != '[') break;
+                if (b == 'D' && pos > 0) {
+                    do pos--; while (pos > 0 && ((unsigned char)buffer[pos] & 0xC0) == 0x80);
+                } else if (b == 'C' && pos < len) {
+                    do pos++; while (pos < len && ((unsigned char)buffer[pos] & 0xC0) == 0x80);
+                } else if (b == 'H') {
+                    pos = 0;
+                } else if (b == 'F') {
+                    pos = len;
+                }
+                break;
+            }
+            default:
+                if (c >= 32) {
+                    char ch = (char)c;
+                    pos = insert(&len, pos, &ch, 1);
+                }
+                break;
+        }
+        refresh(len, pos);
+    }
+}
+
+// Read one line into the buffer.
+static const char* fetch_line(void) {
+    if (enable_raw() == 0) {
+        const char* line = edit();
+        disable_raw();
+        return line;
+    }
 
     enum {
         NORMAL
     } state = NORMAL;
 
     size_t n = 0;
-    printf("%s", PROMPT);
+    printf("%s", prompt);
     while (n < BUFLEN - 1) {
         int c = fgetc(stdin);
         if (c == EOF) {
@@ -36,4 +274,29 @@ const char* fetch() {
     }
     perror("Such a long command is a bad style ><");
     exit(-1);
+}
+
+// The lines of one command, each with its newline.
+static char* source = NULL;
+
+const char* fetch() {
+    jobs_notify();
+    prompt = PROMPT;
+    size_t len = 0;
+    Incomplete incomplete;
+    incomplete_init(&incomplete);
+    int more;
+    do {
+        const char* line = fetch_line();
+        size_t n = strlen(line);
+        source = realloc(source, len + n + 2);
+        memcpy(source + len, line, n);
+        source[len + n] = '\n';
+        source[len + n + 1] = '\0';
+        // Only the new line is scanned.
+        more = incomplete_line(&incomplete, source + len, n + 1);
+        len += n + 1;
+        prompt = MORE_PROMPT;
+    } while (more);
+    return source;
 }
\ No newline at end of file
@@ -0,0 +1,1045 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include "complete.h"
+#include "parser.h"
+#include "cache.h"
+#include "script.h"
+#include "vars.h"
+#include "wildcard.h"
+#include "dircache.h"
+#include "ush.h"
+#include "serve.h"
+#include "stream.h"
+#include "check.h"
+
+// Benchmarks, run as ./bench <name> [args...].
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static char* make_temp_dir(void) {
+    char* dir = strdup("/tmp/ush-bench-XXXXXX");
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        exit(-1);
+    }
+    return dir;
+}
+
+static void remove_dir(const char* dir) {
+    char cmd[256];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    if (system(cmd) != 0) {
+        perror("rm");
+    }
+}
+
+/// Tab completion latency with 'n' executables on the PATH.
+static void bench_complete(int n) {
+    char* dir = make_temp_dir();
+    char path[512];
+    for (int i = 0; i < n; ++i) {
+        snprintf(path, sizeof(path), "%s/cmd%c%c%d", dir, 'a' + i % 26, 'a' + i / 26 % 26, i);
+        int fd = open(path, O_CREAT | O_WRONLY, 0755);
+        close(fd);
+    }
+
+    const char* dirs[] = { dir };
+    complete_set_path(dirs, 1);
+
+    // The first call builds the trie.
+    Candidates cands = {0};
+    double start = now();
+    complete_command("cmdq", &cands);
+    double build = now() - start;
+    delete_candidates(&cands);
+
+    const int rounds = 10000;
+    double worst = 0;
+    size_t found = 0;
+    start = now();
+    for (int i = 0; i < rounds; ++i) {
+        char prefix[16];
+        snprintf(prefix, sizeof(prefix), "cmd%c%c", 'a' + i % 26, 'a' + i / 7 % 26);
+        double t = now();
+        found += complete_command(prefix, &cands);
+        delete_candidates(&cands);
+        t = now() - t;
+        if (t > worst) worst = t;
+    }
+    double total = now() - start;
+
+    printf("complete: %d executables, build %.2f ms\n", n, build * 1e3);
+    printf("complete: %d lookups, %zu candidates, avg %.2f us, worst %.2f us\n",
+        rounds, found, total / rounds * 1e6, worst * 1e6);
+    remove_dir(dir);
+    free(dir);
+}
+
+/// The parser alone on lexed lines, per token.
+static void bench_parse(int rounds) {
+    static const char* lines[] = {
+        "ls -l -a /usr/bin",
+        "cat access.log | ./test_pipe | wc > counts.txt",
+        "sort < in > out",
+        "grep -v error server.log > errors.txt < in",
+        "for i in a b c d; do ls $i | wc; done",
+        "while ls x; do pwd; ls; done & pwd"
+    };
+    enum { N = sizeof(lines) / sizeof(lines[0]) };
+    Tokens* tokens[N];
+    size_t n = 0;
+    for (int i = 0; i < N; ++i) {
+        tokens[i] = lex(lines[i]);
+        n += tokens[i]->n;
+    }
+
+    double start = now();
+    for (int r = 0; r < rounds; ++r) {
+        for (int i = 0; i < N; ++i) {
+            delete_cmd(parse(tokens[i]));
+        }
+    }
+    double t = now() - start;
+    for (int i = 0; i < N; ++i) {
+        delete_tokens(tokens[i]);
+    }
+    printf("parse: %zu tokens in %d lines, %.1f ns/token\n", n, N, t / ((double)n * rounds) * 1e9);
+}
+
+/// Lexing and parsing every line against looking it up in the parse cache.
+static void bench_parse_cache(int rounds) {
+    static const char* lines[] = {
+        "ls -l -a /usr/bin",
+        "cat access.log | ./test_pipe | wc",
+        "sort < in > out",
+        "grep error server.log > errors.txt",
+        "ls | wc"
+    };
+    const int n = sizeof(lines) / sizeof(lines[0]);
+
+    double start = now();
+    for (int i = 0; i < rounds; ++i) {
+        Tokens* tokens = lex(lines[i % n]);
+        Cmd* cmd = parse(tokens);
+        delete_tokens(tokens);
+        delete_cmd(cmd);
+    }
+    double parse_time = now() - start;
+
+    start = now();
+    for (int i = 0; i < rounds; ++i) {
+        CacheEntry* entry = cache_acquire(lines[i % n]);
+        cache_release(entry);
+    }
+    double cache_time = now() - start;
+
+    CacheStats stats = cache_stats();
+    printf("parse-cache: lex+parse %.0f ns/line, cached %.0f ns/line (%zu hits, %zu misses)\n",
+        parse_time / rounds * 1e9, cache_time / rounds * 1e9, stats.hits, stats.misses);
+}
+
+/// Startup of a script: parsing the text against loading the compiled file.
+static void bench_script(int lines) {
+    static const char* templates[] = {
+        "ls -l -a /usr/bin/%d",
+        "cat access-%d.log | ./test_pipe | wc",
+        "sort < in%d > out%d",
+        "grep error%d server.log > errors.txt",
+        "./test_pipe %d < in > out"
+    };
+    char* dir = make_temp_dir();
+    char path[256];
+    snprintf(path, sizeof(path), "%s/bench.ush", dir);
+    FILE* f = fopen(path, "w");
+    for (int i = 0; i < lines; ++i) {
+        fprintf(f, templates[i % 5], i, i);
+        fputc('\n', f);
+    }
+    fclose(f);
+
+    Script script;
+    double start = now();
+    load_script(path, &script, 0);
+    double cold = now() - start;
+    delete_script(&script);
+
+    start = now();
+    load_script(path, &script, 1);
+    double compile = now() - start;
+    delete_script(&script);
+
+    start = now();
+    load_script(path, &script, 1);
+    double cached = now() - start;
+    size_t n = script.n;
+    delete_script(&script);
+
+    printf("script: %d lines, parse %.2f ms, parse+compile %.2f ms, cached load %.2f ms (%zu commands)\n",
+        lines, cold * 1e3, compile * 1e3, cached * 1e3, n);
+    remove_dir(dir);
+    free(dir);
+}
+
+/// Variable expansion throughput with 'n' variables defined.
+static void bench_expand(int n) {
+    char name[32], value[64];
+    for (int i = 0; i < n; ++i) {
+        snprintf(name, sizeof(name), "VAR%d", i);
+        snprintf(value, sizeof(value), "/some/value/number/%d", i);
+        var_set(name, value);
+    }
+    static const char* words[] = {
+        "plain-word-without-variables",
+        "$VAR1",
+        "${VAR2}/bin/${VAR3}",
+        "prefix-$VAR4-$VAR5-$MISSING-suffix",
+        "$VAR6$VAR7$VAR8$VAR9"
+    };
+    const int rounds = 2000000;
+    size_t bytes = 0;
+    double start = now();
+    for (int i = 0; i < rounds; ++i) {
+        char* word = expand_word(words[i % 5]);
+        bytes += strlen(word);
+        free(word);
+    }
+    double t = now() - start;
+    printf("expand: %d variables, %.1f M words/s, %.0f ns/word, %.1f MB/s out\n",
+        n, rounds / t * 1e-6, t / rounds * 1e9, bytes / t * 1e-6);
+
+    start = now();
+    for (int i = 0; i < rounds; ++i) {
+        if (i % 1000 == 0) var_set("VAR1", "changed");
+        vars_environ();
+    }
+    t = now() - start;
+    printf("expand: envp lookup %.0f ns/launch (rebuilt every 1000 launches)\n", t / rounds * 1e9);
+}
+
+/// Lexer throughput on a long line full of quoted words.
+static void bench_lex(size_t bytes) {
+    char* line = malloc(bytes + 256);
+    size_t n = 0;
+    for (size_t i = 0; n < bytes; ++i) {
+        n += sprintf(line + n, "grep 'a quoted | pattern %zu' \"$HOME/with spaces/file%zu.log\" "
+            "plain_argument_word_%zu --flag=value\\ escaped | ", i, i, i);
+    }
+    strcpy(line + n, "wc");
+
+    const int rounds = 20;
+    size_t tokens = 0;
+    double start = now();
+    for (int i = 0; i < rounds; ++i) {
+        Tokens* list = lex(line);
+        tokens += list->n;
+        delete_tokens(list);
+    }
+    double t = now() - start;
+    printf("lex: %zu bytes, %.1f MB/s, %.0f ns/token\n",
+        n, n * (double)rounds / t * 1e-6, t / tokens * 1e9);
+    free(line);
+}
+
+/// Expanding *.log in a directory of 'n' files, against /bin/sh.
+static void bench_glob(int n) {
+    char* dir = make_temp_dir();
+    char path[512];
+    for (int i = 0; i < n; ++i) {
+        snprintf(path, sizeof(path), "%s/file%07d.%s", dir, i, i % 2 ? "log" : "txt");
+        close(open(path, O_CREAT | O_WRONLY, 0644));
+    }
+    snprintf(path, sizeof(path), "%s/*.log", dir);
+
+    char** matches;
+    double start = now();
+    size_t m = wildcard_expand(path, &matches);
+    double cold = now() - start;
+    for (size_t i = 0; i < m; ++i) free(matches[i]);
+    free(matches);
+
+    const int rounds = 10;
+    start = now();
+    for (int r = 0; r < rounds; ++r) {
+        m = wildcard_expand(path, &matches);
+        for (size_t i = 0; i < m; ++i) free(matches[i]);
+        free(matches);
+    }
+    double cached = (now() - start) / rounds;
+
+    char cmd[1024];
+    snprintf(cmd, sizeof(cmd), "/bin/sh -c 'set -- %s; test $# = %zu'", path, m);
+    start = now();
+    if (system(cmd) != 0) {
+        fprintf(stderr, "glob: /bin/sh found a different number of files\n");
+    }
+    double sh = now() - start;
+
+    printf("glob: %d files, %zu matches, first %.1f ms, cached %.1f ms, /bin/sh %.1f ms\n",
+        n, m, cold * 1e3, cached * 1e3, sh * 1e3);
+    dircache_clear();
+    remove_dir(dir);
+    free(dir);
+}
+
+// The line of a for loop over 'n' words.
+static char* loop_line(int n, const char* body) {
+    char* line = malloc((size_t)n * 8 + strlen(body) + 64);
+    size_t len = sprintf(line, "for i in");
+    for (int i = 0; i < n; ++i) {
+        len += sprintf(line + len, " %d", i);
+    }
+    sprintf(line + len, "; do %s; done", body);
+    return line;
+}
+
+/// A for loop over 'n' words with a builtin body, the tree is walked
+/// without lexing the body again. The same loop in /bin/sh for scale.
+static void bench_loop(int n) {
+    char* line = loop_line(n, "true");
+    ush_trace = 0;
+    cache_resize(0);
+    double start = now();
+    run(line);
+    double ush = now() - start;
+
+    // Too long for a command line argument.
+    char* dir = make_temp_dir();
+    char path[256];
+    snprintf(path, sizeof(path), "%s/loop.sh", dir);
+    FILE* f = fopen(path, "w");
+    fprintf(f, "%s\n", line);
+    fclose(f);
+    char cmd[512];
+    snprintf(cmd, sizeof(cmd), "/bin/sh %s", path);
+    start = now();
+    if (system(cmd) != 0) {
+        fprintf(stderr, "loop: /bin/sh failed\n");
+    }
+    double sh = now() - start;
+    remove_dir(dir);
+    free(dir);
+
+    printf("loop: %d iterations, %.0f ns/iteration (%.1f M/s), /bin/sh %.0f ns/iteration\n",
+        n, ush / n * 1e9, n / ush / 1e6, sh / n * 1e9);
+    free(line);
+}
+
+/// Calling a function against calling the builtin it wraps.
+static void bench_call(int n) {
+    ush_trace = 0;
+    cache_resize(0);
+    run("f() { true; }");
+    const char* bodies[] = { "true", "f" };
+    double times[2];
+    for (int k = 0; k < 2; ++k) {
+        char* line = loop_line(n, bodies[k]);
+        double start = now();
+        run(line);
+        times[k] = now() - start;
+        free(line);
+    }
+    printf("call: builtin %.0f ns/call, function %.0f ns/call\n",
+        times[0] / n * 1e9, times[1] / n * 1e9);
+}
+
+typedef struct {
+    const char* path;
+    const char* line;
+    int requests;
+    double* latency;
+} Client;
+
+static void* run_client(void* arg) {
+    Client* c = arg;
+    int fd = serve_connect(c->path);
+    if (fd < 0) {
+        perror("connect");
+        return NULL;
+    }
+    int null = open("/dev/null", O_WRONLY);
+    for (int i = 0; i < c->requests; ++i) {
+        double start = now();
+        if (serve_request(fd, c->line, null, null) < 0) {
+            fprintf(stderr, "serve: request failed\n");
+            break;
+        }
+        c->latency[i] = now() - start;
+    }
+    close(null);
+    close(fd);
+    return NULL;
+}
+
+static int compare_double(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+/// Load generator for 'ush --serve': 'clients' connections send 'line'
+/// as fast as the replies come back. Against a fresh /bin/sh per request.
+static void bench_serve_line(const char* path, const char* line, int requests, int clients) {
+    pthread_t* threads = malloc(clients * sizeof(pthread_t));
+    Client* c = malloc(clients * sizeof(Client));
+    double* latency = calloc(requests, sizeof(double));
+    int per = requests / clients;
+    double start = now();
+    for (int i = 0; i < clients; ++i) {
+        c[i] = (Client){ path, line, per, latency + i * per };
+        pthread_create(threads + i, NULL, run_client, c + i);
+    }
+    for (int i = 0; i < clients; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    double total = now() - start;
+    int n = per * clients;
+    qsort(latency, n, sizeof(double), compare_double);
+    printf("serve: %-12s %d clients, %.0f requests/s, p50 %.0f us, p99 %.0f us\n",
+        line, clients, n / total, latency[n / 2] * 1e6, latency[n * 99 / 100] * 1e6);
+
+    // A fresh shell per request, what the server saves.
+    const int fresh = 200;
+    char cmd[256];
+    snprintf(cmd, sizeof(cmd), "/bin/sh -c '%s' > /dev/null", line);
+    start = now();
+    for (int i = 0; i < fresh; ++i) {
+        if (system(cmd) != 0) break;
+    }
+    printf("serve: %-12s fresh /bin/sh per request %.0f us\n", line, (now() - start) / fresh * 1e6);
+    free(latency);
+    free(c);
+    free(threads);
+}
+
+static void bench_serve(int requests) {
+    char* dir = make_temp_dir();
+    char path[256];
+    snprintf(path, sizeof(path), "%s/ush.sock", dir);
+    pid_t server = fork();
+    if (server == 0) {
+        ush_init();
+        exit(serve(path, SERVE_WORKERS) < 0);
+    }
+    // Wait for the socket.
+    int fd;
+    while ((fd = serve_connect(path)) < 0) {
+        usleep(1000);
+    }
+    close(fd);
+
+    bench_serve_line(path, "true", requests, 8);
+    bench_serve_line(path, "echo hi", requests, 8);
+
+    kill(server, SIGTERM);
+    waitpid(server, NULL, 0);
+    remove_dir(dir);
+    free(dir);
+}
+
+/// CPU-bound jobs through 'parallel -j N' for growing N, against xargs -P.
+static void bench_parallel(int jobs) {
+    const char* work = "/bin/sh -c 'i=0; while [ $i -lt 20000 ]; do i=$((i+1)); done'";
+    size_t cap = (size_t)jobs * 8 + 256;
+    char* line = malloc(cap);
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    ush_trace = 0;
+    for (long j = 1; j <= cores * 2; j *= 2) {
+        size_t len = sprintf(line, "parallel -j %ld %s {} :::", j, work);
+        for (int i = 0; i < jobs; ++i) {
+            len += sprintf(line + len, " %d", i);
+        }
+        double start = now();
+        run(line);
+        double t = now() - start;
+        printf("parallel: -j %ld, %d jobs, %.1f jobs/s\n", j, jobs, jobs / t);
+    }
+
+    char cmd[512];
+    snprintf(cmd, sizeof(cmd), "seq %d | xargs -P %ld -I{} %s", jobs, cores, work);
+    double start = now();
+    if (system(cmd) != 0) {
+        fprintf(stderr, "parallel: xargs failed\n");
+    }
+    printf("parallel: xargs -P %ld, %d jobs, %.1f jobs/s\n", cores, jobs, jobs / (now() - start));
+    free(line);
+}
+
+/// Start 'n' background jobs which all live at once, then wait for them.
+/// Every exit is one SIGCHLD read from the signalfd, and reaps whatever
+/// exited meanwhile, so the time to reap does not grow with the jobs tracked.
+static void bench_jobs(int n) {
+    size_t cap = (size_t)n * 8 + 256;
+    char* line = malloc(cap);
+    size_t len = sprintf(line, "for i in");
+    for (int i = 0; i < n; ++i) {
+        len += sprintf(line + len, " %d", i);
+    }
+    sprintf(line + len, "; do /bin/sleep 1 & done");
+    ush_trace = 0;
+    double start = now();
+    run(line);
+    double spawn = now() - start;
+    start = now();
+    run("wait");
+    double wait = now() - start;
+    printf("jobs: %d concurrent, %.0f spawns/s, waited %.2f s after the last spawn\n",
+        n, n / spawn, wait);
+
+    // Short jobs, the exits overlap the spawns.
+    sprintf(line + len, "; do /bin/true & done; wait");
+    start = now();
+    run(line);
+    double t = now() - start;
+    printf("jobs: %d short jobs, %.0f jobs/s\n", n, n / t);
+    free(line);
+}
+
+/// 'tail -n 10' of a file of 'gb' GB against coreutils tail, the file is
+/// sparse but for its last lines. And 'yes | head' both ways, where the
+/// builtin saves the exec and makes yes stop at its next write.
+static void bench_head_tail(int gb) {
+    char* dir = make_temp_dir();
+    char path[256];
+    snprintf(path, sizeof(path), "%s/big", dir);
+    FILE* f = fopen(path, "w");
+    if (f == NULL || ftruncate(fileno(f), (off_t)gb << 30) < 0 || fseeko(f, 0, SEEK_END) < 0) {
+        fprintf(stderr, "tail: failed creating %s\n", path);
+        remove_dir(dir);
+        free(dir);
+        return;
+    }
+    for (int i = 0; i < 100000; ++i) {
+        fprintf(f, "line %d at the end of the big file\n", i);
+    }
+    fclose(f);
+
+    char line[512];
+    const char* tails[] = { "tail", "/usr/bin/tail" };
+    const int rounds = 100;
+    ush_trace = 0;
+    for (int k = 0; k < 2; ++k) {
+        snprintf(line, sizeof(line), "%s -n 10 %s > /dev/null", tails[k], path);
+        double start = now();
+        for (int i = 0; i < rounds; ++i) {
+            run(line);
+        }
+        printf("tail: %-13s -n 10 of %d GB, %.0f us\n", tails[k], gb, (now() - start) / rounds * 1e6);
+    }
+
+    const char* heads[] = { "head", "/usr/bin/head" };
+    for (int k = 0; k < 2; ++k) {
+        snprintf(line, sizeof(line), "/usr/bin/yes | %s -n 10 > /dev/null", heads[k]);
+        double start = now();
+        for (int i = 0; i < rounds; ++i) {
+            run(line);
+        }
+        printf("head: yes | %-13s -n 10, %.0f us\n", heads[k], (now() - start) / rounds * 1e6);
+    }
+    remove_dir(dir);
+    free(dir);
+}
+
+/// The sort builtin against GNU sort in the C locale, on 'lines' random
+/// lines: by bytes, by number, by a field, and with a memory cap which
+/// makes both spill sorted runs to temporary files.
+static void bench_sort(int lines) {
+    char* dir = make_temp_dir();
+    char path[256];
+    snprintf(path, sizeof(path), "%s/in", dir);
+    FILE* f = fopen(path, "w");
+    srand(1);
+    for (int i = 0; i < lines; ++i) {
+        fprintf(f, "%d.%02d host%d GET /page/%x %d\n", rand() % 100000, rand() % 100,
+            rand() % 64, rand(), rand() % 1000);
+    }
+    long bytes = ftell(f);
+    fclose(f);
+
+    static const char* options[] = { "", "-n", "-k 3,3 -u", "-S 16M" };
+    char line[512];
+    ush_trace = 0;
+    for (size_t k = 0; k < sizeof(options) / sizeof(options[0]); ++k) {
+        snprintf(line, sizeof(line), "sort %s %s > /dev/null", options[k], path);
+        double start = now();
+        run(line);
+        double ush = now() - start;
+        snprintf(line, sizeof(line), "LC_ALL=C sort %s %s > /dev/null", options[k], path);
+        start = now();
+        if (system(line) != 0) {
+            fprintf(stderr, "sort: GNU sort failed\n");
+        }
+        double gnu = now() - start;
+        printf("sort: %-10s %d lines, %.1f MB/s, GNU sort %.1f MB/s\n",
+            options[k], lines, bytes / ush / 1e6, bytes / gnu / 1e6);
+    }
+    remove_dir(dir);
+    free(dir);
+}
+
+/// The grep builtin against GNU grep in the C locale on 'mb' MB of log
+/// lines: a literal which never matches, a frequent one, the same with -i,
+/// a regular expression with a literal in it, and -c -v.
+static void bench_grep(int mb) {
+    char* dir = make_temp_dir();
+    char path[256];
+    snprintf(path, sizeof(path), "%s/in", dir);
+    FILE* f = fopen(path, "w");
+    srand(1);
+    while (ftell(f) < (long)mb << 20) {
+        fprintf(f, "%d.%02d host%d GET /page/%x %d\n", rand() % 100000, rand() % 100,
+            rand() % 64, rand(), rand() % 1000);
+    }
+    long bytes = ftell(f);
+    fclose(f);
+
+    static const char* patterns[] = {
+        "zebra", "host7", "-i HOST7", "'page/[0-9a-f]*ff '", "-c -v GET"
+    };
+    // Not /dev/null, GNU grep stops at the first match when it sees it.
+    char out[256];
+    snprintf(out, sizeof(out), "%s/out", dir);
+    char line[768];
+    ush_trace = 0;
+    // Read it once, so both find it in the page cache.
+    snprintf(line, sizeof(line), "grep -c x %s > %s", path, out);
+    run(line);
+    for (size_t k = 0; k < sizeof(patterns) / sizeof(patterns[0]); ++k) {
+        snprintf(line, sizeof(line), "grep %s %s > %s", patterns[k], path, out);
+        double start = now();
+        run(line);
+        double ush = now() - start;
+        snprintf(line, sizeof(line), "LC_ALL=C grep %s %s > %s", patterns[k], path, out);
+        start = now();
+        if (system(line) > 1 << 8) {
+            fprintf(stderr, "grep: GNU grep failed\n");
+        }
+        double gnu = now() - start;
+        printf("grep: %-22s %.2f GB/s, GNU grep %.2f GB/s\n", patterns[k], bytes / ush / 1e9, bytes / gnu / 1e9);
+    }
+    remove_dir(dir);
+    free(dir);
+}
+
+/// Throughput of a 4 stage ./test_pipe pipeline, as it is, with the
+/// stages spread over the cores and with every stage under SCHED_BATCH.
+// Comparing the output of two commands, through pipes against through
+// temporary files written first.
+static void bench_subst(int mb) {
+    char* dir = make_temp_dir();
+    char line[768];
+    long bytes = (long)mb << 20;
+    ush_trace = 0;
+    snprintf(line, sizeof(line), "cmp <(head -c %ld /dev/zero) <(head -c %ld /dev/zero)", bytes, bytes);
+    double start = now();
+    run(line);
+    double subst = now() - start;
+    snprintf(line, sizeof(line),
+        "head -c %ld /dev/zero > %s/a; head -c %ld /dev/zero > %s/b; cmp %s/a %s/b",
+        bytes, dir, bytes, dir, dir, dir);
+    start = now();
+    run(line);
+    double files = now() - start;
+    printf("subst: %d MB each, %.2f GB/s through pipes, %.2f GB/s through temp files\n",
+        mb, 2.0 * mb / 1024 / subst, 2.0 * mb / 1024 / files);
+    remove_dir(dir);
+    free(dir);
+}
+
+// '$(cmd)' with a builtin, run in the shell into memory, against the same
+// builtin forked, which a list is, and an executable read from a pipe.
+static void bench_cmdsubst(int n) {
+    ush_trace = 0;
+    static const char* bodies[] = { "x=$(pwd)", "x=$(true; pwd)", "x=$(/bin/echo $i)" };
+    double t[3];
+    for (int k = 0; k < 3; ++k) {
+        // A fork is a lot slower, fewer rounds do.
+        int rounds = k == 0 ? n : n / 100;
+        char* line = loop_line(rounds, bodies[k]);
+        double start = now();
+        run(line);
+        t[k] = (now() - start) / rounds;
+        free(line);
+    }
+    printf("cmdsubst: builtin %.2f us (%.0f/s), forked builtin %.1f us (%.0f/s), executable %.1f us (%.0f/s)\n",
+        t[0] * 1e6, 1 / t[0], t[1] * 1e6, 1 / t[1], t[2] * 1e6, 1 / t[2]);
+}
+
+// Inline input to a builtin, a here-string against an echo through a pipe.
+static void bench_here(int n) {
+    ush_trace = 0;
+    char* dir = make_temp_dir();
+    char body[512];
+    static const char* inputs[] = { "grep -c b <<< $i", "echo $i | grep -c b" };
+    double t[2];
+    for (int k = 0; k < 2; ++k) {
+        snprintf(body, sizeof(body), "%s > %s/out", inputs[k], dir);
+        char* line = loop_line(n, body);
+        double start = now();
+        run(line);
+        t[k] = now() - start;
+        free(line);
+    }
+    printf("here: %d commands, %.1f us with <<<, %.1f us with echo |\n",
+        n, t[0] / n * 1e6, t[1] / n * 1e6);
+    remove_dir(dir);
+    free(dir);
+}
+
+// pwd and 'pwd -P' as builtins called directly, $PWD against getcwd,
+// from a directory deep enough for the difference to show.
+static void bench_pwd(int n) {
+    char* dir = make_temp_dir();
+    char path[4096];
+    int len = snprintf(path, sizeof(path), "%s", dir);
+    for (int i = 0; i < 32; ++i) {
+        len += snprintf(path + len, sizeof(path) - len, "/level%d", i);
+        mkdir(path, 0755);
+    }
+    char line[4200];
+    snprintf(line, sizeof(line), "cd %s", path);
+    ush_trace = 0;
+    run(line);
+
+    fflush(stdout);
+    int out = dup(1);
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, 1);
+    close(null);
+    static char* words[][2] = { { "pwd", NULL }, { "pwd", "-P" } };
+    double t[2];
+    for (int k = 0; k < 2; ++k) {
+        double start = now();
+        for (int i = 0; i < n; ++i) {
+            simple_pwd(k + 1, words[k]);
+        }
+        fflush(stdout);
+        t[k] = now() - start;
+    }
+    dup2(out, 1);
+    close(out);
+    run("cd /");
+    printf("pwd: %.0f ns logical, %.0f ns with getcwd\n", t[0] / n * 1e9, t[1] / n * 1e9);
+    remove_dir(dir);
+    free(dir);
+}
+
+// A piped script of 'lines' lines: the first command out of the Stream
+// and all of them split, against loading the whole script before the
+// first one can run.
+static void bench_stream(int lines) {
+    char* dir = make_temp_dir();
+    char path[256];
+    snprintf(path, sizeof(path), "%s/bench.ush", dir);
+    FILE* f = fopen(path, "w");
+    for (int i = 0; i < lines; i += 5) {
+        fprintf(f, "for i in a%d b c\ndo\n    ls $i |\n        wc\ndone\n", i);
+    }
+    fclose(f);
+
+    double start = now();
+    int fd = open(path, O_RDONLY);
+    Stream stream;
+    stream_init(&stream);
+    char chunk[65536];
+    double first = 0;
+    size_t n = 0;
+    ssize_t got;
+    do {
+        got = read(fd, chunk, sizeof(chunk));
+        stream_feed(&stream, chunk, got > 0 ? (size_t)got : 0);
+        char* source;
+        while ((source = stream_next(&stream, got <= 0)) != NULL) {
+            if (n++ == 0) first = now() - start;
+            free(source);
+        }
+    } while (got > 0);
+    double split = now() - start;
+    stream_free(&stream);
+    close(fd);
+
+    Script script;
+    start = now();
+    load_script(path, &script, 0);
+    double whole = now() - start;
+    delete_script(&script);
+
+    printf("stream: %zu commands, first after %.1f us, all split in %.2f ms; whole script parsed in %.2f ms\n",
+        n, first * 1e6, split * 1e3, whole * 1e3);
+    remove_dir(dir);
+    free(dir);
+}
+
+// 'ush -n' on 'files' scripts: a shell per file against one run on a
+// single thread and on every core.
+static void bench_check(int files) {
+    if (access("./ush", X_OK) < 0) {
+        fprintf(stderr, "check: ./ush is missing\n");
+        return;
+    }
+    char* dir = make_temp_dir();
+    char** paths = malloc((files + 2) * sizeof(char*));
+    for (int i = 0; i < files; ++i) {
+        char path[256];
+        snprintf(path, sizeof(path), "%s/s%d.ush", dir, i);
+        paths[i + 2] = strdup(path);
+        FILE* f = fopen(path, "w");
+        for (int k = 0; k < 50; ++k) {
+            fprintf(f, "for i in a%d b c\ndo\n    ls -l $i | wc > out%d\ndone\n", k, k);
+        }
+        fclose(f);
+    }
+
+    fflush(stdout);
+    int out = dup(1);
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, 1);
+    close(null);
+
+    double start = now();
+    for (int i = 0; i < files; ++i) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            execl("./ush", "ush", "-n", paths[i + 2], (char*)NULL);
+            _exit(127);
+        }
+        waitpid(pid, NULL, 0);
+    }
+    double each = now() - start;
+
+    double t[2];
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int k = 0; k < 2; ++k) {
+        char jobs[32];
+        snprintf(jobs, sizeof(jobs), "-j%ld", k == 0 ? 1 : cores);
+        paths[1] = jobs;
+        start = now();
+        check_files(files + 1, paths + 1);
+        fflush(stdout);
+        t[k] = now() - start;
+    }
+    dup2(out, 1);
+    close(out);
+
+    printf("check: %d files, a shell each %.1f ms, one thread %.1f ms, %ld threads %.1f ms\n",
+        files, each * 1e3, t[0] * 1e3, cores, t[1] * 1e3);
+    for (int i = 0; i < files; ++i) free(paths[i + 2]);
+    free(paths);
+    remove_dir(dir);
+    free(dir);
+}
+
+static void bench_pipeline(int lines) {
+    if (access("./test_pipe", X_OK) < 0) {
+        fprintf(stderr, "pipeline: ./test_pipe is missing\n");
+        return;
+    }
+    char* dir = make_temp_dir();
+    char in[256];
+    snprintf(in, sizeof(in), "%s/in", dir);
+    FILE* f = fopen(in, "w");
+    for (int i = 0; i < lines; ++i) {
+        fprintf(f, "line %d of the pipeline benchmark input\n", i);
+    }
+    long bytes = ftell(f);
+    fclose(f);
+
+    static const struct {
+        const char* name;
+        const char* spread;
+        const char* prefix;
+    } modes[] = {
+        { "default", "0", "" },
+        { "spread", "1", "" },
+        { "batch", "0", "sched -b " }
+    };
+    char line[1024];
+    ush_trace = 0;
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+        var_set("USH_SPREAD", modes[m].spread);
+        snprintf(line, sizeof(line),
+            "%s./test_pipe < %s | %s./test_pipe | %s./test_pipe | %s./test_pipe > /dev/null",
+            modes[m].prefix, in, modes[m].prefix, modes[m].prefix, modes[m].prefix);
+        double start = now();
+        run(line);
+        double t = now() - start;
+        printf("pipeline: %-8s %.1f MB/s\n", modes[m].name, bytes / t / 1e6);
+    }
+    var_unset("USH_SPREAD");
+    remove_dir(dir);
+    free(dir);
+}
+
+// Builtin stages run as threads of the shell passing rings, against the
+// same stages forked and passing pipes: the throughput over a large file,
+// then the latency of a pipeline passing one line.
+static void bench_threads(int mb) {
+    char* dir = make_temp_dir();
+    char path[256];
+    snprintf(path, sizeof(path), "%s/in", dir);
+    FILE* f = fopen(path, "w");
+    srand(1);
+    while (ftell(f) < (long)mb << 20) {
+        fprintf(f, "%d.%02d host%d GET /page/%x %d\n", rand() % 100000, rand() % 100,
+            rand() % 64, rand(), rand() % 1000);
+    }
+    long bytes = ftell(f);
+    fclose(f);
+
+    static const char* pipelines[] = { "cat %s | grep host7 | wc", "cat %s | cat | cat | grep -c zebra" };
+    static const char* modes[] = { "1", "0" };
+    char cmd[512], line[768];
+    ush_trace = 0;
+    snprintf(line, sizeof(line), "wc %s > %s/out", path, dir);
+    run(line);
+    for (size_t k = 0; k < sizeof(pipelines) / sizeof(pipelines[0]); ++k) {
+        double t[2];
+        snprintf(cmd, sizeof(cmd), pipelines[k], "in");
+        for (int m = 0; m < 2; ++m) {
+            var_set("USH_THREADS", modes[m]);
+            snprintf(line, sizeof(line), pipelines[k], path);
+            snprintf(line + strlen(line), sizeof(line) - strlen(line), " > %s/out", dir);
+            double start = now();
+            run(line);
+            t[m] = now() - start;
+        }
+        printf("threads: %-34s threads %.2f GB/s, forked %.2f GB/s\n", cmd, bytes / t[0] / 1e9, bytes / t[1] / 1e9);
+    }
+
+    int rounds = 2000;
+    double t[2];
+    snprintf(cmd, sizeof(cmd), "cat <<< $i | wc > %s/out", dir);
+    for (int m = 0; m < 2; ++m) {
+        var_set("USH_THREADS", modes[m]);
+        char* loop = loop_line(rounds, cmd);
+        double start = now();
+        run(loop);
+        t[m] = (now() - start) / rounds;
+        free(loop);
+    }
+    printf("threads: %-34s threads %.1f us, forked %.1f us\n", "cat <<< $i | wc, latency", t[0] * 1e6, t[1] * 1e6);
+    var_unset("USH_THREADS");
+    remove_dir(dir);
+    free(dir);
+}
+
+// The find builtin over a tree of 'files' empty files in 1000 directories
+// three levels deep, with 1 to 8 workers, and GNU find for scale. The
+// tree is read once first, every run finds it in the cache.
+static void bench_find(int files) {
+    char* dir = make_temp_dir();
+    char path[256];
+    for (int i = 0; i < 1000; ++i) {
+        snprintf(path, sizeof(path), "%s/%d", dir, i / 100);
+        mkdir(path, 0755);
+        snprintf(path, sizeof(path), "%s/%d/%d", dir, i / 100, i / 10 % 10);
+        mkdir(path, 0755);
+        snprintf(path, sizeof(path), "%s/%d/%d/%d", dir, i / 100, i / 10 % 10, i % 10);
+        mkdir(path, 0755);
+    }
+    for (int i = 0; i < files; ++i) {
+        int d = i % 1000;
+        snprintf(path, sizeof(path), "%s/%d/%d/%d/file%d.c", dir, d / 100, d / 10 % 10, d % 10, i);
+        int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            perror(path);
+            break;
+        }
+        close(fd);
+    }
+
+    char line[768];
+    ush_trace = 0;
+    snprintf(line, sizeof(line), "find %s > %s.out", dir, dir);
+    run(line);
+    static const int jobs[] = { 1, 2, 4, 8 };
+    for (size_t k = 0; k < sizeof(jobs) / sizeof(jobs[0]); ++k) {
+        snprintf(line, sizeof(line), "find -j %d %s -name '*7.c' > %s.out", jobs[k], dir, dir);
+        double start = now();
+        run(line);
+        double t = now() - start;
+        printf("find: -j %d  %.0f ms, %.1f M entries/s\n", jobs[k], t * 1e3, files / t / 1e6);
+    }
+    snprintf(line, sizeof(line), "find %s -name '*7.c' > %s.out", dir, dir);
+    double start = now();
+    if (system(line) != 0) {
+        fprintf(stderr, "find: GNU find failed\n");
+    }
+    double t = now() - start;
+    printf("find: GNU   %.0f ms, %.1f M entries/s\n", t * 1e3, files / t / 1e6);
+    snprintf(path, sizeof(path), "%s.out", dir);
+    unlink(path);
+    remove_dir(dir);
+    free(dir);
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s complete|parse|parse-cache|script|expand|lex|glob|loop|call|serve|parallel|pipeline|jobs|tail|sort|grep|subst|cmdsubst|here|pwd|stream|check|threads|find [n]\n", argv[0]);
+        return 1;
+    }
+    if (!strcmp(argv[1], "complete")) {
+        bench_complete(argc > 2 ? atoi(argv[2]) : 10000);
+    } else if (!strcmp(argv[1], "parse")) {
+        bench_parse(argc > 2 ? atoi(argv[2]) : 200000);
+    } else if (!strcmp(argv[1], "parse-cache")) {
+        bench_parse_cache(argc > 2 ? atoi(argv[2]) : 1000000);
+    } else if (!strcmp(argv[1], "script")) {
+        bench_script(argc > 2 ? atoi(argv[2]) : 50000);
+    } else if (!strcmp(argv[1], "expand")) {
+        bench_expand(argc > 2 ? atoi(argv[2]) : 1000);
+    } else if (!strcmp(argv[1], "lex")) {
+        bench_lex(argc > 2 ? atoi(argv[2]) : 1 << 20);
+    } else if (!strcmp(argv[1], "glob")) {
+        bench_glob(argc > 2 ? atoi(argv[2]) : 200000);
+    } else if (!strcmp(argv[1], "loop")) {
+        bench_loop(argc > 2 ? atoi(argv[2]) : 1000000);
+    } else if (!strcmp(argv[1], "call")) {
+        bench_call(argc > 2 ? atoi(argv[2]) : 1000000);
+    } else if (!strcmp(argv[1], "serve")) {
+        bench_serve(argc > 2 ? atoi(argv[2]) : 20000);
+    } else if (!strcmp(argv[1], "parallel")) {
+        bench_parallel(argc > 2 ? atoi(argv[2]) : 200);
+    } else if (!strcmp(argv[1], "pipeline")) {
+        bench_pipeline(argc > 2 ? atoi(argv[2]) : 2000000);
+    } else if (!strcmp(argv[1], "jobs")) {
+        bench_jobs(argc > 2 ? atoi(argv[2]) : 2000);
+    } else if (!strcmp(argv[1], "tail")) {
+        bench_head_tail(argc > 2 ? atoi(argv[2]) : 10);
+    } else if (!strcmp(argv[1], "sort")) {
+        bench_sort(argc > 2 ? atoi(argv[2]) : 2000000);
+    } else if (!strcmp(argv[1], "grep")) {
+        bench_grep(argc > 2 ? atoi(argv[2]) : 256);
+    } else if (!strcmp(argv[1], "subst")) {
+        bench_subst(argc > 2 ? atoi(argv[2]) : 1024);
+    } else if (!strcmp(argv[1], "cmdsubst")) {
+        bench_cmdsubst(argc > 2 ? atoi(argv[2]) : 200000);
+    } else if (!strcmp(argv[1], "here")) {
+        bench_here(argc > 2 ? atoi(argv[2]) : 20000);
+    } else if (!strcmp(argv[1], "pwd")) {
+        bench_pwd(argc > 2 ? atoi(argv[2]) : 1000000);
+    } else if (!strcmp(argv[1], "stream")) {
+        bench_stream(argc > 2 ? atoi(argv[2]) : 500000);
+    } else if (!strcmp(argv[1], "check")) {
+        bench_check(argc > 2 ? atoi(argv[2]) : 2000);
+    } else if (!strcmp(argv[1], "threads")) {
+        bench_threads(argc > 2 ? atoi(argv[2]) : 256);
+    } else if (!strcmp(argv[1], "find")) {
+        bench_find(argc > 2 ? atoi(argv[2]) : 1000000);
+    } else {
+        fprintf(stderr, "unknown benchmark %s\n", argv[1]);
+        return 1;
+    }
+    return 0;
+}
\ No newline at end of file
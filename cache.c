@@ -0,0 +1,159 @@
+#include "parser.h"
+#include "cache.h"
+
+#define DEFAULT_CAPACITY 256
+
+static CacheEntry** buckets = NULL;
+static size_t n_buckets = 0;
+
+// Most and least recently used entries.
+static CacheEntry* head = NULL;
+static CacheEntry* tail = NULL;
+
+static CacheStats stats = {
+    .capacity = DEFAULT_CAPACITY
+};
+
+// FNV-1a.
+static unsigned long hash_line(const char* s) {
+    unsigned long h = 14695981039346656037UL;
+    for (; *s; ++s) {
+        h ^= (unsigned char)*s;
+        h *= 1099511628211UL;
+    }
+    return h;
+}
+
+static void delete_entry(CacheEntry* entry) {
+    delete_cmd(entry->cmd);
+    free(entry->source);
+    free(entry);
+}
+
+static void unlink_lru(CacheEntry* entry) {
+    if (entry->prev != NULL) entry->prev->next = entry->next;
+    else head = entry->next;
+    if (entry->next != NULL) entry->next->prev = entry->prev;
+    else tail = entry->prev;
+    entry->prev = entry->next = NULL;
+}
+
+static void push_lru(CacheEntry* entry) {
+    entry->prev = NULL;
+    entry->next = head;
+    if (head != NULL) head->prev = entry;
+    else tail = entry;
+    head = entry;
+}
+
+// Drop the entry from the table, it is freed once nobody uses it.
+static void evict(CacheEntry* entry) {
+    CacheEntry** link = &buckets[entry->hash & (n_buckets - 1)];
+    while (*link != entry) link = &(*link)->chain;
+    *link = entry->chain;
+    unlink_lru(entry);
+    entry->cached = 0;
+    stats.size--;
+    if (entry->refs == 0) delete_entry(entry);
+}
+
+// Keep about one entry per bucket.
+static void rehash(size_t capacity) {
+    size_t n = 16;
+    while (n < capacity) n *= 2;
+    if (n == n_buckets) return;
+
+    CacheEntry** old = buckets;
+    size_t n_old = n_buckets;
+    buckets = calloc(n, sizeof(CacheEntry*));
+    n_buckets = n;
+    for (size_t i = 0; i < n_old; ++i) {
+        CacheEntry* entry = old[i];
+        while (entry != NULL) {
+            CacheEntry* next = entry->chain;
+            CacheEntry** bucket = &buckets[entry->hash & (n - 1)];
+            entry->chain = *bucket;
+            *bucket = entry;
+            entry = next;
+        }
+    }
+    free(old);
+}
+
+static Cmd* parse_line(const char* source) {
+    Tokens* tokens = lex(source);
+    Cmd* cmd = parse(tokens);
+    delete_tokens(tokens);
+    return cmd;
+}
+
+CacheEntry* cache_acquire(const char* source) {
+    if (n_buckets == 0) rehash(stats.capacity);
+
+    unsigned long hash = hash_line(source);
+    for (CacheEntry* entry = buckets[hash & (n_buckets - 1)]; entry != NULL; entry = entry->chain) {
+        if (entry->hash == hash && !strcmp(entry->source, source)) {
+            stats.hits++;
+            unlink_lru(entry);
+            push_lru(entry);
+            entry->refs++;
+            return entry;
+        }
+    }
+
+    stats.misses++;
+    Cmd* cmd = parse_line(source);
+    if (cmd == NULL) {
+        return NULL;
+    }
+
+    CacheEntry* entry = malloc(sizeof(CacheEntry));
+    entry->hash = hash;
+    entry->source = strdup(source);
+    entry->cmd = cmd;
+    entry->refs = 1;
+    entry->cached = 0;
+    entry->prev = entry->next = entry->chain = NULL;
+    if (stats.capacity == 0) {
+        // Caching is off, the entry lives until it is released.
+        return entry;
+    }
+
+    if (stats.size == stats.capacity) {
+        stats.evictions++;
+        evict(tail);
+    }
+    CacheEntry** bucket = &buckets[hash & (n_buckets - 1)];
+    entry->chain = *bucket;
+    *bucket = entry;
+    entry->cached = 1;
+    push_lru(entry);
+    stats.size++;
+    return entry;
+}
+
+void cache_release(CacheEntry* entry) {
+    entry->refs--;
+    if (entry->refs == 0 && !entry->cached) {
+        delete_entry(entry);
+    }
+}
+
+void cache_resize(size_t capacity) {
+    while (stats.size > capacity) {
+        stats.evictions++;
+        evict(tail);
+    }
+    stats.capacity = capacity;
+    rehash(capacity);
+}
+
+void cache_clear(void) {
+    while (tail != NULL) {
+        evict(tail);
+    }
+}
+
+CacheStats cache_stats(void) {
+    return stats;
+}
\ No newline at end of file
@@ -0,0 +1,35 @@
+#include <stddef.h>
+
+struct Cmd;
+
+/// An entry of the parse cache: the tree parsed from 'source'.
+/// Trees are shared and must not be modified.
+typedef struct CacheEntry {
+    unsigned long hash;
+    char* source;
+    struct Cmd* cmd;
+    int refs;
+    int cached;                 // Still reachable from the table.
+    struct CacheEntry* prev;    // LRU order, most recent first.
+    struct CacheEntry* next;
+    struct CacheEntry* chain;   // Next entry in the same bucket.
+} CacheEntry;
+
+typedef struct {
+    size_t size;
+    size_t capacity;
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+} CacheStats;
+
+/// Return the parsed command of 'source', lexing and parsing it only
+/// if the same line is not in the cache. Returns NULL if parsing fails.
+/// The entry stays valid until released, even if it is evicted meanwhile.
+CacheEntry* cache_acquire(const char* source);
+void cache_release(CacheEntry* entry);
+
+/// Set the maximum number of cached lines, 0 disables the cache.
+void cache_resize(size_t capacity);
+void cache_clear(void);
+CacheStats cache_stats(void);
@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "parser.h"
+#include "deque.h"
+#include "check.h"
+
+/// A script is lexed and parsed whole, like a piped one: a NEWLINE
+/// separates its commands. Only the first error of a file is found.
+/// The files are dealt out to the workers' deques like the jobs of
+/// 'parallel', a worker which runs out steals from the others.
+
+typedef struct {
+    const char* path;
+    const char* error;      // NULL if the file parses.
+    int errnum;             // Why the file cannot be read, or 0.
+    size_t line;            // 0 if the file cannot be read.
+    size_t col;
+} Check;
+
+typedef struct {
+    Deque* deques;
+    size_t n;
+} Pool;
+
+typedef struct {
+    Pool* pool;
+    size_t self;
+} Worker;
+
+// The whole file, NUL-terminated, or NULL with errno set.
+static char* read_file(const char* path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return NULL;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        close(fd);
+        errno = EISDIR;
+        return NULL;
+    }
+    size_t cap = st.st_size > 0 ? (size_t)st.st_size + 1 : 4096;
+    size_t n = 0;
+    char* text = malloc(cap);
+    ssize_t got;
+    while ((got = read(fd, text + n, cap - n - 1)) != 0) {
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            int error = errno;
+            free(text);
+            close(fd);
+            errno = error;
+            return NULL;
+        }
+        n += got;
+        if (n + 1 == cap) {
+            cap *= 2;
+            text = realloc(text, cap);
+        }
+    }
+    close(fd);
+    text[n] = '\0';
+    return text;
+}
+
+static void check_file(Check* check) {
+    char* text = read_file(check->path);
+    if (text == NULL) {
+        check->errnum = errno;
+        return;
+    }
+    Tokens* tokens = lex(text);
+    // A file of comments and blank lines has nothing to parse.
+    size_t i = 0;
+    while (i < tokens->n && tokens->kinds[i] == NEWLINE) i++;
+    ParseError error = { NULL, 0 };
+    if (i < tokens->n || tokens->error != NULL) {
+        delete_cmd(parse_tokens(tokens, &error));
+    }
+    delete_tokens(tokens);
+
+    if (error.message != NULL) {
+        check->error = error.message;
+        check->line = 1;
+        size_t start = 0;
+        for (size_t k = 0; k < error.at; ++k) {
+            if (text[k] == '\n') {
+                check->line++;
+                start = k + 1;
+            }
+        }
+        check->col = error.at - start + 1;
+    }
+    free(text);
+}
+
+static void* work(void* arg) {
+    Worker* worker = arg;
+    Pool* pool = worker->pool;
+    void* p;
+    while (deque_take(pool->deques, pool->n, worker->self, &p) == 0) {
+        check_file(p);
+    }
+    return NULL;
+}
+
+static void print_json_string(const char* s) {
+    putchar('"');
+    for (; *s; ++s) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            printf("\\%c", c);
+        } else if (c < 0x20) {
+            printf("\\u%04x", c);
+        } else {
+            putchar(c);
+        }
+    }
+    putchar('"');
+}
+
+int check_files(size_t n, char** args) {
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t i = 0;
+    if (i < n && !strncmp(args[i], "-j", 2)) {
+        const char* value = args[i][2] ? args[i] + 2 : (i + 1 < n ? args[++i] : "");
+        char* end;
+        jobs = strtol(value, &end, 10);
+        if (*end != '\0' || jobs <= 0) {
+            fprintf(stderr, "ush -n: bad job count %s\n", value);
+            return 2;
+        }
+        i++;
+    }
+    size_t n_files = n - i;
+    if (n_files == 0) {
+        fprintf(stderr, "usage: ush -n [-j N] file...\n");
+        return 2;
+    }
+
+    Check* checks = malloc(n_files * sizeof(Check));
+    Pool pool = { NULL, jobs < (long)n_files ? (size_t)jobs : n_files };
+    pool.deques = malloc(pool.n * sizeof(Deque));
+    for (size_t k = 0; k < pool.n; ++k) {
+        deque_init(pool.deques + k);
+    }
+    // Backwards, so each worker pops its files in order.
+    for (size_t k = n_files; k-- > 0;) {
+        checks[k] = (Check){ args[i + k], NULL, 0, 0, 0 };
+        deque_push(pool.deques + k % pool.n, checks + k);
+    }
+
+    pthread_t* threads = malloc(pool.n * sizeof(pthread_t));
+    Worker* workers = malloc(pool.n * sizeof(Worker));
+    for (size_t k = 0; k < pool.n; ++k) {
+        workers[k] = (Worker){ &pool, k };
+        pthread_create(threads + k, NULL, work, workers + k);
+    }
+    // All of them before the deques go, the last ones may still steal.
+    for (size_t k = 0; k < pool.n; ++k) {
+        pthread_join(threads[k], NULL);
+    }
+    for (size_t k = 0; k < pool.n; ++k) {
+        deque_destroy(pool.deques + k);
+    }
+
+    int failed = 0;
+    for (size_t k = 0; k < n_files; ++k) {
+        Check* check = checks + k;
+        printf("{\"file\":");
+        print_json_string(check->path);
+        if (check->errnum != 0) {
+            check->error = strerror(check->errnum);
+        }
+        if (check->error == NULL) {
+            printf(",\"ok\":true}\n");
+            continue;
+        }
+        failed = 1;
+        printf(",\"ok\":false");
+        if (check->line > 0) {
+            printf(",\"line\":%zu,\"col\":%zu", check->line, check->col);
+            fprintf(stderr, "%s:%zu:%zu: %s\n", check->path, check->line, check->col, check->error);
+        } else {
+            fprintf(stderr, "%s: %s\n", check->path, check->error);
+        }
+        printf(",\"error\":");
+        print_json_string(check->error);
+        printf("}\n");
+    }
+
+    free(workers);
+    free(threads);
+    free(pool.deques);
+    free(checks);
+    return failed;
+}
\ No newline at end of file
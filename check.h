@@ -0,0 +1,15 @@
+#include <stddef.h>
+
+/// Syntax check: 'ush -n [-j N] file...' lexes and parses the files
+/// without running anything, N at a time on a pool of threads (N defaults
+/// to the number of cores).
+///
+/// For each file, in the order given, one line of JSON on stdout:
+///     {"file":"a.ush","ok":true}
+///     {"file":"b.ush","ok":false,"line":3,"col":7,"error":"expected 'done'"}
+/// The line and column count from 1, the column in bytes. A file which
+/// cannot be read has no line and column. The errors also go to stderr as
+/// file:line:col: error.
+///
+/// Returns 0 if every file parses, 1 if one does not, 2 on bad usage.
+int check_files(size_t n, char** args);
\ No newline at end of file
@@ -0,0 +1,236 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "complete.h"
+#include "dircache.h"
+
+const char* candidate(const Candidates* cands, size_t i) {
+    return cands->text + cands->offs[i];
+}
+
+void delete_candidates(Candidates* cands) {
+    free(cands->offs);
+    free(cands->text);
+    memset(cands, 0, sizeof(Candidates));
+}
+
+// Append a candidate made of 'a' followed by 'b'.
+static void add_candidate(Candidates* cands, const char* a, size_t la, const char* b, size_t lb) {
+    if (cands->n == cands->cap) {
+        cands->cap = cands->cap ? cands->cap * 2 : 64;
+        cands->offs = realloc(cands->offs, cands->cap * sizeof(size_t));
+    }
+    while (cands->len + la + lb + 1 > cands->room) {
+        cands->room = cands->room ? cands->room * 2 : 1024;
+        cands->text = realloc(cands->text, cands->room);
+    }
+    cands->offs[cands->n++] = cands->len;
+    memcpy(cands->text + cands->len, a, la);
+    memcpy(cands->text + cands->len + la, b, lb);
+    cands->len += la + lb;
+    cands->text[cands->len++] = '\0';
+}
+
+/// Prefix trie of command names.
+/// Nodes live in one pool and refer to each other by index,
+/// children are kept as a sorted sibling list.
+typedef struct {
+    char c;
+    char end;
+    int child;
+    int sibling;
+} Node;
+
+static Node* nodes = NULL;
+static int n_nodes = 0;
+static int cap_nodes = 0;
+
+static const char** path_dirs = NULL;
+static struct timespec* path_mtimes = NULL;
+static size_t n_path = 0;
+
+static char** names = NULL;
+static size_t n_names = 0;
+
+static int built = 0;
+
+static int new_node(char c) {
+    if (n_nodes == cap_nodes) {
+        cap_nodes = cap_nodes ? cap_nodes * 2 : 1024;
+        nodes = realloc(nodes, cap_nodes * sizeof(Node));
+    }
+    nodes[n_nodes].c = c;
+    nodes[n_nodes].end = 0;
+    nodes[n_nodes].child = -1;
+    nodes[n_nodes].sibling = -1;
+    return n_nodes++;
+}
+
+static void trie_insert(const char* name) {
+    int curr = 0;
+    for (const char* p = name; *p; ++p) {
+        // Find the child, keeping the siblings sorted.
+        int prev = -1;
+        int next = nodes[curr].child;
+        while (next >= 0 && nodes[next].c < *p) {
+            prev = next;
+            next = nodes[next].sibling;
+        }
+        if (next < 0 || nodes[next].c != *p) {
+            int node = new_node(*p);
+            nodes[node].sibling = next;
+            if (prev < 0) nodes[curr].child = node;
+            else nodes[prev].sibling = node;
+            next = node;
+        }
+        curr = next;
+    }
+    nodes[curr].end = 1;
+}
+
+static int trie_find(const char* prefix) {
+    int curr = 0;
+    for (const char* p = prefix; *p && curr >= 0; ++p) {
+        int next = nodes[curr].child;
+        while (next >= 0 && nodes[next].c < *p) {
+            next = nodes[next].sibling;
+        }
+        curr = (next >= 0 && nodes[next].c == *p) ? next : -1;
+    }
+    return curr;
+}
+
+// Depth first walk, 'word' holds the characters on the way down.
+static void trie_collect(int node, char** word, size_t depth, size_t* room, Candidates* cands) {
+    if (depth + 1 >= *room) {
+        *room *= 2;
+        *word = realloc(*word, *room);
+    }
+    if (nodes[node].end) {
+        add_candidate(cands, *word, depth, "", 0);
+    }
+    for (int child = nodes[node].child; child >= 0; child = nodes[child].sibling) {
+        (*word)[depth] = nodes[child].c;
+        trie_collect(child, word, depth + 1, room, cands);
+    }
+}
+
+static void stat_path(void) {
+    for (size_t i = 0; i < n_path; ++i) {
+        struct stat st;
+        if (stat(path_dirs[i], &st) < 0) {
+            memset(path_mtimes + i, 0, sizeof(struct timespec));
+        } else {
+            path_mtimes[i] = st.st_mtim;
+        }
+    }
+}
+
+static int path_changed(void) {
+    for (size_t i = 0; i < n_path; ++i) {
+        struct stat st;
+        struct timespec mtime = {0, 0};
+        if (stat(path_dirs[i], &st) == 0) {
+            mtime = st.st_mtim;
+        }
+        if (mtime.tv_sec != path_mtimes[i].tv_sec || mtime.tv_nsec != path_mtimes[i].tv_nsec) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void build(void) {
+    n_nodes = 0;
+    new_node(0);
+    stat_path();
+    for (size_t i = 0; i < n_path; ++i) {
+        DIR* d = opendir(path_dirs[i]);
+        if (d == NULL) continue;
+        struct dirent* e;
+        while ((e = readdir(d)) != NULL) {
+            if (e->d_name[0] == '.') continue;
+            if (e->d_type == DT_DIR) continue;
+            // Same check as the executor does before execv.
+            if (faccessat(dirfd(d), e->d_name, X_OK, 0) < 0) continue;
+            trie_insert(e->d_name);
+        }
+        closedir(d);
+    }
+    for (size_t i = 0; i < n_names; ++i) {
+        trie_insert(names[i]);
+    }
+    built = 1;
+}
+
+void complete_set_path(const char* const* dirs, size_t n) {
+    path_dirs = realloc(path_dirs, n * sizeof(char*));
+    path_mtimes = realloc(path_mtimes, n * sizeof(struct timespec));
+    memcpy(path_dirs, dirs, n * sizeof(char*));
+    n_path = n;
+    built = 0;
+}
+
+void complete_add_name(const char* name) {
+    names = realloc(names, (n_names + 1) * sizeof(char*));
+    names[n_names++] = strdup(name);
+    if (built) trie_insert(name);
+}
+
+size_t complete_command(const char* prefix, Candidates* cands) {
+    if (!built || path_changed()) {
+        build();
+    }
+    int node = trie_find(prefix);
+    if (node < 0) return 0;
+
+    size_t depth = strlen(prefix);
+    size_t room = depth + 64;
+    char* word = malloc(room);
+    memcpy(word, prefix, depth);
+    trie_collect(node, &word, depth, &room, cands);
+    free(word);
+    return cands->n;
+}
+
+size_t complete_file(const char* word, Candidates* cands) {
+    const char* slash = strrchr(word, '/');
+    const char* base = slash != NULL ? slash + 1 : word;
+    size_t dir_len = base - word;
+
+    const DirListing* dir;
+    if (slash == NULL) {
+        dir = dircache_get(".");
+    } else if (slash == word) {
+        dir = dircache_get("/");
+    } else {
+        char* path = strndup(word, dir_len);
+        dir = dircache_get(path);
+        free(path);
+    }
+    if (dir == NULL) return 0;
+
+    size_t len = strlen(base);
+    for (size_t i = dircache_lower_bound(dir, base); i < dir->n; ++i) {
+        const DirEntry* e = dir->entries + i;
+        if (strncmp(e->name, base, len)) break;
+        // Hidden files only when asked for.
+        if (e->name[0] == '.' && base[0] != '.') continue;
+        if (e->is_dir) {
+            // Append the slash to the name part.
+            size_t n = strlen(e->name);
+            char* name = malloc(n + 2);
+            memcpy(name, e->name, n);
+            name[n] = '/';
+            add_candidate(cands, word, dir_len, name, n + 1);
+            free(name);
+        } else {
+            add_candidate(cands, word, dir_len, e->name, strlen(e->name));
+        }
+    }
+    return cands->n;
+}
@@ -0,0 +1,29 @@
+#include <stddef.h>
+
+/// Completion candidates, stored in one block of text.
+typedef struct {
+    size_t n;
+    size_t cap;
+    size_t* offs;
+    char* text;
+    size_t len;
+    size_t room;
+} Candidates;
+
+const char* candidate(const Candidates* cands, size_t i);
+void delete_candidates(Candidates* cands);
+
+/// Directories searched for commands.
+/// The trie of executables is built on first use and rebuilt
+/// when the mtime of one of these directories changes.
+void complete_set_path(const char* const* dirs, size_t n);
+
+/// Names which are always offered as commands (e.g. builtins).
+void complete_add_name(const char* name);
+
+/// Fill 'cands' with the commands starting with 'prefix'.
+size_t complete_command(const char* prefix, Candidates* cands);
+
+/// Fill 'cands' with the files matching 'word', which may contain a directory.
+/// Directories get a trailing '/'.
+size_t complete_file(const char* word, Candidates* cands);
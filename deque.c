@@ -0,0 +1,65 @@
+#include <stdlib.h>
+#include <string.h>
+#include "deque.h"
+
+void deque_init(Deque* deque) {
+    pthread_mutex_init(&deque->lock, NULL);
+    deque->items = NULL;
+    deque->top = deque->bottom = deque->cap = 0;
+}
+
+void deque_destroy(Deque* deque) {
+    pthread_mutex_destroy(&deque->lock);
+    free(deque->items);
+}
+
+void deque_push(Deque* deque, void* item) {
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom == deque->cap) {
+        // Slide the live items down before growing.
+        size_t n = deque->bottom - deque->top;
+        if (deque->top > 0 && n * 2 <= deque->cap) {
+            memmove(deque->items, deque->items + deque->top, n * sizeof(void*));
+        } else {
+            deque->cap = deque->cap ? deque->cap * 2 : 64;
+            void** items = malloc(deque->cap * sizeof(void*));
+            if (n > 0) memcpy(items, deque->items + deque->top, n * sizeof(void*));
+            free(deque->items);
+            deque->items = items;
+        }
+        deque->top = 0;
+        deque->bottom = n;
+    }
+    deque->items[deque->bottom++] = item;
+    pthread_mutex_unlock(&deque->lock);
+}
+
+int deque_pop(Deque* deque, void** item) {
+    int result = -1;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom > deque->top) {
+        *item = deque->items[--deque->bottom];
+        result = 0;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return result;
+}
+
+int deque_steal(Deque* deque, void** item) {
+    int result = -1;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom > deque->top) {
+        *item = deque->items[deque->top++];
+        result = 0;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return result;
+}
+
+int deque_take(Deque* deques, size_t n, size_t self, void** item) {
+    if (deque_pop(deques + self, item) == 0) return 0;
+    for (size_t i = 1; i < n; ++i) {
+        if (deque_steal(deques + (self + i) % n, item) == 0) return 0;
+    }
+    return -1;
+}
\ No newline at end of file
@@ -0,0 +1,27 @@
+#include <stddef.h>
+#include <pthread.h>
+
+/// Work-stealing deque: the owner pushes and pops at the bottom (LIFO,
+/// the newest work is the warmest), thieves take from the top (FIFO,
+/// the oldest work tends to be the biggest). A mutex per deque keeps it
+/// simple, the lock is only contended while stealing.
+typedef struct {
+    pthread_mutex_t lock;
+    void** items;
+    size_t top;     // Next item to steal.
+    size_t bottom;  // One past the last item.
+    size_t cap;
+} Deque;
+
+void deque_init(Deque* deque);
+void deque_destroy(Deque* deque);
+
+void deque_push(Deque* deque, void* item);
+
+/// Return 0 and the item, or -1 if the deque is empty.
+int deque_pop(Deque* deque, void** item);
+int deque_steal(Deque* deque, void** item);
+
+/// Take from 'deques[self]', otherwise steal from the others, starting
+/// after 'self' so the thieves spread out. Returns -1 if all are empty.
+int deque_take(Deque* deques, size_t n, size_t self, void** item);
\ No newline at end of file
@@ -0,0 +1,151 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "dircache.h"
+
+// Number of directories kept in the cache.
+#define DIRCACHE_SIZE 16
+
+// Most recently used listing first.
+static DirListing* cache = NULL;
+static size_t n_cached = 0;
+
+static void delete_listing(DirListing* dir) {
+    free(dir->path);
+    free(dir->entries);
+    free(dir->names);
+    free(dir);
+}
+
+static int cmp_entry(const void* a, const void* b) {
+    return strcmp(((const DirEntry*)a)->name, ((const DirEntry*)b)->name);
+}
+
+// Read the whole directory into one block of names.
+static int scan(DirListing* dir, const char* path) {
+    DIR* d = opendir(path);
+    if (d == NULL) return -1;
+
+    size_t n = 0, cap = 64;
+    size_t used = 0, room = 1024;
+    // Offsets into the name block, fixed up once the block stops moving.
+    size_t* offs = malloc(cap * sizeof(size_t));
+    int* dirs = malloc(cap * sizeof(int));
+    char* names = malloc(room);
+
+    struct dirent* e;
+    while ((e = readdir(d)) != NULL) {
+        if (!strcmp(e->d_name, ".") || !strcmp(e->d_name, "..")) continue;
+        size_t len = strlen(e->d_name) + 1;
+        if (n == cap) {
+            cap *= 2;
+            offs = realloc(offs, cap * sizeof(size_t));
+            dirs = realloc(dirs, cap * sizeof(int));
+        }
+        while (used + len > room) {
+            room *= 2;
+            names = realloc(names, room);
+        }
+        memcpy(names + used, e->d_name, len);
+        offs[n] = used;
+        if (e->d_type == DT_DIR) {
+            dirs[n] = 1;
+        } else if (e->d_type == DT_UNKNOWN || e->d_type == DT_LNK) {
+            // Follow links so that a link to a directory completes as one.
+            struct stat st;
+            dirs[n] = fstatat(dirfd(d), e->d_name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+        } else {
+            dirs[n] = 0;
+        }
+        used += len;
+        n++;
+    }
+    closedir(d);
+
+    dir->n = n;
+    dir->names = names;
+    dir->entries = malloc((n + 1) * sizeof(DirEntry));
+    for (size_t i = 0; i < n; ++i) {
+        dir->entries[i].name = names + offs[i];
+        dir->entries[i].is_dir = dirs[i];
+    }
+    free(offs);
+    free(dirs);
+    qsort(dir->entries, n, sizeof(DirEntry), cmp_entry);
+    return 0;
+}
+
+static int same_time(const struct timespec* a, const struct timespec* b) {
+    return a->tv_sec == b->tv_sec && a->tv_nsec == b->tv_nsec;
+}
+
+const DirListing* dircache_get(const char* path) {
+    struct stat st;
+    if (stat(path, &st) < 0 || !S_ISDIR(st.st_mode)) {
+        return NULL;
+    }
+
+    DirListing* prev = NULL;
+    for (DirListing* dir = cache; dir != NULL; prev = dir, dir = dir->next) {
+        if (strcmp(dir->path, path)) continue;
+        // Unlink it, it will be pushed to the front again.
+        if (prev != NULL) prev->next = dir->next;
+        else cache = dir->next;
+        n_cached--;
+        if (dir->dev == st.st_dev && dir->ino == st.st_ino && same_time(&dir->mtime, &st.st_mtim)) {
+            dir->next = cache;
+            cache = dir;
+            n_cached++;
+            return dir;
+        }
+        // Stale listing.
+        delete_listing(dir);
+        break;
+    }
+
+    DirListing* dir = malloc(sizeof(DirListing));
+    dir->path = strdup(path);
+    dir->dev = st.st_dev;
+    dir->ino = st.st_ino;
+    dir->mtime = st.st_mtim;
+    if (scan(dir, path) < 0) {
+        free(dir->path);
+        free(dir);
+        return NULL;
+    }
+
+    // Evict the least recently used listing.
+    if (n_cached == DIRCACHE_SIZE) {
+        DirListing** last = &cache;
+        while ((*last)->next != NULL) last = &(*last)->next;
+        delete_listing(*last);
+        *last = NULL;
+        n_cached--;
+    }
+    dir->next = cache;
+    cache = dir;
+    n_cached++;
+    return dir;
+}
+
+size_t dircache_lower_bound(const DirListing* dir, const char* prefix) {
+    size_t lo = 0, hi = dir->n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(dir->entries[mid].name, prefix) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+void dircache_clear(void) {
+    while (cache != NULL) {
+        DirListing* next = cache->next;
+        delete_listing(cache);
+        cache = next;
+    }
+    n_cached = 0;
+}
@@ -0,0 +1,30 @@
+#include <stddef.h>
+#include <time.h>
+#include <sys/types.h>
+
+typedef struct {
+    const char* name;
+    int is_dir;
+} DirEntry;
+
+/// A sorted snapshot of one directory.
+/// The listing is rescanned when the mtime of the directory changes.
+typedef struct DirListing {
+    char* path;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    size_t n;
+    DirEntry* entries;
+    char* names;
+    struct DirListing* next;
+} DirListing;
+
+/// Returns the listing of 'path', or NULL if it cannot be read.
+/// The listing stays valid until the next call of dircache_get.
+const DirListing* dircache_get(const char* path);
+
+/// Index of the first entry not less than 'prefix'.
+size_t dircache_lower_bound(const DirListing* dir, const char* prefix);
+
+void dircache_clear(void);
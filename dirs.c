@@ -0,0 +1,312 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "ush.h"
+#include "vars.h"
+#include "dirs.h"
+
+/// cd [-L | -P] [dir | -]
+/// pwd [-L | -P]
+/// pushd [dir]
+/// popd
+/// dirs [-c]
+///
+/// A relative dir is looked for in the directories of $CDPATH first.
+/// 'cd -' goes back to $OLDPWD. pushd saves the current directory on a
+/// stack before changing to dir, or swaps it with the one on top, popd
+/// changes back to the top one and drops it.
+
+// The directories saved by pushd, the top one last.
+static char** stack = NULL;
+static size_t depth = 0;
+
+// Whether the path has a '.' or '..' component.
+static int has_dots(const char* path) {
+    for (const char* p = path; *p; ++p) {
+        if (p[0] == '.' && (p == path || p[-1] == '/')) {
+            size_t n = p[1] == '.' ? 2 : 1;
+            if (p[n] == '/' || p[n] == '\0') return 1;
+        }
+    }
+    return 0;
+}
+
+void dirs_init(void) {
+    const char* pwd = var_get("PWD");
+    struct stat a, b;
+    if (pwd == NULL || pwd[0] != '/' || has_dots(pwd) ||
+        stat(pwd, &a) < 0 || stat(".", &b) < 0 ||
+        a.st_dev != b.st_dev || a.st_ino != b.st_ino) {
+        // Allocated to size, the path may be longer than PATH_MAX.
+        char* cwd = getcwd(NULL, 0);
+        if (cwd != NULL) {
+            var_set("PWD", cwd);
+            free(cwd);
+        }
+    }
+    var_export("PWD");
+    var_export("OLDPWD");
+}
+
+// The logical working directory, malloc'ed.
+static char* current(void) {
+    const char* pwd = var_get("PWD");
+    if (pwd != NULL && pwd[0] == '/') return strdup(pwd);
+    char* cwd = getcwd(NULL, 0);
+    return cwd != NULL ? cwd : strdup(".");
+}
+
+// Make 'path' absolute from $PWD and drop its '.' and '..' components,
+// '..' removes the component before it.
+static char* logical(const char* path) {
+    char* base = path[0] == '/' ? strdup("") : current();
+    size_t len = strlen(base);
+    char* out = malloc(len + strlen(path) + 3);
+    memcpy(out, base, len);
+    free(base);
+    while (len > 0 && out[len - 1] == '/') len--;
+    const char* p = path;
+    while (*p) {
+        while (*p == '/') p++;
+        size_t n = strcspn(p, "/");
+        if (n == 0 || (n == 1 && p[0] == '.')) {
+            // Nothing to add.
+        } else if (n == 2 && p[0] == '.' && p[1] == '.') {
+            while (len > 0 && out[len - 1] != '/') len--;
+            if (len > 0) len--;
+        } else {
+            out[len++] = '/';
+            memcpy(out + len, p, n);
+            len += n;
+        }
+        p += n;
+    }
+    if (len == 0) out[len++] = '/';
+    out[len] = '\0';
+    return out;
+}
+
+// chdir, which also takes a path longer than PATH_MAX: it is followed in
+// pieces, and the directory is restored if a piece fails.
+static int change_dir(const char* path) {
+    if (chdir(path) == 0) return 0;
+    if (errno != ENAMETOOLONG) return -1;
+    int saved = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (saved < 0) return -1;
+    const char* p = path;
+    int failed = *p == '/' && chdir("/") < 0;
+    while (!failed && *p) {
+        while (*p == '/') p++;
+        size_t n = strlen(p);
+        if (n >= PATH_MAX) {
+            // The longest run of whole components which fits.
+            n = PATH_MAX - 1;
+            while (n > 0 && p[n] != '/') n--;
+        }
+        if (n == 0) {
+            errno = ENAMETOOLONG;
+            failed = 1;
+            break;
+        }
+        char* piece = strndup(p, n);
+        failed = chdir(piece) < 0;
+        free(piece);
+        p += n;
+    }
+    int error = errno;
+    if (failed && fchdir(saved) < 0) {
+        fprintf(stderr, "cd: cannot restore the directory, %s\n", strerror(errno));
+    }
+    close(saved);
+    errno = error;
+    return failed ? -1 : 0;
+}
+
+// The directory of $CDPATH which has 'dir', malloc'ed, or NULL. Sets
+// '*print' unless it was found through an empty entry, the current
+// directory.
+static char* search_cdpath(const char* dir, int* print) {
+    const char* cdpath = var_get("CDPATH");
+    if (cdpath == NULL || dir[0] == '/' ||
+        (dir[0] == '.' && (dir[1] == '\0' || dir[1] == '/')) ||
+        (dir[0] == '.' && dir[1] == '.' && (dir[2] == '\0' || dir[2] == '/'))) {
+        return NULL;
+    }
+    for (const char* p = cdpath;; ++p) {
+        size_t n = strcspn(p, ":");
+        char* path = malloc(n + strlen(dir) + 3);
+        if (n == 0) {
+            sprintf(path, "./%s", dir);
+        } else {
+            sprintf(path, "%.*s/%s", (int)n, p, dir);
+        }
+        struct stat st;
+        if (stat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+            *print = n > 0;
+            return path;
+        }
+        free(path);
+        p += n;
+        if (*p == '\0') return NULL;
+    }
+}
+
+// Change to 'dir' and update $PWD and $OLDPWD, returns the status.
+static int cd_to(const char* dir, int physical, int print) {
+    char* path = search_cdpath(dir, &print);
+    if (path == NULL) path = strdup(dir);
+    char* target = physical ? NULL : logical(path);
+    if (target == NULL || change_dir(target) < 0) {
+        // A '..' after a link may name nothing, try the path as it is.
+        free(target);
+        target = NULL;
+        if (change_dir(path) < 0) {
+            fprintf(stderr, "cd: %s: %s\n", dir, strerror(errno));
+            free(path);
+            return 1;
+        }
+        target = getcwd(NULL, 0);
+        if (target == NULL) target = logical(path);
+    }
+    free(path);
+
+    char* old = current();
+    var_set("OLDPWD", old);
+    var_set("PWD", target);
+    free(old);
+    if (print) printf("%s\n", target);
+    free(target);
+    return 0;
+}
+
+int simple_cd(size_t n, char** words) {
+    int physical = 0;
+    size_t i = 1;
+    for (; i < n && words[i][0] == '-' && words[i][1] != '\0'; ++i) {
+        if (!strcmp(words[i], "-L")) {
+            physical = 0;
+        } else if (!strcmp(words[i], "-P")) {
+            physical = 1;
+        } else if (!strcmp(words[i], "--")) {
+            i++;
+            break;
+        } else {
+            fprintf(stderr, "usage: cd [-L | -P] [dir | -]\n");
+            return 2;
+        }
+    }
+    if (n - i > 1) {
+        fprintf(stderr, "cd: too many arguments\n");
+        return 1;
+    }
+    const char* dir = i < n ? words[i] : var_get("HOME");
+    int print = 0;
+    if (dir == NULL) {
+        fprintf(stderr, "cd: HOME not set\n");
+        return 1;
+    }
+    if (i < n && !strcmp(dir, "-")) {
+        dir = var_get("OLDPWD");
+        if (dir == NULL) {
+            fprintf(stderr, "cd: OLDPWD not set\n");
+            return 1;
+        }
+        print = 1;
+    }
+    return cd_to(dir, physical, print);
+}
+
+int simple_pwd(size_t n, char** words) {
+    if (n > 1 && !strcmp(words[1], "-P")) {
+        char* cwd = getcwd(NULL, 0);
+        if (cwd == NULL) {
+            fprintf(stderr, "pwd: %s\n", strerror(errno));
+            return 1;
+        }
+        printf("%s\n", cwd);
+        free(cwd);
+        return 0;
+    }
+    char* pwd = current();
+    printf("%s\n", pwd);
+    free(pwd);
+    return 0;
+}
+
+// A directory under $HOME is shown as '~/...'.
+static void print_dir(const char* dir, const char* end) {
+    const char* home = var_get("HOME");
+    size_t n = home != NULL ? strlen(home) : 0;
+    if (n > 1 && !strncmp(dir, home, n) && (dir[n] == '/' || dir[n] == '\0')) {
+        printf("~%s%s", dir + n, end);
+    } else {
+        printf("%s%s", dir, end);
+    }
+}
+
+static void print_stack(void) {
+    char* pwd = current();
+    print_dir(pwd, depth > 0 ? " " : "\n");
+    free(pwd);
+    for (size_t i = depth; i > 0; --i) {
+        print_dir(stack[i - 1], i > 1 ? " " : "\n");
+    }
+}
+
+int simple_pushd(size_t n, char** words) {
+    if (n > 2) {
+        fprintf(stderr, "usage: pushd [dir]\n");
+        return 2;
+    }
+    if (n == 1 && depth == 0) {
+        fprintf(stderr, "pushd: no other directory\n");
+        return 1;
+    }
+    char* here = current();
+    if (cd_to(n == 1 ? stack[depth - 1] : words[1], 0, 0) != 0) {
+        free(here);
+        return 1;
+    }
+    if (n == 1) {
+        // Swap with the top one.
+        free(stack[depth - 1]);
+        stack[depth - 1] = here;
+    } else {
+        stack = realloc(stack, (depth + 1) * sizeof(char*));
+        stack[depth++] = here;
+    }
+    print_stack();
+    return 0;
+}
+
+int simple_popd(size_t n, char** words) {
+    if (depth == 0) {
+        fprintf(stderr, "popd: directory stack empty\n");
+        return 1;
+    }
+    if (cd_to(stack[depth - 1], 0, 0) != 0) {
+        return 1;
+    }
+    free(stack[--depth]);
+    print_stack();
+    return 0;
+}
+
+int simple_dirs(size_t n, char** words) {
+    if (n == 2 && !strcmp(words[1], "-c")) {
+        while (depth > 0) free(stack[--depth]);
+        return 0;
+    }
+    if (n > 1) {
+        fprintf(stderr, "usage: dirs [-c]\n");
+        return 2;
+    }
+    print_stack();
+    return 0;
+}
\ No newline at end of file
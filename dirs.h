@@ -0,0 +1,8 @@
+/// The working directory as the user named it: $PWD keeps the path cd was
+/// given, symbolic links and all, and '..' goes back up that path rather
+/// than to the parent of the link's target. pwd prints it without asking
+/// the kernel.
+
+/// Keep an inherited $PWD if it names the current directory, otherwise
+/// set it from getcwd. Call it after vars_init.
+void dirs_init(void);
\ No newline at end of file
@@ -0,0 +1,406 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "ush.h"
+#include "deque.h"
+
+/// find [-j N] [path...] [-name pattern] [-type c] [-mtime [+-]N] [-print0]
+///
+/// Prints the paths under each path, "." by default, itself included,
+/// which pass every test: -name matches the last part of the path with
+/// the shell pattern, -type its kind (f, d, l, p, s, c or b), -mtime the
+/// days since it was modified, rounded down, more than N with +N and
+/// less with -N. The paths end with a newline, or a NUL with -print0.
+/// Symbolic links are not followed.
+///
+/// The directories are walked by N threads, N defaults to the number of
+/// cores. Each one reads a directory with getdents64 and pushes the ones
+/// it holds on its deque, an idle worker steals from the others. A
+/// directory is opened with openat from its parent, and the tests stat
+/// by name within it, the kernel never walks a whole path again. The
+/// paths are printed in no particular order, each worker batches them
+/// and writes whole batches to the output.
+
+#define DENTS 32768
+#define BATCH 65536
+
+typedef enum {
+    TEST_NAME,
+    TEST_TYPE,
+    TEST_MTIME
+} TestKind;
+
+typedef struct {
+    TestKind kind;
+    const char* pattern;
+    unsigned char type;     // DT_*.
+    int cmp;                // -1, 0 or 1 for -N, N and +N.
+    long days;
+} Test;
+
+// A directory to read. Its fd stays open until every directory in it
+// was opened, each of them holds a reference.
+typedef struct Dir {
+    struct Dir* parent;
+    int fd;
+    int refs;
+    const char* name;       // Within 'path'.
+    char path[];
+} Dir;
+
+typedef struct {
+    Test* tests;
+    size_t n_tests;
+    char end;               // After each path.
+    time_t now;
+    FILE* out;
+
+    Deque* deques;
+    size_t n;
+    pthread_mutex_t lock;
+    pthread_cond_t more;
+    size_t generation;      // Bumped whenever directories were pushed.
+    size_t pending;         // Directories pushed and not read yet, atomic.
+    size_t waiting;         // Idle workers, atomic.
+    int stop;               // Nothing reads the output any more.
+    int failed;
+} Pool;
+
+typedef struct {
+    Pool* pool;
+    size_t self;
+    char* batch;
+    size_t len;
+} Worker;
+
+static Dir* new_dir(Dir* parent, const char* path, size_t len, const char* name) {
+    size_t name_len = strlen(name);
+    // "/" does not get another slash.
+    int slash = parent != NULL && len > 0 && path[len - 1] != '/';
+    Dir* dir = malloc(sizeof(Dir) + len + slash + name_len + 1);
+    dir->parent = parent;
+    dir->fd = -1;
+    dir->refs = 1;
+    memcpy(dir->path, path, len);
+    if (slash) dir->path[len] = '/';
+    memcpy(dir->path + len + slash, name, name_len + 1);
+    dir->name = parent != NULL ? dir->path + len + slash : dir->path;
+    if (parent != NULL) __atomic_add_fetch(&parent->refs, 1, __ATOMIC_RELAXED);
+    return dir;
+}
+
+static void release(Dir* dir) {
+    if (__atomic_sub_fetch(&dir->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        if (dir->fd >= 0) close(dir->fd);
+        free(dir);
+    }
+}
+
+static void flush_batch(Worker* worker) {
+    Pool* pool = worker->pool;
+    if (worker->len == 0) return;
+    // One call, the stream's lock keeps the batches whole.
+    if (!__atomic_load_n(&pool->stop, __ATOMIC_RELAXED) &&
+        fwrite(worker->batch, 1, worker->len, pool->out) != worker->len) {
+        __atomic_store_n(&pool->stop, 1, __ATOMIC_RELAXED);
+    }
+    worker->len = 0;
+}
+
+// Add 'dir/name' to the batch of the worker.
+static void print_path(Worker* worker, const char* dir, size_t len, const char* name) {
+    Pool* pool = worker->pool;
+    size_t name_len = strlen(name);
+    int slash = len > 0 && dir[len - 1] != '/';
+    size_t need = len + slash + name_len + 1;
+    if (worker->len + need > BATCH) flush_batch(worker);
+    if (need > BATCH) {
+        // Longer than a batch, written in parts under the stream's lock.
+        flockfile(pool->out);
+        fwrite_unlocked(dir, 1, len, pool->out);
+        if (slash) putc_unlocked('/', pool->out);
+        fwrite_unlocked(name, 1, name_len, pool->out);
+        putc_unlocked(pool->end, pool->out);
+        funlockfile(pool->out);
+        return;
+    }
+    char* p = worker->batch + worker->len;
+    memcpy(p, dir, len);
+    if (slash) p[len] = '/';
+    memcpy(p + len + slash, name, name_len);
+    p[need - 1] = pool->end;
+    worker->len += need;
+}
+
+// Whether the entry 'name' of 'dirfd' passes the tests. Its type comes
+// from the directory when it is known there, 'st' is only filled in
+// when a test needs it.
+static int passes(const Pool* pool, int dirfd, const char* name, const char* base,
+        unsigned char* type, struct stat* st, int* have_stat) {
+    for (size_t i = 0; i < pool->n_tests; ++i) {
+        const Test* test = pool->tests + i;
+        if (test->kind == TEST_NAME) {
+            if (fnmatch(test->pattern, base, 0) != 0) return 0;
+            continue;
+        }
+        if (!*have_stat && (test->kind == TEST_MTIME || *type == DT_UNKNOWN)) {
+            if (fstatat(dirfd, name, st, AT_SYMLINK_NOFOLLOW) < 0) return 0;
+            *have_stat = 1;
+            *type = IFTODT(st->st_mode);
+        }
+        if (test->kind == TEST_TYPE) {
+            if (*type != test->type) return 0;
+        } else {
+            long days = (long)((pool->now - st->st_mtime) / 86400);
+            int cmp = days < test->days ? -1 : days > test->days;
+            if (cmp != test->cmp) return 0;
+        }
+    }
+    return 1;
+}
+
+// Let the idle workers steal the directories pushed so far, rather than
+// wait until the whole directory was read.
+static void wake_idle(Pool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->generation++;
+    pthread_cond_broadcast(&pool->more);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Read the directory, print what passes and push the directories in it.
+// Each one is counted before it is pushed: another worker may steal and
+// read it before this one is done. Returns how many were pushed.
+static size_t read_dir(Worker* worker, Dir* dir) {
+    Pool* pool = worker->pool;
+    int at = dir->parent != NULL ? dir->parent->fd : AT_FDCWD;
+    int fd = openat(at, dir->name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (dir->parent != NULL) {
+        release(dir->parent);
+        dir->parent = NULL;
+    }
+    if (fd < 0) {
+        fprintf(stderr, "find: %s: %s\n", dir->path, strerror(errno));
+        __atomic_store_n(&pool->failed, 1, __ATOMIC_RELAXED);
+        release(dir);
+        return 0;
+    }
+    dir->fd = fd;
+
+    size_t len = strlen(dir->path);
+    size_t pushed = 0, woken = 0;
+    char buf[DENTS];
+    ssize_t got;
+    while ((got = getdents64(fd, buf, sizeof(buf))) > 0) {
+        for (ssize_t off = 0; off < got;) {
+            struct dirent64* entry = (struct dirent64*)(buf + off);
+            off += entry->d_reclen;
+            const char* name = entry->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+
+            unsigned char type = entry->d_type;
+            struct stat st;
+            int have_stat = 0;
+            if (passes(pool, fd, name, name, &type, &st, &have_stat)) {
+                print_path(worker, dir->path, len, name);
+            }
+            if (type == DT_UNKNOWN && fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+                type = IFTODT(st.st_mode);
+            }
+            if (type == DT_DIR) {
+                __atomic_fetch_add(&pool->pending, 1, __ATOMIC_RELAXED);
+                deque_push(pool->deques + worker->self, new_dir(dir, dir->path, len, name));
+                pushed++;
+            }
+        }
+        if (pushed > woken && __atomic_load_n(&pool->waiting, __ATOMIC_RELAXED) > 0) {
+            wake_idle(pool);
+            woken = pushed;
+        }
+    }
+    if (got < 0) {
+        fprintf(stderr, "find: %s: %s\n", dir->path, strerror(errno));
+        __atomic_store_n(&pool->failed, 1, __ATOMIC_RELAXED);
+    }
+    release(dir);
+    return pushed;
+}
+
+static void* work(void* arg) {
+    Worker* worker = arg;
+    Pool* pool = worker->pool;
+    worker->batch = malloc(BATCH);
+    worker->len = 0;
+    pthread_mutex_lock(&pool->lock);
+    while (__atomic_load_n(&pool->pending, __ATOMIC_RELAXED) > 0 &&
+            !__atomic_load_n(&pool->stop, __ATOMIC_RELAXED)) {
+        size_t generation = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+        void* p;
+        if (deque_take(pool->deques, pool->n, worker->self, &p) == 0) {
+            size_t pushed = read_dir(worker, p);
+            pthread_mutex_lock(&pool->lock);
+            size_t left = __atomic_sub_fetch(&pool->pending, 1, __ATOMIC_RELAXED);
+            pool->generation++;
+            if (__atomic_load_n(&pool->waiting, __ATOMIC_RELAXED) > 0 && (pushed > 0 || left == 0)) {
+                pthread_cond_broadcast(&pool->more);
+            }
+            continue;
+        }
+        // Everything left is being read, wait for what it pushes.
+        pthread_mutex_lock(&pool->lock);
+        __atomic_add_fetch(&pool->waiting, 1, __ATOMIC_RELAXED);
+        while (pool->generation == generation && __atomic_load_n(&pool->pending, __ATOMIC_RELAXED) > 0) {
+            pthread_cond_wait(&pool->more, &pool->lock);
+        }
+        __atomic_sub_fetch(&pool->waiting, 1, __ATOMIC_RELAXED);
+    }
+    // Out of the loop on 'stop' too, the others must not wait for this one.
+    pthread_cond_broadcast(&pool->more);
+    pthread_mutex_unlock(&pool->lock);
+    flush_batch(worker);
+    free(worker->batch);
+    return NULL;
+}
+
+static int usage(void) {
+    fprintf(stderr, "usage: find [-j N] [path...] [-name pattern] [-type c] [-mtime [+-]N] [-print0]\n");
+    return 2;
+}
+
+// Parse the tests from 'words[i]' on, returns the number or -1.
+static long parse_tests(size_t i, size_t n, char** words, Pool* pool) {
+    pool->tests = malloc(n * sizeof(Test));
+    pool->n_tests = 0;
+    pool->end = '\n';
+    for (; i < n; ++i) {
+        const char* value = i + 1 < n ? words[i + 1] : NULL;
+        Test test;
+        if (!strcmp(words[i], "-print")) {
+            continue;
+        } else if (!strcmp(words[i], "-print0")) {
+            pool->end = '\0';
+            continue;
+        } else if (!strcmp(words[i], "-name") && value != NULL) {
+            test = (Test){ .kind = TEST_NAME, .pattern = value };
+        } else if (!strcmp(words[i], "-type") && value != NULL && strlen(value) == 1 && strchr("fdlpscb", value[0])) {
+            static const unsigned char types[] = { DT_REG, DT_DIR, DT_LNK, DT_FIFO, DT_SOCK, DT_CHR, DT_BLK };
+            test = (Test){ .kind = TEST_TYPE, .type = types[strchr("fdlpscb", value[0]) - "fdlpscb"] };
+        } else if (!strcmp(words[i], "-mtime") && value != NULL) {
+            test = (Test){ .kind = TEST_MTIME };
+            const char* digits = value;
+            if (*digits == '+' || *digits == '-') {
+                test.cmp = *digits == '+' ? 1 : -1;
+                digits++;
+            }
+            char* end;
+            test.days = strtol(digits, &end, 10);
+            if (*digits < '0' || *digits > '9' || *end != '\0') {
+                fprintf(stderr, "find: bad -mtime %s\n", value);
+                return -1;
+            }
+        } else {
+            usage();
+            return -1;
+        }
+        pool->tests[pool->n_tests++] = test;
+        i++;
+    }
+    return (long)pool->n_tests;
+}
+
+int simple_find(size_t n, char** words){
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t i = 1;
+    if (i < n && !strncmp(words[i], "-j", 2)) {
+        const char* value = words[i][2] ? words[i] + 2 : (i + 1 < n ? words[++i] : "");
+        char* end;
+        jobs = strtol(value, &end, 10);
+        if (*end != '\0' || jobs <= 0) {
+            fprintf(stderr, "find: bad job count %s\n", value);
+            return 2;
+        }
+        i++;
+    }
+    size_t first = i;
+    while (i < n && (words[i][0] != '-' || words[i][1] == '\0')) i++;
+    size_t n_paths = i - first;
+
+    Pool pool = { .n = (size_t)jobs, .now = time(NULL), .out = builtin_stdout() };
+    if (parse_tests(i, n, words, &pool) < 0) {
+        free(pool.tests);
+        return 2;
+    }
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.more, NULL);
+    pool.deques = malloc(pool.n * sizeof(Deque));
+    for (size_t k = 0; k < pool.n; ++k) {
+        deque_init(pool.deques + k);
+    }
+
+    // The paths themselves are tested here, the directories among them
+    // are dealt out to the workers.
+    Worker self = { &pool, 0, malloc(BATCH), 0 };
+    static char* dot[] = { "." };
+    char** paths = n_paths > 0 ? words + first : dot;
+    size_t n_roots = n_paths > 0 ? n_paths : 1;
+    for (size_t k = 0; k < n_roots; ++k) {
+        const char* path = paths[k];
+        struct stat st;
+        if (fstatat(AT_FDCWD, path, &st, AT_SYMLINK_NOFOLLOW) < 0) {
+            fprintf(stderr, "find: %s: %s\n", path, strerror(errno));
+            pool.failed = 1;
+            continue;
+        }
+        unsigned char type = IFTODT(st.st_mode);
+        int have_stat = 1;
+        const char* base = strrchr(path, '/');
+        base = base != NULL && base[1] != '\0' ? base + 1 : path;
+        if (passes(&pool, AT_FDCWD, path, base, &type, &st, &have_stat)) {
+            print_path(&self, "", 0, path);
+        }
+        if (S_ISDIR(st.st_mode)) {
+            deque_push(pool.deques + pool.pending++ % pool.n, new_dir(NULL, "", 0, path));
+        }
+    }
+    flush_batch(&self);
+    free(self.batch);
+
+    pthread_t* threads = malloc(pool.n * sizeof(pthread_t));
+    Worker* workers = malloc(pool.n * sizeof(Worker));
+    for (size_t k = 0; k < pool.n; ++k) {
+        workers[k] = (Worker){ &pool, k, NULL, 0 };
+        pthread_create(threads + k, NULL, work, workers + k);
+    }
+    for (size_t k = 0; k < pool.n; ++k) {
+        pthread_join(threads[k], NULL);
+    }
+    // What is left after a write failed.
+    for (size_t k = 0; k < pool.n; ++k) {
+        void* p;
+        while (deque_pop(pool.deques + k, &p) == 0) {
+            Dir* dir = p;
+            if (dir->parent != NULL) release(dir->parent);
+            free(dir);
+        }
+        deque_destroy(pool.deques + k);
+    }
+    fflush(pool.out);
+
+    free(workers);
+    free(threads);
+    free(pool.deques);
+    free(pool.tests);
+    pthread_mutex_destroy(&pool.lock);
+    pthread_cond_destroy(&pool.more);
+    return pool.failed || pool.stop;
+}
\ No newline at end of file
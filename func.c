@@ -1,96 +1,221 @@
 #include "ush.h"
 #include "parser.h"
+#include "cache.h"
+#include "vars.h"
+#include "jobs.h"
 
-void simple_ls(size_t n, char** words){
-	char cwd[1024];
-    if(getcwd(cwd, 1024) == NULL){
-        fprintf(stderr, "%s\n", strerror(errno));
-        exit(-1);
-    }
-    else{
-        DIR* dir;
-        struct dirent* Dirent;
-        if((dir = opendir(cwd)) == NULL){
-            fprintf(stderr, "%s\n", strerror(errno));
-            exit(-1);
-        }
-        else{
-            while((Dirent = readdir(dir)) != NULL){
-                fprintf(stdout, "%s\n", Dirent->d_name);
-            }
-        }
-    }
-}
-
-void simple_pwd(size_t n, char** words){
-	char cwd[1024];
-    if(getcwd(cwd, 1024) == NULL){
-        fprintf(stderr, "%s\n", strerror(errno));
-        exit(-1);
-    }
-    else{
-        fprintf(stdout, "%s\n", cwd);
-    }
-}
-
-void simple_cd(size_t n, char** words){
-	char cwd[1024];
-	if(getcwd(cwd, 1024) == NULL){
-		fprintf(stderr, "%s\n", strerror(errno));
-		exit(-1);
-	}
-	else{
-		if(is_path(words[1])){
-			if(chdir(words[1]) == -1){
-				fprintf(stderr, "%s\n", strerror(errno));
-				exit(-1);
-			}
-		}
-		else{
-			strcat(cwd, "/");
-			strcat(cwd, words[1]);
-			if(chdir(cwd) == -1){
-				fprintf(stderr, "%s\n", strerror(errno));
-				exit(-1);
-			}
-			//simple_pwd();
-		}
+int simple_ls(size_t n, char** words){
+	DIR* dir = opendir(".");
+	if(dir == NULL){
+		fprintf(stderr, "ls: %s\n", strerror(errno));
+		return 1;
+	}
+	struct dirent* Dirent;
+	while((Dirent = readdir(dir)) != NULL){
+		fprintf(stdout, "%s\n", Dirent->d_name);
 	}
+	closedir(dir);
+	return 0;
 }
 
-void simple_wc(size_t n, char** argv){
+#define WC_BLOCK 65536
+
+// The counts go on from where the last block left them, the end of the
+// input counts as one more character.
+int simple_wc(size_t n, char** argv){
 	int lines = 1;
 	int characters = 0;
 	int words = 0;
-	int ch = 0;
-	FILE* in;
 	int previousSpace = 0;
+	int fd;
 	if(argv[1] != NULL){
-		in = fopen(argv[1], "r");
-		if(in == NULL){
+		fd = open(argv[1], O_RDONLY | O_CLOEXEC);
+		if(fd < 0){
 			fprintf(stderr, "failed to open file, %s\n", strerror(errno));
-			exit(-1);
+			return 1;
 		}
 	} else {
-		in = stdin;
-	}
-	while(!feof(in)) {
-		ch = fgetc(in);
-		characters++;
-		if (isspace(ch) && !previousSpace) {
-			previousSpace = 1;
-			words++;
+		fd = builtin_stdin();
+	}
+	char buf[WC_BLOCK];
+	ssize_t got;
+	while((got = builtin_read(fd, buf, sizeof(buf))) != 0){
+		if(got < 0){
+			if(errno == EINTR) continue;
+			fprintf(stderr, "wc: %s\n", strerror(errno));
+			break;
 		}
-		else if(ch == '\n'){
-			previousSpace = 0;
-			words++;
-			lines++;
-		} else {
-			previousSpace = 0;
+		characters += got;
+		for(ssize_t i = 0; i < got; ++i){
+			unsigned char ch = buf[i];
+			if(isspace(ch) && !previousSpace){
+				previousSpace = 1;
+				words++;
+			}
+			else if(ch == '\n'){
+				previousSpace = 0;
+				words++;
+				lines++;
+			} else {
+				previousSpace = 0;
+			}
 		}
 	}
+	characters++;
 	if(argv[1] != NULL) {
-		fclose(in);
+		close(fd);
+	}
+	fprintf(builtin_stdout(), "%d %d %d\n", lines, words, characters);
+	return 0;
+}
+
+// Copy 'fd' to 'out', returns 1 if reading failed and -1 if writing did.
+static int cat_fd(int fd, const char* name, FILE* out){
+	char buf[WC_BLOCK];
+	ssize_t got;
+	while((got = builtin_read(fd, buf, sizeof(buf))) != 0){
+		if(got < 0){
+			if(errno == EINTR) continue;
+			fprintf(stderr, "cat: %s: %s\n", name, strerror(errno));
+			return 1;
+		}
+		// Passed on as it comes, a slow writer is not held up.
+		if(fwrite(buf, 1, got, out) != (size_t)got || fflush(out) != 0){
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// cat [-u] [file...]   copy the files, or stdin for none or '-'
+int simple_cat(size_t n, char** words){
+	size_t i = 1;
+	if(i < n && !strcmp(words[i], "-u")){
+		// Unbuffered is what it does anyway.
+		i++;
+	}
+	FILE* out = builtin_stdout();
+	if(i == n){
+		return cat_fd(builtin_stdin(), "-", out) != 0;
+	}
+	int status = 0;
+	for(; i < n; ++i){
+		int result;
+		if(!strcmp(words[i], "-")){
+			result = cat_fd(builtin_stdin(), "-", out);
+		} else {
+			int fd = open(words[i], O_RDONLY | O_CLOEXEC);
+			if(fd < 0){
+				fprintf(stderr, "cat: %s: %s\n", words[i], strerror(errno));
+				status = 1;
+				continue;
+			}
+			result = cat_fd(fd, words[i], out);
+			close(fd);
+		}
+		// Nobody reads the output any more.
+		if(result < 0) return 1;
+		if(result > 0) status = 1;
 	}
-	fprintf(stdout, "%d %d %d\n", lines, words, characters);
+	return status;
 }
+
+// cache          print the parse cache statistics
+// cache -s size  set the number of cached lines
+// cache -c       drop all cached lines
+int simple_cache(size_t n, char** words){
+	if(n == 3 && !strcmp(words[1], "-s")){
+		char* end;
+		long size = strtol(words[2], &end, 10);
+		if(*end != '\0' || size < 0){
+			fprintf(stderr, "cache: bad size %s\n", words[2]);
+			return 1;
+		}
+		cache_resize((size_t)size);
+	} else if(n == 2 && !strcmp(words[1], "-c")){
+		cache_clear();
+	} else if(n != 1){
+		fprintf(stderr, "usage: cache [-s size | -c]\n");
+		return 2;
+	}
+	CacheStats stats = cache_stats();
+	size_t lookups = stats.hits + stats.misses;
+	fprintf(stdout, "size %zu/%zu hits %zu misses %zu evictions %zu hit-rate %.1f%%\n",
+		stats.size, stats.capacity, stats.hits, stats.misses, stats.evictions,
+		lookups ? 100.0 * stats.hits / lookups : 0.0);
+	return 0;
+}
+
+// export                 print the exported variables
+// export NAME[=value]... mark the variables for the environment
+int simple_export(size_t n, char** words){
+	if(n == 1){
+		vars_print_exported();
+		return 0;
+	}
+	for(size_t i = 1; i < n; ++i){
+		size_t len = assignment(words[i]);
+		if(len > 0){
+			char* name = strndup(words[i], len);
+			var_set(name, words[i] + len + 1);
+			var_export(name);
+			free(name);
+		} else {
+			var_export(words[i]);
+		}
+	}
+	return 0;
+}
+
+int simple_unset(size_t n, char** words){
+	for(size_t i = 1; i < n; ++i){
+		var_unset(words[i]);
+	}
+	return 0;
+}
+
+int simple_true(size_t n, char** words){
+	return 0;
+}
+
+int simple_false(size_t n, char** words){
+	return 1;
+}
+
+// hash     print the remembered executables
+// hash -r  forget them, PATH is searched again
+int simple_hash(size_t n, char** words){
+	if(n == 2 && !strcmp(words[1], "-r")){
+		commands_forget();
+	} else if(n != 1){
+		fprintf(stderr, "usage: hash [-r]\n");
+		return 2;
+	} else {
+		commands_print();
+	}
+	return 0;
+}
+
+// wait         wait for every background job, the status is 0
+// wait pid...  wait for these, the status is the one of the last
+int simple_wait(size_t n, char** words){
+	if(n == 1){
+		return jobs_wait_background();
+	}
+	int status = 0;
+	for(size_t i = 1; i < n; ++i){
+		char* end;
+		long pid = strtol(words[i], &end, 10);
+		if(*end != '\0' || pid <= 0){
+			fprintf(stderr, "wait: bad pid %s\n", words[i]);
+			return 2;
+		}
+		status = jobs_exit_status(jobs_wait((pid_t)pid));
+	}
+	return status;
+}
+
+int simple_jobs(size_t n, char** words){
+	jobs_print();
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,456 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <regex.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ush.h"
+
+/// grep [-cvinF] [-e pattern] [pattern] [file...]
+///
+/// Prints the lines matching the basic regular expression, or the fixed
+/// string with -F, with -c only their number; -v selects the lines which
+/// do not match, -i ignores case, -n prints the line numbers. The status
+/// is 0 if a line was selected, 1 if none, 2 on errors.
+///
+/// The buffer is not matched line by line. A pattern is searched as a
+/// literal when it has no special characters; otherwise the longest
+/// literal every match must contain is. The literal is found with SIMD
+/// compares of its first and last bytes, only the hits are compared
+/// whole, and only the lines holding a hit go to regexec. Regular files
+/// are mapped, anything else is read in large blocks.
+
+#define BLOCK (1 << 20)
+
+typedef struct {
+    int count;
+    int invert;
+    int icase;
+    int number;
+    const char* name;       // Printed before the lines, NULL for one file.
+
+    // Every match holds these, in lower case with -i. The first is
+    // searched for, the others are checked before regexec.
+    char** literals;
+    size_t n_literals;
+    const char* literal;    // The first, NULL to try every line.
+    size_t literal_len;
+    int chosen;             // Whether the first was picked, see choose_literal.
+    int use_regex;
+    regex_t re;
+
+    size_t line_no;
+    size_t selected;
+    FILE* out;
+} Grep;
+
+static unsigned char lower[256];
+
+static int equal_icase(const char* a, const char* b, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        if (lower[(unsigned char)a[i]] != (unsigned char)b[i]) return 0;
+    }
+    return 1;
+}
+
+static const char* find_scalar(const Grep* g, const char* s, size_t len) {
+    if (!g->icase) {
+        return memmem(s, len, g->literal, g->literal_len);
+    }
+    for (size_t i = 0; i + g->literal_len <= len; ++i) {
+        if (equal_icase(s + i, g->literal, g->literal_len)) return s + i;
+    }
+    return NULL;
+}
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+
+// The blocks at each position and at position + length - 1 are compared
+// with the first and the last byte of the literal, in either case with -i.
+// Positions where both match are compared whole.
+static const char* find_sse2(const Grep* g, const char* s, size_t len) {
+    size_t m = g->literal_len;
+    unsigned char first = g->literal[0], last = g->literal[m - 1];
+    __m128i first_lo = _mm_set1_epi8(first), last_lo = _mm_set1_epi8(last);
+    __m128i first_up = _mm_set1_epi8(g->icase ? toupper(first) : first);
+    __m128i last_up = _mm_set1_epi8(g->icase ? toupper(last) : last);
+    size_t i = 0;
+    for (; i + m - 1 + 16 <= len; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(s + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(s + i + m - 1));
+        __m128i hit_a = _mm_or_si128(_mm_cmpeq_epi8(a, first_lo), _mm_cmpeq_epi8(a, first_up));
+        __m128i hit_b = _mm_or_si128(_mm_cmpeq_epi8(b, last_lo), _mm_cmpeq_epi8(b, last_up));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(hit_a, hit_b));
+        while (mask != 0) {
+            const char* at = s + i + __builtin_ctz(mask);
+            if (g->icase ? equal_icase(at, g->literal, m) : !memcmp(at, g->literal, m)) return at;
+            mask &= mask - 1;
+        }
+    }
+    return find_scalar(g, s + i, len - i);
+}
+
+// Same with 32 bytes per step, only called when the CPU has AVX2.
+__attribute__((target("avx2")))
+static const char* find_avx2(const Grep* g, const char* s, size_t len) {
+    size_t m = g->literal_len;
+    unsigned char first = g->literal[0], last = g->literal[m - 1];
+    __m256i first_lo = _mm256_set1_epi8(first), last_lo = _mm256_set1_epi8(last);
+    __m256i first_up = _mm256_set1_epi8(g->icase ? toupper(first) : first);
+    __m256i last_up = _mm256_set1_epi8(g->icase ? toupper(last) : last);
+    size_t i = 0;
+    for (; i + m - 1 + 32 <= len; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(s + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(s + i + m - 1));
+        __m256i hit_a = _mm256_or_si256(_mm256_cmpeq_epi8(a, first_lo), _mm256_cmpeq_epi8(a, first_up));
+        __m256i hit_b = _mm256_or_si256(_mm256_cmpeq_epi8(b, last_lo), _mm256_cmpeq_epi8(b, last_up));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_and_si256(hit_a, hit_b));
+        while (mask != 0) {
+            const char* at = s + i + __builtin_ctz(mask);
+            if (g->icase ? equal_icase(at, g->literal, m) : !memcmp(at, g->literal, m)) return at;
+            mask &= mask - 1;
+        }
+    }
+    return find_sse2(g, s + i, len - i);
+}
+#endif
+
+static const char* (*find_literal)(const Grep*, const char*, size_t) = NULL;
+static pthread_once_t grep_once = PTHREAD_ONCE_INIT;
+
+// Once, pipeline stages may run grep in several threads.
+static void init_grep(void) {
+    for (int c = 0; c < 256; ++c) {
+        lower[c] = (unsigned char)tolower(c);
+    }
+    find_literal = find_scalar;
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    find_literal = find_sse2;
+    if (__builtin_cpu_supports("avx2")) {
+        find_literal = find_avx2;
+    }
+#endif
+}
+
+// Whether the char at 'p' is made optional or repeated by what follows.
+static int quantified(const char* p) {
+    return p[1] == '*' || (p[1] == '\\' && (p[2] == '{' || p[2] == '?' || p[2] == '+'));
+}
+
+// The runs of ordinary characters outside groups in the basic regular
+// expression, which every match contains, none if it uses the \|
+// extension. Longest first.
+static size_t required_literals(const char* re, char*** out) {
+    *out = NULL;
+    if (strstr(re, "\\|") != NULL) return 0;
+    size_t n = 0;
+    size_t run_len = 0;
+    int depth = 0;
+    for (const char* p = re; ; ++p) {
+        const char* at = p;
+        int ordinary = 0;
+        if (*p == '\0') {
+            // Ends the last run.
+        } else if (*p == '\\') {
+            if (p[1] == '(') depth++;
+            if (p[1] == ')') depth--;
+            if (p[1] != '\0') p++;
+        } else if (*p == '[') {
+            // Skip the bracket expression, a ']' first is one of its chars.
+            if (p[1] == '^') p++;
+            if (p[1] == ']') p++;
+            while (p[1] != '\0' && p[1] != ']') {
+                // [:class:], [.coll.] and [=equiv=] are single items,
+                // their ']' does not close the bracket.
+                if (p[1] == '[' && (p[2] == ':' || p[2] == '.' || p[2] == '=')) {
+                    const char* close = strchr(p + 3, p[2]);
+                    while (close != NULL && close[1] != ']') close = strchr(close + 1, p[2]);
+                    if (close != NULL) {
+                        p = close + 1;
+                        continue;
+                    }
+                }
+                p++;
+            }
+            if (p[1] != '\0') p++;
+        } else if (*p != '.' && *p != '*' && !(*p == '^' && p == re) && !(*p == '$' && p[1] == '\0')) {
+            ordinary = depth == 0 && !quantified(p);
+        }
+        if (ordinary) {
+            run_len++;
+        } else if (run_len > 0) {
+            *out = realloc(*out, (n + 1) * sizeof(char*));
+            size_t k = n++;
+            // Insertion by length.
+            while (k > 0 && strlen((*out)[k - 1]) < run_len) {
+                (*out)[k] = (*out)[k - 1];
+                k--;
+            }
+            (*out)[k] = strndup(at - run_len, run_len);
+            run_len = 0;
+        }
+        if (*p == '\0') break;
+    }
+    return n;
+}
+
+static int has_special(const char* re) {
+    return strpbrk(re, "\\.[]*^$") != NULL;
+}
+
+static void print_line(Grep* g, const char* line, size_t len) {
+    if (g->name != NULL) {
+        fputs_unlocked(g->name, g->out);
+        putc_unlocked(':', g->out);
+    }
+    if (g->number) {
+        fprintf(g->out, "%zu:", g->line_no);
+    }
+    fwrite_unlocked(line, 1, len, g->out);
+    putc_unlocked('\n', g->out);
+}
+
+static void select_line(Grep* g, const char* line, size_t len, int matched) {
+    g->line_no++;
+    if (matched == g->invert) return;
+    g->selected++;
+    if (!g->count) print_line(g, line, len);
+}
+
+// Lines which cannot match, only -v and -n look at them.
+static void skip_lines(Grep* g, const char* p, const char* end) {
+    if (g->invert) {
+        while (p < end) {
+            const char* nl = memchr(p, '\n', end - p);
+            const char* le = nl ? nl : end;
+            select_line(g, p, le - p, 0);
+            p = le + 1;
+        }
+    } else if (g->number) {
+        while ((p = memchr(p, '\n', end - p)) != NULL) {
+            g->line_no++;
+            p++;
+        }
+    }
+}
+
+static int match_line(const Grep* g, const char* line, size_t len) {
+    if (!g->use_regex) return 1;
+    for (size_t i = 1; i < g->n_literals; ++i) {
+        Grep other = *g;
+        other.literal = g->literals[i];
+        other.literal_len = strlen(g->literals[i]);
+        if (find_scalar(&other, line, len) == NULL) return 0;
+    }
+    regmatch_t range = { .rm_so = 0, .rm_eo = (regoff_t)len };
+    return regexec(&g->re, line, 1, &range, REG_STARTEND) == 0;
+}
+
+// The longest literal is not always the best to search for, e.g. one in
+// every line. Keep the one found least often at the start of the input.
+static void choose_literal(Grep* g, const char* data, size_t len) {
+    if (len > 65536) len = 65536;
+    size_t best = 0, best_hits = (size_t)-1;
+    for (size_t i = 0; i < g->n_literals; ++i) {
+        Grep probe = *g;
+        probe.literal = g->literals[i];
+        probe.literal_len = strlen(g->literals[i]);
+        if (probe.literal_len == 0) continue;
+        size_t hits = 0;
+        for (const char* p = data; (p = find_literal(&probe, p, data + len - p)) != NULL; ++p) {
+            hits++;
+        }
+        if (hits < best_hits) {
+            best = i;
+            best_hits = hits;
+        }
+    }
+    char* t = g->literals[0];
+    g->literals[0] = g->literals[best];
+    g->literals[best] = t;
+    g->literal = g->literals[0];
+    g->literal_len = strlen(g->literal);
+}
+
+// Match the lines of 'data', returns the bytes used. Unless 'final' the
+// last line without its newline is left for the next call.
+static size_t grep_buffer(Grep* g, const char* data, size_t len, int final) {
+    const char* limit = data + len;
+    if (!final) {
+        const char* nl = memrchr(data, '\n', len);
+        if (nl == NULL) return 0;
+        limit = nl + 1;
+    }
+    if (!g->chosen && g->n_literals > 1) {
+        choose_literal(g, data, limit - data);
+    }
+    g->chosen = 1;
+    const char* p = data;
+    while (p < limit) {
+        const char* hit = g->literal ? find_literal(g, p, limit - p) : p;
+        if (hit == NULL) {
+            skip_lines(g, p, limit);
+            break;
+        }
+        const char* start = memrchr(p, '\n', hit - p);
+        start = start ? start + 1 : p;
+        const char* end = memchr(hit, '\n', limit - hit);
+        end = end ? end : limit;
+        skip_lines(g, p, start);
+        select_line(g, start, end - start, match_line(g, start, end - start));
+        p = end + 1;
+    }
+    return limit - data;
+}
+
+static int grep_fd(Grep* g, int fd) {
+    g->line_no = 0;
+    g->selected = 0;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        char* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            madvise(data, st.st_size, MADV_SEQUENTIAL);
+            grep_buffer(g, data, st.st_size, 1);
+            munmap(data, st.st_size);
+            return 0;
+        }
+    }
+
+    size_t cap = 2 * BLOCK, len = 0;
+    char* data = malloc(cap);
+    while (1) {
+        if (cap - len < BLOCK) {
+            cap *= 2;
+            data = realloc(data, cap);
+        }
+        ssize_t got = builtin_read(fd, data + len, cap - len);
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0) {
+            free(data);
+            return -1;
+        }
+        len += got;
+        size_t used = grep_buffer(g, data, len, got == 0);
+        memmove(data, data + used, len - used);
+        len -= used;
+        if (got == 0) break;
+    }
+    free(data);
+    return 0;
+}
+
+static void print_count(Grep* g) {
+    if (g->name != NULL) {
+        fprintf(g->out, "%s:", g->name);
+    }
+    fprintf(g->out, "%zu\n", g->selected);
+}
+
+static int usage(void) {
+    fprintf(stderr, "usage: grep [-cvinF] [-e pattern] [pattern] [file...]\n");
+    return 2;
+}
+
+int simple_grep(size_t n, char** words){
+    pthread_once(&grep_once, init_grep);
+    Grep g = { 0 };
+    g.out = builtin_stdout();
+    int fixed = 0;
+    const char* pattern = NULL;
+    size_t i = 1;
+    for (; i < n && words[i][0] == '-' && words[i][1] != '\0'; ++i) {
+        if (!strcmp(words[i], "--")) {
+            i++;
+            break;
+        }
+        for (const char* f = words[i] + 1; *f != '\0'; ++f) {
+            if (*f == 'c') {
+                g.count = 1;
+            } else if (*f == 'v') {
+                g.invert = 1;
+            } else if (*f == 'i') {
+                g.icase = 1;
+            } else if (*f == 'n') {
+                g.number = 1;
+            } else if (*f == 'F') {
+                fixed = 1;
+            } else if (*f == 'e') {
+                pattern = f[1] ? f + 1 : (i + 1 < n ? words[++i] : NULL);
+                if (pattern == NULL) return usage();
+                break;
+            } else {
+                return usage();
+            }
+        }
+    }
+    if (pattern == NULL) {
+        if (i == n) return usage();
+        pattern = words[i++];
+    }
+
+    if (fixed || !has_special(pattern)) {
+        g.literals = malloc(sizeof(char*));
+        g.literals[0] = strdup(pattern);
+        g.n_literals = 1;
+    } else {
+        int err = regcomp(&g.re, pattern, REG_NOSUB | (g.icase ? REG_ICASE : 0));
+        if (err != 0) {
+            char message[256];
+            regerror(err, &g.re, message, sizeof(message));
+            fprintf(stderr, "grep: %s\n", message);
+            return 2;
+        }
+        g.use_regex = 1;
+        g.n_literals = required_literals(pattern, &g.literals);
+    }
+    for (size_t k = 0; k < g.n_literals && g.icase; ++k) {
+        for (char* c = g.literals[k]; *c != '\0'; ++c) {
+            *c = (char)lower[(unsigned char)*c];
+        }
+    }
+    // Every line contains the empty string.
+    if (g.n_literals > 0 && g.literals[0][0] != '\0') {
+        g.literal = g.literals[0];
+        g.literal_len = strlen(g.literal);
+    }
+
+    int status = 0;
+    size_t selected = 0;
+    if (i == n) {
+        if (grep_fd(&g, builtin_stdin()) < 0) {
+            fprintf(stderr, "grep: %s\n", strerror(errno));
+            status = 2;
+        }
+        if (g.count) print_count(&g);
+        selected += g.selected;
+    }
+    int many = n - i > 1;
+    for (; i < n; ++i) {
+        g.name = many ? words[i] : NULL;
+        int fd = open(words[i], O_RDONLY | O_CLOEXEC);
+        if (fd < 0 || grep_fd(&g, fd) < 0) {
+            fprintf(stderr, "grep: %s: %s\n", words[i], strerror(errno));
+            status = 2;
+        } else if (g.count) {
+            print_count(&g);
+        }
+        if (fd >= 0) close(fd);
+        selected += g.selected;
+    }
+
+    if (g.use_regex) regfree(&g.re);
+    for (size_t k = 0; k < g.n_literals; ++k) {
+        free(g.literals[k]);
+    }
+    free(g.literals);
+    if (status == 0 && selected == 0) status = 1;
+    return status;
+}
\ No newline at end of file
@@ -0,0 +1,238 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "ush.h"
+
+/// head [-n N | -c N | -N] [file...]
+/// tail [-n N | -c N | -N] [file...]
+///
+/// The first or the last N lines, or bytes with -c, of each file or of
+/// stdin, N is 10 by default. head stops reading as soon as it has its
+/// lines, and closes a pipe or ring it read from so the writer stops at
+/// once. tail reads a regular file backwards from its end, a file of any
+/// size costs the few blocks holding its last lines.
+
+#define BLOCK 65536
+
+typedef struct {
+    const char* name;
+    int bytes;      // -c, count bytes instead of lines.
+    size_t count;
+} Options;
+
+// Parse the options, returns the index of the first file or 0 on errors.
+static size_t parse_options(const char* name, size_t n, char** words, Options* options) {
+    *options = (Options){ .name = name, .bytes = 0, .count = 10 };
+    size_t i = 1;
+    for (; i < n && words[i][0] == '-' && words[i][1] != '\0'; ++i) {
+        const char* value;
+        if (!strcmp(words[i], "--")) {
+            return i + 1;
+        } else if (words[i][1] == 'n' || words[i][1] == 'c') {
+            options->bytes = words[i][1] == 'c';
+            value = words[i][2] ? words[i] + 2 : (i + 1 < n ? words[++i] : "");
+        } else {
+            value = words[i] + 1;
+        }
+        char* end;
+        long long count = strtoll(value, &end, 10);
+        if (*value == '\0' || *end != '\0' || count < 0) {
+            fprintf(stderr, "usage: %s [-n N | -c N | -N] [file...]\n", name);
+            return 0;
+        }
+        options->count = (size_t)count;
+    }
+    return i;
+}
+
+static void write_out(const char* data, size_t n) {
+    fwrite(data, 1, n, builtin_stdout());
+}
+
+// Copy the start of 'fd', returns -1 if reading failed.
+static int head_fd(int fd, const Options* options) {
+    char buf[BLOCK];
+    size_t left = options->count;
+    while (left > 0) {
+        ssize_t got = builtin_read(fd, buf, sizeof(buf));
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0) return -1;
+        if (got == 0) break;
+
+        size_t used = (size_t)got;
+        if (options->bytes) {
+            if (used > left) used = left;
+            left -= used;
+        } else {
+            for (const char* p = buf; (p = memchr(p, '\n', buf + got - p)) != NULL; ++p) {
+                if (--left == 0) {
+                    used = p + 1 - buf;
+                    break;
+                }
+            }
+        }
+        write_out(buf, used);
+        if (used < (size_t)got) {
+            // Leave a shared file offset after what was printed, it fails on a pipe.
+            lseek(fd, (off_t)used - got, SEEK_CUR);
+        }
+    }
+    return 0;
+}
+
+// Offset in 'data' of the last 'lines' lines, counting on from 'found'
+// lines after it. Sets 'found' to the lines seen when there are fewer.
+static size_t last_lines(const char* data, size_t len, size_t lines, size_t* found) {
+    for (size_t end = len; end > 0;) {
+        const char* p = memrchr(data, '\n', end);
+        if (p == NULL) break;
+        end = p - data;
+        if (++*found == lines) return end + 1;
+    }
+    return 0;
+}
+
+// The length without a final newline, which ends the last line.
+static size_t without_final_newline(const char* data, size_t len) {
+    return len > 0 && data[len - 1] == '\n' ? len - 1 : len;
+}
+
+// A regular file is read backwards block by block until the start of its
+// last lines, then forwards from there.
+static int tail_file(int fd, off_t size, const Options* options) {
+    char buf[BLOCK];
+    off_t start = 0;
+    if (options->count == 0) {
+        start = size;
+    } else if (options->bytes) {
+        start = size > (off_t)options->count ? size - (off_t)options->count : 0;
+    } else {
+        size_t found = 0;
+        off_t pos = size;
+        char last;
+        // The final newline ends the last line rather than starting another.
+        if (pread(fd, &last, 1, size - 1) == 1 && last == '\n') pos--;
+        while (pos > 0) {
+            off_t from = pos > BLOCK ? pos - BLOCK : 0;
+            ssize_t got = pread(fd, buf, pos - from, from);
+            if (got < 0 && errno == EINTR) continue;
+            if (got <= 0) return -1;
+            size_t offset = last_lines(buf, (size_t)got, options->count, &found);
+            if (found == options->count) {
+                start = from + (off_t)offset;
+                break;
+            }
+            pos = from;
+        }
+    }
+
+    for (off_t pos = start; pos < size;) {
+        ssize_t got = pread(fd, buf, sizeof(buf), pos);
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0) return -1;
+        if (got == 0) break;
+        write_out(buf, (size_t)got);
+        pos += got;
+    }
+    return 0;
+}
+
+// Anything else is read to its end, keeping a buffer which is trimmed to
+// the last lines whenever it grew past twice what it kept the last time.
+static int tail_stream(int fd, const Options* options) {
+    size_t cap = 2 * BLOCK, len = 0, limit = 2 * BLOCK;
+    char* data = malloc(cap);
+    while (1) {
+        if (cap - len < BLOCK) {
+            cap *= 2;
+            data = realloc(data, cap);
+        }
+        ssize_t got = builtin_read(fd, data + len, cap - len);
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0) {
+            free(data);
+            return -1;
+        }
+        len += (size_t)got;
+        if (len > limit || got == 0) {
+            size_t start = 0, found = 0;
+            if (options->bytes) {
+                start = len > options->count ? len - options->count : 0;
+            } else if (options->count == 0) {
+                start = len;
+            } else {
+                start = last_lines(data, without_final_newline(data, len), options->count, &found);
+            }
+            memmove(data, data + start, len - start);
+            len -= start;
+            limit = 2 * len > 2 * BLOCK ? 2 * len : 2 * BLOCK;
+        }
+        if (got == 0) break;
+    }
+    write_out(data, len);
+    free(data);
+    return 0;
+}
+
+static int tail_fd(int fd, const Options* options) {
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        return tail_file(fd, st.st_size, options);
+    }
+    return tail_stream(fd, options);
+}
+
+// Run 'each' on the files, with a header before each one if there are several.
+static int for_files(size_t first, size_t n, char** words, const Options* options,
+        int (*each)(int, const Options*)) {
+    if (first == n) {
+        if (each(builtin_stdin(), options) < 0) {
+            fprintf(stderr, "%s: %s\n", options->name, strerror(errno));
+            return 1;
+        }
+        return 0;
+    }
+    int status = 0;
+    for (size_t i = first; i < n; ++i) {
+        int fd = open(words[i], O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            fprintf(stderr, "%s: %s: %s\n", options->name, words[i], strerror(errno));
+            status = 1;
+            continue;
+        }
+        if (n - first > 1) {
+            fprintf(builtin_stdout(), "%s==> %s <==\n", i == first ? "" : "\n", words[i]);
+        }
+        if (each(fd, options) < 0) {
+            fprintf(stderr, "%s: %s: %s\n", options->name, words[i], strerror(errno));
+            status = 1;
+        }
+        close(fd);
+    }
+    return status;
+}
+
+int simple_head(size_t n, char** words){
+    Options options;
+    size_t first = parse_options("head", n, words, &options);
+    if (first == 0) return 2;
+    int status = for_files(first, n, words, &options, head_fd);
+    // In a pipeline stage, let the writer stop now rather than when the
+    // output is flushed.
+    if (first == n) {
+        builtin_close_stdin();
+    }
+    return status;
+}
+
+int simple_tail(size_t n, char** words){
+    Options options;
+    size_t first = parse_options("tail", n, words, &options);
+    if (first == 0) return 2;
+    return for_files(first, n, words, &options, tail_fd);
+}
\ No newline at end of file
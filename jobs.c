@@ -0,0 +1,223 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#include "table.h"
+#include "jobs.h"
+
+typedef struct {
+    pid_t pid;
+    int status;
+    int done;
+    int number;     // Background job number, 0 otherwise.
+} Job;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t reaped = PTHREAD_COND_INITIALIZER;
+// Whether a thread is waiting in epoll_wait, the others wait on 'reaped'.
+static int leader = 0;
+
+// pid, in decimal, to Job.
+static Table jobs;
+static int n_background = 0;
+
+static int sfd = -1;
+static int efd = -1;
+static sigset_t saved_mask;
+
+static void init(void) {
+    if (efd >= 0) return;
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &set, &saved_mask);
+    sfd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+    efd = epoll_create1(EPOLL_CLOEXEC);
+    if (sfd < 0 || efd < 0) {
+        perror("Failed creating the event loop");
+        exit(-1);
+    }
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = sfd };
+    epoll_ctl(efd, EPOLL_CTL_ADD, sfd, &ev);
+}
+
+void jobs_init(void) {
+    pthread_mutex_lock(&lock);
+    init();
+    pthread_mutex_unlock(&lock);
+}
+
+void jobs_child(void) {
+    if (efd < 0) return;
+    close(sfd);
+    close(efd);
+    sfd = efd = -1;
+    leader = 0;
+    // The parent's children are not ours.
+    for (size_t i = 0; i < jobs.cap; ++i) {
+        if (table_live(&jobs, i)) free(jobs.slots[i].value);
+    }
+    table_clear(&jobs);
+    n_background = 0;
+    pthread_sigmask(SIG_SETMASK, &saved_mask, NULL);
+    // Only the forking thread exists in the child, the lock may be stale.
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&reaped, NULL);
+}
+
+static Job* track(pid_t pid) {
+    char key[16];
+    snprintf(key, sizeof(key), "%d", (int)pid);
+    Job** slot = (Job**)table_put(&jobs, key);
+    if (*slot == NULL) {
+        *slot = calloc(1, sizeof(Job));
+        (*slot)->pid = pid;
+    }
+    return *slot;
+}
+
+static void forget(Job* job) {
+    char key[16];
+    snprintf(key, sizeof(key), "%d", (int)job->pid);
+    table_remove(&jobs, key);
+    if (job->number > 0) n_background--;
+    free(job);
+}
+
+// Drain the signalfd and reap every child which exited, with the lock held.
+static void reap(void) {
+    struct signalfd_siginfo info;
+    while (read(sfd, &info, sizeof(info)) == sizeof(info)) {
+    }
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        // It may exit before its parent got to track it.
+        Job* job = track(pid);
+        job->status = status;
+        job->done = 1;
+    }
+}
+
+int jobs_wait(pid_t pid) {
+    pthread_mutex_lock(&lock);
+    init();
+    Job* job = track(pid);
+    siginfo_t info;
+    if (!job->done && waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) < 0 && errno == ECHILD) {
+        // Not a child of this shell, or reaped already by someone else.
+        job->status = 127 << 8;
+        job->done = 1;
+    }
+    while (!job->done) {
+        if (leader) {
+            pthread_cond_wait(&reaped, &lock);
+            continue;
+        }
+        reap();
+        if (job->done) break;
+
+        leader = 1;
+        pthread_mutex_unlock(&lock);
+        struct epoll_event ev;
+        while (epoll_wait(efd, &ev, 1, -1) < 0 && errno == EINTR) {
+        }
+        pthread_mutex_lock(&lock);
+        reap();
+        leader = 0;
+        pthread_cond_broadcast(&reaped);
+    }
+    int status = job->status;
+    forget(job);
+    pthread_mutex_unlock(&lock);
+    return status;
+}
+
+int jobs_exit_status(int status) {
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    return 1;
+}
+
+int jobs_background(pid_t pid) {
+    pthread_mutex_lock(&lock);
+    init();
+    Job* job = track(pid);
+    // Numbers start over once all the jobs are done.
+    static int next = 0;
+    if (n_background == 0) next = 0;
+    job->number = ++next;
+    n_background++;
+    pthread_mutex_unlock(&lock);
+    return job->number;
+}
+
+// The pids of the background jobs, malloc'ed.
+static size_t background_pids(pid_t** pids) {
+    pthread_mutex_lock(&lock);
+    *pids = malloc((n_background + 1) * sizeof(pid_t));
+    size_t n = 0;
+    for (size_t i = 0; i < jobs.cap; ++i) {
+        if (!table_live(&jobs, i)) continue;
+        const Job* job = jobs.slots[i].value;
+        if (job->number > 0) (*pids)[n++] = job->pid;
+    }
+    pthread_mutex_unlock(&lock);
+    return n;
+}
+
+int jobs_wait_background(void) {
+    pid_t* pids;
+    size_t n = background_pids(&pids);
+    for (size_t i = 0; i < n; ++i) {
+        jobs_wait(pids[i]);
+    }
+    free(pids);
+    return 0;
+}
+
+void jobs_print(void) {
+    pthread_mutex_lock(&lock);
+    if (efd >= 0) reap();
+    for (size_t i = 0; i < jobs.cap; ++i) {
+        if (!table_live(&jobs, i)) continue;
+        const Job* job = jobs.slots[i].value;
+        if (job->number > 0) {
+            printf("[%d] %s %d\n", job->number, job->done ? "Done" : "Running", (int)job->pid);
+        }
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+int jobs_fd(void) {
+    return efd;
+}
+
+int jobs_notify(void) {
+    int printed = 0;
+    pthread_mutex_lock(&lock);
+    if (efd >= 0) {
+        reap();
+        for (size_t i = 0; i < jobs.cap; ++i) {
+            if (!table_live(&jobs, i)) continue;
+            Job* job = jobs.slots[i].value;
+            if (job->number == 0 || !job->done) continue;
+            int status = jobs_exit_status(job->status);
+            if (status == 0) {
+                printf("[%d] Done %d\n", job->number, (int)job->pid);
+            } else {
+                printf("[%d] Exit %d %d\n", job->number, status, (int)job->pid);
+            }
+            forget(job);
+            printed++;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return printed;
+}
\ No newline at end of file
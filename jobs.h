@@ -0,0 +1,38 @@
+#include <sys/types.h>
+
+/// Child processes are reaped by one event loop: SIGCHLD is blocked and
+/// read from a signalfd watched with epoll, so an exit is noticed without
+/// polling, and every child which exited is reaped at once with WNOHANG.
+/// The statuses are kept in a table by pid until they are asked for.
+
+/// Block SIGCHLD and open the loop. Call it before starting threads which
+/// wait for children, the signal mask is per thread.
+void jobs_init(void);
+
+/// Call in a forked child: drops the parent's loop and table, and restores
+/// the signal mask from before jobs_init, which would survive exec.
+void jobs_child(void);
+
+/// Wait for the child and return its raw wait status. Several threads may
+/// wait at once: one runs the loop, the others sleep until it reaped theirs.
+int jobs_wait(pid_t pid);
+
+/// The exit status of a raw wait status, 128 + the signal if killed.
+int jobs_exit_status(int status);
+
+/// Track a child started with '&', returns its job number.
+int jobs_background(pid_t pid);
+
+/// Wait for every background job, returns 0 like POSIX wait.
+int jobs_wait_background(void);
+
+/// Print the background jobs which are still running.
+void jobs_print(void);
+
+/// A descriptor which becomes readable when a child exited, for poll.
+int jobs_fd(void);
+
+/// Reap without blocking and print the background jobs which finished,
+/// which also drains jobs_fd.
+/// Returns the number of lines printed.
+int jobs_notify(void);
\ No newline at end of file
@@ -1,32 +1,59 @@
 #include "lexer.h"
+#include <pthread.h>
 
-static Token* make_token(T_Kind kind, const char* source, int len) {
-    Token* token = malloc(sizeof(Token));
-    token->kind = kind;
-    token->next = NULL;
+static Tokens* make_tokens(void) {
+    Tokens* tokens = malloc(sizeof(Tokens));
+    tokens->n = 0;
+    tokens->cap = 16;
+    tokens->kinds = malloc(tokens->cap * sizeof(T_Kind));
+    tokens->spans = malloc(tokens->cap * sizeof(Span));
+    tokens->starts = malloc(tokens->cap * sizeof(uint32_t));
+    tokens->len = 0;
+    tokens->room = 256;
+    tokens->text = malloc(tokens->room);
+    tokens->kinds[0] = END;
+    tokens->starts[0] = 0;
+    tokens->error = NULL;
+    tokens->at = 0;
+    return tokens;
+}
+
+// A token at 'at' in the source, a WORD has 'len' chars of 'word'.
+static void push_token(Tokens* tokens, T_Kind kind, size_t at, const char* word, size_t len) {
+    // One more slot for END.
+    if (tokens->n + 1 == tokens->cap) {
+        tokens->cap *= 2;
+        tokens->kinds = realloc(tokens->kinds, tokens->cap * sizeof(T_Kind));
+        tokens->spans = realloc(tokens->spans, tokens->cap * sizeof(Span));
+        tokens->starts = realloc(tokens->starts, tokens->cap * sizeof(uint32_t));
+    }
     if (kind == WORD) {
         // Copy the string.
-        char* word = malloc((len + 1) * sizeof(char));
-        memcpy(word, source, len);
-        word[len] = '\0';
-        token->data.word = word;
+        if (tokens->len + len + 1 > tokens->room) {
+            while (tokens->len + len + 1 > tokens->room) tokens->room *= 2;
+            tokens->text = realloc(tokens->text, tokens->room);
+        }
+        memcpy(tokens->text + tokens->len, word, len);
+        tokens->text[tokens->len + len] = '\0';
+        tokens->spans[tokens->n] = (Span){ (uint32_t)tokens->len, (uint32_t)len };
+        tokens->len += len + 1;
     }
-    return token;
+    tokens->starts[tokens->n] = (uint32_t)at;
+    tokens->kinds[tokens->n++] = kind;
+    tokens->kinds[tokens->n] = END;
 }
 
-void delete_token(Token* token) {
-    if (token->kind == WORD) {
-        free((void*)token->data.word);
-    }
-    free(token);
+const char* token_word(const Tokens* tokens, size_t i) {
+    return tokens->text + tokens->spans[i].off;
 }
 
-void delete_tokens(Token* tokens) {
-    while (tokens != NULL) {
-        Token* prev = tokens;
-        tokens = tokens->next;
-        delete_token(prev);
-    }
+void delete_tokens(Tokens* tokens) {
+    if (tokens == NULL) return;
+    free(tokens->kinds);
+    free(tokens->spans);
+    free(tokens->starts);
+    free(tokens->text);
+    free(tokens);
 }
 
 typedef enum {
@@ -40,93 +67,447 @@ static int is_char(char c) {
     return (c <= 'z' && c >= 'a') || (c <= 'Z' && c >= 'A') || (c <= '9' && c >= '0');
 }
 
-int is_not_metachar(char c);
+// Quotes and backslashes are part of a word, they are removed
+// when the word is expanded.
 inline int is_not_metachar(char c) {
     return c != '<' && c != '>' && c != '|' &&
-        c != '&' && c != '\'' && c != '"' && c != '$' &&
-        c != ';' &&
+        c != '&' && c != ';' && c != '(' && c != ')' &&
         c != ' ' && c != '\n' && c != '\t' && c != 0;
 }
 
+/// Words are not fed to the state machines one char at a time:
+/// 'scan_word' jumps to the next byte which may end the word or
+/// change the quoting, using SSE2/AVX2 compares when available.
+typedef struct {
+    const char* chars;
+    int n;
+    unsigned char member[256];
+} ByteClass;
+
+// Metachars ending a word, and the quoting characters.
+static ByteClass WORD_STOP = { "<>|&;() \t\n'\"\\", 14, {0} };
+// Characters ending a run inside double quotes.
+static ByteClass DQUOTE_STOP = { "\"\\$", 3, {0} };
+// Parentheses and quoting inside a process substitution.
+static ByteClass SUBST_STOP = { "()'\"\\", 5, {0} };
+
+static void init_class(ByteClass* cls) {
+    for (int i = 0; i < cls->n; ++i) {
+        cls->member[(unsigned char)cls->chars[i]] = 1;
+    }
+}
+
+static size_t find_scalar(const ByteClass* cls, const char* s, size_t i, size_t len) {
+    while (i < len && !cls->member[(unsigned char)s[i]]) i++;
+    return i;
+}
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+
+// Index of the first byte of 's' in the class, 16 bytes per step.
+static size_t find_sse2(const ByteClass* cls, const char* s, size_t i, size_t len) {
+    __m128i set[16];
+    for (int k = 0; k < cls->n; ++k) {
+        set[k] = _mm_set1_epi8(cls->chars[k]);
+    }
+    for (; i + 16 <= len; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*)(s + i));
+        __m128i hit = _mm_cmpeq_epi8(block, set[0]);
+        for (int k = 1; k < cls->n; ++k) {
+            hit = _mm_or_si128(hit, _mm_cmpeq_epi8(block, set[k]));
+        }
+        int mask = _mm_movemask_epi8(hit);
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return find_scalar(cls, s, i, len);
+}
+
+// Same with 32 bytes per step, only called when the CPU has AVX2.
+__attribute__((target("avx2")))
+static size_t find_avx2(const ByteClass* cls, const char* s, size_t i, size_t len) {
+    __m256i set[16];
+    for (int k = 0; k < cls->n; ++k) {
+        set[k] = _mm256_set1_epi8(cls->chars[k]);
+    }
+    for (; i + 32 <= len; i += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i*)(s + i));
+        __m256i hit = _mm256_cmpeq_epi8(block, set[0]);
+        for (int k = 1; k < cls->n; ++k) {
+            hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(block, set[k]));
+        }
+        unsigned mask = (unsigned)_mm256_movemask_epi8(hit);
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return find_sse2(cls, s, i, len);
+}
+#endif
+
+static size_t (*find_class)(const ByteClass*, const char*, size_t, size_t) = NULL;
+
+// Once, before the first source is lexed.
+static pthread_once_t scanner_once = PTHREAD_ONCE_INIT;
+
+static void init_scanner(void) {
+    init_class(&WORD_STOP);
+    init_class(&DQUOTE_STOP);
+    init_class(&SUBST_STOP);
+    find_class = find_scalar;
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    find_class = find_sse2;
+    if (__builtin_cpu_supports("avx2")) {
+        find_class = find_avx2;
+    }
+#endif
+}
+
+// What the scanners return for a quote or a substitution which is still
+// open at the end of the source.
+#define OPEN ((size_t)-1)
+
+// The outermost construct left open, for the error message: each scanner
+// sets it when it returns OPEN, the enclosing ones after the inner ones.
+// Sources may be lexed in several threads at once.
+static __thread const char* left_open = NULL;
+
+static size_t scan_subst(const char* s, size_t i, size_t len);
+
+// Skip the quoted part or the escaped char starting at 'i'.
+static size_t skip_quoted(const char* s, size_t i, size_t len) {
+    switch (s[i]) {
+        case '\\':
+            return i + 2 < len ? i + 2 : len;
+        case '\'': {
+            const char* close = memchr(s + i + 1, '\'', len - i - 1);
+            if (close != NULL) return close - s + 1;
+            left_open = "unterminated quote";
+            return OPEN;
+        }
+        default:
+            i++;
+            while (1) {
+                i = find_class(&DQUOTE_STOP, s, i, len);
+                if (i >= len) break;
+                if (s[i] == '"') return i + 1;
+                if (s[i] == '$') {
+                    if (i + 1 < len && s[i + 1] == '(') {
+                        i = scan_subst(s, i, len);
+                        if (i == OPEN) break;
+                    } else {
+                        i++;
+                    }
+                    continue;
+                }
+                // Backslash.
+                i += 2;
+            }
+            left_open = "unterminated quote";
+            return OPEN;
+    }
+}
+
+/// Returns the end of the word starting at 'i'.
+/// Single quotes are taken literally, a backslash escapes the next char
+/// outside of single quotes. A command substitution '$(...)' is part of
+/// the word, up to the matching ')'.
+static size_t scan_word(const char* s, size_t i, size_t len) {
+    // Where the last quoted part ends, a '$' before it is not live.
+    size_t plain = i;
+    while (1) {
+        i = find_class(&WORD_STOP, s, i, len);
+        if (i == len) return len;
+        if (s[i] == '(' && i > plain && s[i - 1] == '$') {
+            i = scan_subst(s, i - 1, len);
+            if (i == OPEN) return OPEN;
+            plain = i;
+            continue;
+        }
+        if (s[i] != '\\' && s[i] != '\'' && s[i] != '"') {
+            // A metachar ends the word.
+            return i;
+        }
+        i = skip_quoted(s, i, len);
+        if (i == OPEN) return OPEN;
+        plain = i;
+    }
+}
+
+/// A process substitution, '<(' or '>(' up to the matching ')', is one
+/// word. Its commands are lexed again when the parser checks them.
+static int is_subst_start(const char* s, size_t i, size_t len) {
+    return i + 1 < len && (s[i] == '<' || s[i] == '>') && s[i + 1] == '(';
+}
+
+// From the '<', '>' or '$' at 'i' to after the matching ')'.
+static size_t scan_subst(const char* s, size_t i, size_t len) {
+    const char* what = s[i] == '$' ? "unterminated command substitution" :
+        "unterminated process substitution";
+    int depth = 0;
+    for (i++; i < len;) {
+        i = find_class(&SUBST_STOP, s, i, len);
+        if (i == len) break;
+        if (s[i] == '(') {
+            depth++;
+            i++;
+        } else if (s[i] == ')') {
+            i++;
+            if (--depth == 0) return i;
+        } else {
+            i = skip_quoted(s, i, len);
+            if (i == OPEN) break;
+        }
+    }
+    left_open = what;
+    return OPEN;
+}
+
+/// A here-string '<<<word' or a here-document '<<DELIM' ('<<-DELIM' strips
+/// the leading tabs) is one word, after an LT token. The body of a
+/// here-document is made of the lines after the one of its '<<', up to a
+/// line which is the delimiter, and goes into the word after a newline:
+/// '<<DELIM\nbody'. The scan skips the bodies when it gets there.
+static int is_here_start(const char* s, size_t i, size_t len) {
+    return i + 1 < len && s[i] == '<' && s[i + 1] == '<';
+}
+
+// The delimiter without its quotes.
+static char* unquote(const char* s, size_t n) {
+    char* out = malloc(n + 1);
+    size_t len = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (s[i] == '\\' && i + 1 < n) {
+            out[len++] = s[++i];
+        } else if (s[i] != '\'' && s[i] != '"') {
+            out[len++] = s[i];
+        }
+    }
+    out[len] = '\0';
+    return out;
+}
+
+// Returns the start of the first line from 'from' which is 'delim', or
+// 'len' if there is none. '*next' is set to the end of that line.
+static size_t find_delimiter(const char* s, size_t from, size_t len,
+        const char* delim, int strip, size_t* next) {
+    size_t n = strlen(delim);
+    for (size_t line = from; line < len;) {
+        const char* nl = memchr(s + line, '\n', len - line);
+        size_t end = nl != NULL ? (size_t)(nl - s) : len;
+        size_t at = line;
+        while (strip && at < end && s[at] == '\t') at++;
+        if (end - at == n && !memcmp(s + at, delim, n)) {
+            *next = end;
+            return line;
+        }
+        line = end + 1;
+    }
+    *next = len;
+    return len;
+}
+
+// The bodies of the here-documents of one line, from 'from' to 'to'.
+typedef struct {
+    size_t from;
+    size_t to;
+    int open;       // The source ended before a delimiter line.
+} Bodies;
+
+// Scan the here word at 'i', returns its end and sets '*word' to its text.
+static size_t scan_here(const char* s, size_t i, size_t len, Bodies* bodies, char** word) {
+    size_t start = i;
+    int string = i + 2 < len && s[i + 2] == '<';
+    i += string ? 3 : 2;
+    int strip = !string && i < len && s[i] == '-';
+    if (strip) i++;
+    while (i < len && (s[i] == ' ' || s[i] == '\t')) i++;
+    size_t at = i;
+    if (i < len && is_not_metachar(s[i])) {
+        i = scan_word(s, i, len);
+        if (i == OPEN) return OPEN;
+    }
+    if (string) {
+        *word = malloc(3 + i - at + 1);
+        memcpy(*word, "<<<", 3);
+        memcpy(*word + 3, s + at, i - at);
+        (*word)[3 + i - at] = '\0';
+        return i;
+    }
+
+    // The body starts after the previous one, or on the next line.
+    size_t body = bodies->to;
+    if (body == 0) {
+        const char* nl = memchr(s + i, '\n', len - i);
+        body = nl != NULL ? (size_t)(nl - s) : len;
+        bodies->from = body + 1;
+    }
+    if (body < len) body++;
+    char* delim = unquote(s + at, i - at);
+    size_t end = find_delimiter(s, body, len, delim, strip, &bodies->to);
+    if (end == len) bodies->open = 1;
+    free(delim);
+
+    size_t head = i - start;
+    char* out = malloc(head + 1 + end - body + 1);
+    memcpy(out, s + start, head);
+    size_t n = head;
+    out[n++] = '\n';
+    for (size_t k = body; k < end; ++k) {
+        if (strip && s[k] == '\t' && (k == body || s[k - 1] == '\n')) {
+            while (k < end && s[k] == '\t') k++;
+            if (k == end) break;
+        }
+        out[n++] = s[k];
+    }
+    out[n] = '\0';
+    *word = out;
+    return i;
+}
+
+// The state of one FSM, the lexers keep theirs in a Lexer so that
+// several sources can be lexed at once.
+typedef enum {
+    _INITIAL,
+    _FAILED,
+    _SUCCEED,
+    _RUNNING
+} State;
+
 // Finite State Machine:
-//              none-metachar       metachar
+//              <                   other
 // _INITIAL     _RUNNING            _FAILED
-// _RUNNING     _RUNNING            _SUCCEED
+// _RUNNING     _SUCCEED            _SUCCEED
 // _SUCCEED     _FAILED             _FAILED
 // _FAILED      _FAILED             _FAILED
-static Status word(int reset, char c, T_Kind* kind) {
-    static enum {
-        _INITIAL,
-        _FAILED,
-        _SUCCEED,
-        _RUNNING
-    } status = _INITIAL;
+static Status lt(State* status, int reset, char c, T_Kind* kind) {
     if (reset) {
-        status = _INITIAL;
+        *status = _INITIAL;
         return INITIAL;
     }
-    switch (status) {
+    switch (*status) {
         case _INITIAL:
-            if (is_not_metachar(c)) {
-                status = _RUNNING;
+            if (c == '<') {
+                *status = _RUNNING;
                 return RUNNING;
             } else {
-                status = _FAILED;
+                *status = _FAILED;
                 return FAILED;
             }
         case _RUNNING:
-            if (is_not_metachar(c)) {
+            *status = _SUCCEED;
+            *kind = LT;
+            return SUCCEED;
+        case _FAILED:
+            return FAILED;
+        case _SUCCEED:
+            *status = _FAILED;
+            return FAILED;
+        default:
+            perror("unknown internal status ><!");
+            exit(-1);
+    }
+}
+
+// Finite State Machine:
+//              >                   other
+// _INITIAL     _RUNNING            _FAILED
+// _RUNNING     _SUCCEED            _SUCCEED
+// _SUCCEED     _FAILED             _FAILED
+// _FAILED      _FAILED             _FAILED
+static Status rt(State* status, int reset, char c, T_Kind* kind) {
+    if (reset) {
+        *status = _INITIAL;
+        return INITIAL;
+    }
+    switch (*status) {
+        case _INITIAL:
+            if (c == '>') {
+                *status = _RUNNING;
                 return RUNNING;
             } else {
-                status = _SUCCEED;
-                *kind = WORD;
-                return SUCCEED;
+                *status = _FAILED;
+                return FAILED;
             }
+        case _RUNNING:
+            *status = _SUCCEED;
+            *kind = RT;
+            return SUCCEED;
         case _FAILED:
             return FAILED;
         case _SUCCEED:
-            status = _FAILED;
+            *status = _FAILED;
             return FAILED;
         default:
-            perror("Unknown internal status ><!");
+            perror("unknown internal status ><!");
+            exit(-1);
+    }
+}
+// Finite State Machine:
+//              |                  other
+// _INITIAL     _RUNNING            _FAILED
+// _RUNNING     _SUCCEED            _SUCCEED
+// _SUCCEED     _FAILED             _FAILED
+// _FAILED      _FAILED             _FAILED
+static Status pipe(State* status, int reset, char c, T_Kind* kind) {
+    if (reset) {
+        *status = _INITIAL;
+        return INITIAL;
+    }
+    switch (*status) {
+        case _INITIAL:
+            if (c == '|') {
+                *status = _RUNNING;
+                return RUNNING;
+            } else {
+                *status = _FAILED;
+                return FAILED;
+            }
+        case _RUNNING:
+            *status = _SUCCEED;
+            *kind = PIPE;
+            return SUCCEED;
+        case _FAILED:
+            return FAILED;
+        case _SUCCEED:
+            *status = _FAILED;
+            return FAILED;
+        default:
+            perror("unknown internal status ><!");
             exit(-1);
     }
 }
 
 // Finite State Machine:
-//              <                   other
+//              ;                   other
 // _INITIAL     _RUNNING            _FAILED
 // _RUNNING     _SUCCEED            _SUCCEED
 // _SUCCEED     _FAILED             _FAILED
 // _FAILED      _FAILED             _FAILED
-static Status lt(int reset, char c, T_Kind* kind) {
-    static enum {
-        _INITIAL,
-        _FAILED,
-        _SUCCEED,
-        _RUNNING
-    } status = _INITIAL;
+static Status semi(State* status, int reset, char c, T_Kind* kind) {
     if (reset) {
-        status = _INITIAL;
+        *status = _INITIAL;
         return INITIAL;
     }
-    switch (status) {
+    switch (*status) {
         case _INITIAL:
-            if (c == '<') {
-                status = _RUNNING;
+            if (c == ';') {
+                *status = _RUNNING;
                 return RUNNING;
             } else {
-                status = _FAILED;
+                *status = _FAILED;
                 return FAILED;
             }
         case _RUNNING:
-            status = _SUCCEED;
-            *kind = LT;
+            *status = _SUCCEED;
+            *kind = SEMI;
             return SUCCEED;
         case _FAILED:
             return FAILED;
         case _SUCCEED:
-            status = _FAILED;
+            *status = _FAILED;
             return FAILED;
         default:
             perror("unknown internal status ><!");
@@ -135,79 +516,103 @@ static Status lt(int reset, char c, T_Kind* kind) {
 }
 
 // Finite State Machine:
-//              >                   other
+//              \n                  other
 // _INITIAL     _RUNNING            _FAILED
 // _RUNNING     _SUCCEED            _SUCCEED
 // _SUCCEED     _FAILED             _FAILED
 // _FAILED      _FAILED             _FAILED
-static Status rt(int reset, char c, T_Kind* kind) {
-    static enum {
-        _INITIAL,
-        _FAILED,
-        _SUCCEED,
-        _RUNNING
-    } status = _INITIAL;
+static Status newline(State* status, int reset, char c, T_Kind* kind) {
     if (reset) {
-        status = _INITIAL;
+        *status = _INITIAL;
         return INITIAL;
     }
-    switch (status) {
+    switch (*status) {
         case _INITIAL:
-            if (c == '>') {
-                status = _RUNNING;
+            if (c == '\n') {
+                *status = _RUNNING;
                 return RUNNING;
             } else {
-                status = _FAILED;
+                *status = _FAILED;
                 return FAILED;
             }
         case _RUNNING:
-            status = _SUCCEED;
-            *kind = RT;
+            *status = _SUCCEED;
+            *kind = NEWLINE;
             return SUCCEED;
         case _FAILED:
             return FAILED;
         case _SUCCEED:
-            status = _FAILED;
+            *status = _FAILED;
             return FAILED;
         default:
             perror("unknown internal status ><!");
             exit(-1);
     }
 }
+
 // Finite State Machine:
-//              |                  other
+//              (                   other
 // _INITIAL     _RUNNING            _FAILED
 // _RUNNING     _SUCCEED            _SUCCEED
 // _SUCCEED     _FAILED             _FAILED
 // _FAILED      _FAILED             _FAILED
-static Status pipe(int reset, char c, T_Kind* kind) {
-    static enum {
-        _INITIAL,
-        _FAILED,
-        _SUCCEED,
-        _RUNNING
-    } status = _INITIAL;
+static Status parentl(State* status, int reset, char c, T_Kind* kind) {
     if (reset) {
-        status = _INITIAL;
+        *status = _INITIAL;
         return INITIAL;
     }
-    switch (status) {
+    switch (*status) {
         case _INITIAL:
-            if (c == '|') {
-                status = _RUNNING;
+            if (c == '(') {
+                *status = _RUNNING;
                 return RUNNING;
             } else {
-                status = _FAILED;
+                *status = _FAILED;
                 return FAILED;
             }
         case _RUNNING:
-            status = _SUCCEED;
-            *kind = PIPE;
+            *status = _SUCCEED;
+            *kind = PARENTL;
             return SUCCEED;
         case _FAILED:
             return FAILED;
         case _SUCCEED:
-            status = _FAILED;
+            *status = _FAILED;
+            return FAILED;
+        default:
+            perror("unknown internal status ><!");
+            exit(-1);
+    }
+}
+
+// Finite State Machine:
+//              )                   other
+// _INITIAL     _RUNNING            _FAILED
+// _RUNNING     _SUCCEED            _SUCCEED
+// _SUCCEED     _FAILED             _FAILED
+// _FAILED      _FAILED             _FAILED
+static Status parentr(State* status, int reset, char c, T_Kind* kind) {
+    if (reset) {
+        *status = _INITIAL;
+        return INITIAL;
+    }
+    switch (*status) {
+        case _INITIAL:
+            if (c == ')') {
+                *status = _RUNNING;
+                return RUNNING;
+            } else {
+                *status = _FAILED;
+                return FAILED;
+            }
+        case _RUNNING:
+            *status = _SUCCEED;
+            *kind = PARENTR;
+            return SUCCEED;
+        case _FAILED:
+            return FAILED;
+        case _SUCCEED:
+            *status = _FAILED;
             return FAILED;
         default:
             perror("unknown internal status ><!");
@@ -216,7 +621,7 @@ static Status pipe(int reset, char c, T_Kind* kind) {
 }
 
 static int is_blank(char c) {
-    return c == ' ' || c == '\t' || c == '\n';
+    return c == ' ' || c == '\t';
 }
 // Finite State Machine:
 //              &                   other
@@ -224,34 +629,28 @@ static int is_blank(char c) {
 // _RUNNING     _SUCCEED            _SUCCEED
 // _SUCCEED     _FAILED             _FAILED
 // _FAILED      _FAILED             _FAILED
-static Status background(int reset, char c, T_Kind* kind) {
-    static enum {
-        _INITIAL,
-        _FAILED,
-        _SUCCEED,
-        _RUNNING
-    } status = _INITIAL;
+static Status background(State* status, int reset, char c, T_Kind* kind) {
     if (reset) {
-        status = _INITIAL;
+        *status = _INITIAL;
         return INITIAL;
     }
-    switch (status) {
+    switch (*status) {
         case _INITIAL:
             if (c == '&') {
-                status = _RUNNING;
+                *status = _RUNNING;
                 return RUNNING;
             } else {
-                status = _FAILED;
+                *status = _FAILED;
                 return FAILED;
             }
         case _RUNNING:
-            status = _SUCCEED;
+            *status = _SUCCEED;
             *kind = BACKGROUND;
             return SUCCEED;
         case _FAILED:
             return FAILED;
         case _SUCCEED:
-            status = _FAILED;
+            *status = _FAILED;
             return FAILED;
         default:
             perror("unknown internal status ><!");
@@ -266,29 +665,23 @@ static Status background(int reset, char c, T_Kind* kind) {
 // _RUNNING     _RUNNING            _SUCCEED
 // _SUCCEED     _FAILED             _FAILED
 // _FAILED      _FAILED             _FAILED
-static Status blank(int reset, char c, T_Kind* kind) {
-    static enum {
-        _INITIAL,
-        _FAILED,
-        _SUCCEED,
-        _RUNNING
-    } status = _INITIAL;
+static Status blank(State* status, int reset, char c, T_Kind* kind) {
     if (reset) {
-        status = _INITIAL;
+        *status = _INITIAL;
         return INITIAL;
     }
-    switch (status) {
+    switch (*status) {
         case _INITIAL:
             if (is_blank(c)) {
-                status = _RUNNING;
+                *status = _RUNNING;
                 return RUNNING;
             } else {
-                status = _FAILED;
+                *status = _FAILED;
                 return FAILED;
             }
         case _RUNNING:
             if (!is_blank(c)) {
-                status = _SUCCEED;
+                *status = _SUCCEED;
                 *kind = BLANK;
                 return SUCCEED;
             } else {
@@ -297,7 +690,7 @@ static Status blank(int reset, char c, T_Kind* kind) {
         case _FAILED:
             return FAILED;
         case _SUCCEED:
-            status = _FAILED;
+            *status = _FAILED;
             return FAILED;
         default:
             perror("unknown internal status ><!");
@@ -305,29 +698,36 @@ static Status blank(int reset, char c, T_Kind* kind) {
     }
 }
 
+static Status (*const lexers[])(State*, int, char, T_Kind*) = {
+    lt,     // <
+    rt,     // >
+    blank,
+    pipe,
+    background,
+    semi,
+    newline,
+    parentl, // (
+    parentr  // )
+};
+enum { N_LEXER = sizeof(lexers) / sizeof(lexers[0]) };
+
+typedef struct {
+    State states[N_LEXER];
+} Lexer;
+
 // Bind all the lexer together.
-static Status bind(int reset, char c, T_Kind* kind) {
-
-    static Status (*lexers[])(int, char, T_Kind*) = {
-        word,   // word
-        lt,     // <
-        rt,     // >
-        blank,
-        pipe,
-        background
-    };
-    static const int N_LEXER = sizeof(lexers) / sizeof(lexers[0]);
-    static T_Kind kinds[N_LEXER];
-    static Status ss[N_LEXER];
+static Status bind(Lexer* lexer, int reset, char c, T_Kind* kind) {
+    T_Kind kinds[N_LEXER];
+    Status ss[N_LEXER];
 
     if (reset) {
         for (int i = 0; i < N_LEXER; ++i) {
-            lexers[i](1, 0, NULL);
+            lexers[i](lexer->states + i, 1, 0, NULL);
         }
         return INITIAL;
     }
     for (int i = 0; i < N_LEXER; ++i) {
-        ss[i] = lexers[i](0, c, kinds + i);
+        ss[i] = lexers[i](lexer->states + i, 0, c, kinds + i);
     }
     // Check the status of every lexer.
     for (int i = 0; i < N_LEXER; ++i) {
@@ -342,28 +742,82 @@ static Status bind(int reset, char c, T_Kind* kind) {
     return FAILED;
 }
 
-Token* lex(const char* source) {
+static Tokens* lex_source(const char* source, int* open) {
+
+    pthread_once(&scanner_once, init_scanner);
 
-    int len = strlen(source);
+    size_t len = strlen(source);
 
     // Reset all the lexers.
-    bind(1, 0, NULL);
+    Lexer lexer;
+    bind(&lexer, 1, 0, NULL);
 
     // For the lexers.
     T_Kind kind;
-    Status status;
+    Status status = INITIAL;
 
-    // Token list;
-    Token* head = NULL;
-    Token* last = NULL;
+    Tokens* tokens = make_tokens();
 
-    int curr = 0;
-    int prev = 0;
+    size_t curr = 0;
+    size_t prev = 0;
+
+    Bodies bodies = { 0, 0, 0 };
 
     while (curr < len) {
 
+        // The here-documents of the line end, the scan goes on after the
+        // last delimiter line.
+        if (bodies.to > 0 && curr == bodies.from && curr == prev) {
+            curr = prev = bodies.to < len ? bodies.to + 1 : len;
+            bodies.from = bodies.to = 0;
+            continue;
+        }
+
+        // A backslash-newline joins the lines.
+        if (curr == prev && source[curr] == '\\' && curr + 1 < len && source[curr + 1] == '\n') {
+            curr = prev = curr + 2;
+            continue;
+        }
+
+        if (curr == prev && is_here_start(source, curr, len)) {
+            char* word;
+            curr = scan_here(source, curr, len, &bodies, &word);
+            if (curr == OPEN) break;
+            push_token(tokens, LT, prev, source + prev, 0);
+            push_token(tokens, WORD, prev, word, strlen(word));
+            free(word);
+            prev = curr;
+            status = INITIAL;
+            continue;
+        }
+
+        // A comment goes to the end of the line.
+        if (curr == prev && source[curr] == '#') {
+            const char* nl = memchr(source + curr, '\n', len - curr);
+            curr = prev = nl != NULL ? (size_t)(nl - source) : len;
+            continue;
+        }
+
+        // Words are scanned in one go.
+        if (curr == prev && is_subst_start(source, curr, len)) {
+            curr = scan_subst(source, curr, len);
+            if (curr == OPEN) break;
+            push_token(tokens, WORD, prev, source + prev, curr - prev);
+            prev = curr;
+            status = INITIAL;
+            continue;
+        }
+        if (curr == prev && is_not_metachar(source[curr])) {
+            curr = scan_word(source, curr, len);
+            if (curr == OPEN) break;
+            push_token(tokens, WORD, prev, source + prev, curr - prev);
+            prev = curr;
+            status = INITIAL;
+            continue;
+        }
+
         // Feed the char to the lexers.
-        status = bind(0, source[curr], &kind);
+        status = bind(&lexer, 0, source[curr], &kind);
 
         switch (status) {
             case RUNNING:
@@ -372,25 +826,20 @@ Token* lex(const char* source) {
             case SUCCEED:
                 // Get the recognized token.
                 if (kind != BLANK) {
-                    Token* token = make_token(kind, source + prev, curr - prev);
-                    if (head == NULL) {
-                        head = token;
-                        last = token;
-                    } else {
-                        last->next = token;
-                        last = token;
-                    }
+                    push_token(tokens, kind, prev, source + prev, curr - prev);
                 }
                 // Reset the lexers.
-                bind(1, 0, NULL);
+                bind(&lexer, 1, 0, NULL);
                 // Set the prev to curr.
                 prev = curr;
                 // Notice that in this case we do not increase curr.
                 break;
             case FAILED:
                 // Unknown token.
-                perror("Unknown token ><!");
-                exit(-1);
+                tokens->error = "unknown token";
+                tokens->at = curr;
+                curr = len;
+                break;
             default:
                 perror("Illegal status ><!");
                 exit(-2);
@@ -399,22 +848,107 @@ Token* lex(const char* source) {
 
     // Remember to feed the EOF char to the lexers.
     if (status == RUNNING) {
-        status = bind(0, 0, &kind);
+        status = bind(&lexer, 0, 0, &kind);
         if (status == SUCCEED) {
             if (kind != BLANK) {
-                Token* token = make_token(kind, source + prev, curr - prev);
-                if (head == NULL) {
-                    head = token;
-                    last = token;
-                } else {
-                    last->next = token;
-                    last = token;
-                }
+                push_token(tokens, kind, prev, source + prev, curr - prev);
             }
             // Reset the lexers.
-            bind(1, 0, NULL);
+            bind(&lexer, 1, 0, NULL);
         }
     }
 
-    return head;
+    tokens->starts[tokens->n] = curr == OPEN ? len : curr;
+
+    // A quote, a substitution, a here-document or a line ending with a
+    // backslash goes on after the end.
+    int escaped = len >= 2 && source[len - 1] == '\n' && source[len - 2] == '\\' && prev == len;
+    if (curr == OPEN) {
+        *open = LEX_UNTERMINATED;
+        tokens->error = left_open;
+        tokens->at = prev;
+    } else {
+        *open = bodies.open || escaped ? LEX_CONTINUED : LEX_CLOSED;
+    }
+    return tokens;
+}
+
+size_t subst_length(const char* s) {
+    pthread_once(&scanner_once, init_scanner);
+    if (s[0] != '$' || s[1] != '(') return 0;
+    size_t end = scan_subst(s, 0, strlen(s));
+    return end == OPEN ? 0 : end;
+}
+
+Tokens* lex(const char* source) {
+    int open;
+    return lex_source(source, &open);
+}
+
+Tokens* lex_partial(const char* source, int* open) {
+    return lex_source(source, open);
+}
+
+static void push_open(LexOpen* open, char c) {
+    if (open->depth == open->cap) {
+        open->cap = open->cap > 0 ? open->cap * 2 : 8;
+        open->stack = realloc(open->stack, open->cap);
+    }
+    open->stack[open->depth++] = c;
+}
+
+// The same rules as skip_quoted, scan_word and scan_subst, one byte at a
+// time with the nesting on a stack rather than in the calls.
+size_t lex_resume(const char* s, size_t i, size_t len, LexOpen* open) {
+    if (open->depth == 0 && is_subst_start(s, i, len)) {
+        push_open(open, '(');
+        i += 2;
+    }
+    while (i < len) {
+        char c = s[i];
+        char in = open->depth > 0 ? open->stack[open->depth - 1] : 0;
+        if (in == '\'') {
+            const char* close = memchr(s + i, '\'', len - i);
+            if (close == NULL) return len;
+            open->depth--;
+            i = close - s + 1;
+            continue;
+        }
+        if (c == '\\') {
+            i += 2;
+            continue;
+        }
+        if (in == '"') {
+            if (c == '"') {
+                open->depth--;
+            } else if (c == '$' && i + 1 < len && s[i + 1] == '(') {
+                push_open(open, '(');
+                i++;
+            }
+        } else if (in == '(') {
+            if (c == '(' || c == '\'' || c == '"') {
+                push_open(open, c);
+            } else if (c == ')') {
+                open->depth--;
+            }
+        } else if (c == '\'' || c == '"') {
+            push_open(open, c);
+        } else if (c == '$' && i + 1 < len && s[i + 1] == '(') {
+            push_open(open, '(');
+            i++;
+        } else if (!is_not_metachar(c)) {
+            return i;
+        }
+        i++;
+    }
+    return len;
 }
+
+char* here_delimiter(const char* word, size_t n, int* strip) {
+    if (n < 2 || word[0] != '<' || word[1] != '<' || (n > 2 && word[2] == '<')) return NULL;
+    size_t i = 2;
+    *strip = i < n && word[i] == '-';
+    if (*strip) i++;
+    while (i < n && (word[i] == ' ' || word[i] == '\t')) i++;
+    return unquote(word + i, n - i);
+}
\ No newline at end of file
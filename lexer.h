@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <fcntl.h>
 #include <string.h>
+#include <stdint.h>
 #include <assert.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -17,18 +18,77 @@ typedef enum {
     PARENTR,    // )
     PIPE,       // |
     BACKGROUND, // &
-    BLANK       // (' ' | \n | \t)+
+    SEMI,       // ;
+    NEWLINE,    // \n
+    BLANK,      // (' ' | \t)+
+    END         // After the last token.
 } T_Kind;
 
-typedef struct Token {
-    T_Kind kind;
-    union {
-        const char* word;
-    } data;
-    struct Token* next;
-} Token;
+/// Where the text of a WORD is, in the 'text' of its Tokens.
+typedef struct {
+    uint32_t off;
+    uint32_t len;
+} Span;
 
-void delete_token(Token* token);
-void delete_tokens(Token* token);
+/// The tokens of a source, in arrays rather than linked nodes: the kinds
+/// one after the other, and the spans of the words in a second array,
+/// the words themselves NUL-terminated back to back in 'text'. kinds[n]
+/// is END, the parser looks at it without checking n.
+/// A source which does not lex has the tokens up to the 'error'.
+typedef struct {
+    size_t n;
+    size_t cap;
+    T_Kind* kinds;
+    Span* spans;        // Only set for WORD tokens.
+    uint32_t* starts;   // The offset of each token in the source.
+    char* text;
+    size_t len;
+    size_t room;
+    const char* error;  // Why the source does not lex, or NULL.
+    size_t at;          // Where, the offset in the source.
+} Tokens;
 
-Token* lex(const char* source);
\ No newline at end of file
+/// Whether 'c' can be part of a word, unquoted.
+int is_not_metachar(char c);
+
+/// The word of the i-th token, which is a WORD.
+const char* token_word(const Tokens* tokens, size_t i);
+
+void delete_tokens(Tokens* tokens);
+
+/// Lex the source, the lexer keeps no state between calls so sources can
+/// be lexed on several threads.
+Tokens* lex(const char* source);
+
+/// The length of the command substitution '$(...)' at the start of 's', up
+/// to the matching ')', or 0 if 's' does not start with a closed one.
+size_t subst_length(const char* s);
+
+/// How a partial source ends.
+enum {
+    LEX_CLOSED,
+    LEX_CONTINUED,      // In a here-document, or after a backslash-newline.
+    LEX_UNTERMINATED    // In a quote or a substitution, from tokens->at.
+};
+
+/// Lex what there is of the source, '*open' tells how it ends. Unless it
+/// is LEX_CLOSED the command goes on in the next lines.
+Tokens* lex_partial(const char* source, int* open);
+
+/// The quotes and substitutions open at the end of a line, the innermost
+/// last: '\'', '"' or '(' for each.
+typedef struct {
+    char* stack;
+    size_t depth;
+    size_t cap;
+} LexOpen;
+
+/// Go on scanning a word at 'i' with what 'open' holds open, for a source
+/// which comes line by line. Returns where the word ends, at a metachar
+/// with nothing open, or 'len'.
+size_t lex_resume(const char* s, size_t i, size_t len, LexOpen* open);
+
+/// The delimiter of the here-document word in the 'n' bytes at 'word',
+/// up to its body, without its quotes and malloc'ed. '*strip' tells
+/// whether the tabs are stripped. NULL for a here-string.
+char* here_delimiter(const char* word, size_t n, int* strip);
\ No newline at end of file
@@ -1,7 +1,62 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include "IO.h"
+#include "parser.h"
 #include "ush.h"
+#include "script.h"
+#include "serve.h"
+#include "stream.h"
+#include "check.h"
 
-int main(void) {
+int main(int argc, char** argv) {
+
+    ush_init();
+
+    // ush -n [-j N] file...
+    if (argc > 1 && !strcmp(argv[1], "-n")) {
+        return check_files(argc - 2, argv + 2);
+    }
+
+    // ush --compile script...
+    if (argc > 1 && !strcmp(argv[1], "--compile")) {
+        int failed = 0;
+        for (int i = 2; i < argc; ++i) {
+            failed |= compile_script(argv[i]) < 0;
+        }
+        return failed;
+    }
+
+    // ush --serve socket [workers]
+    if (argc > 2 && !strcmp(argv[1], "--serve")) {
+        int workers = argc > 3 ? atoi(argv[3]) : SERVE_WORKERS;
+        return serve(argv[2], workers > 0 ? workers : SERVE_WORKERS) < 0;
+    }
+
+    // ush --client socket line
+    if (argc > 3 && !strcmp(argv[1], "--client")) {
+        int fd = serve_connect(argv[2]);
+        if (fd < 0) {
+            fprintf(stderr, "%s: %s\n", argv[2], strerror(errno));
+            return 1;
+        }
+        int status = serve_request(fd, argv[3], 1, 2);
+        close(fd);
+        return status < 0 ? 1 : status;
+    }
+
+    // ush script
+    if (argc > 1) {
+        ush_trace = 0;
+        return run_script(argv[1]) < 0;
+    }
+
+    // A piped script runs as it is read.
+    if (!isatty(0)) {
+        ush_trace = 0;
+        return run_stream(0) < 0;
+    }
 
     while (1) {
         const char* source = fetch();
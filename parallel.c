@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "ush.h"
+#include "deque.h"
+#include "jobs.h"
+
+/// parallel [-j N] [-v] cmd [arg...] [::: item...]
+///
+/// Runs 'cmd arg...' once per item, with every '{}' in the words replaced
+/// by the item, or the item appended if there is no '{}'. Without ':::'
+/// the items are the lines of stdin. At most N jobs run at once, one per
+/// worker thread, N defaults to the number of cores.
+///
+/// The jobs are dealt out to the workers' deques up front. A worker which
+/// runs out steals from the others, so a few slow jobs do not leave the
+/// other workers idle while one has a backlog.
+
+typedef struct {
+    size_t index;
+    const char* item;
+    int status;
+} Job;
+
+typedef struct {
+    char** cmd;
+    size_t n_cmd;
+    int has_braces;
+    Deque* deques;
+    size_t n;
+    int verbose;
+    int null;                   // stdin of the jobs.
+    pthread_mutex_t report;     // One status line at a time.
+    size_t failed;
+} Pool;
+
+typedef struct {
+    Pool* pool;
+    size_t self;
+} Worker;
+
+// Replace every "{}" in 'word' by 'item'.
+static char* substitute(const char* word, const char* item) {
+    size_t n = 0;
+    for (const char* p = strstr(word, "{}"); p != NULL; p = strstr(p + 2, "{}")) n++;
+    if (n == 0) return strdup(word);
+    size_t len = strlen(item);
+    char* out = malloc(strlen(word) + n * len + 1);
+    char* o = out;
+    const char* p = word;
+    for (const char* q; (q = strstr(p, "{}")) != NULL; p = q + 2) {
+        memcpy(o, p, q - p);
+        o += q - p;
+        memcpy(o, item, len);
+        o += len;
+    }
+    strcpy(o, p);
+    return out;
+}
+
+static char** job_words(const Pool* pool, const char* item) {
+    char** words = malloc((pool->n_cmd + 2) * sizeof(char*));
+    size_t n = 0;
+    for (size_t i = 0; i < pool->n_cmd; ++i) {
+        words[n++] = substitute(pool->cmd[i], item);
+    }
+    if (!pool->has_braces) {
+        words[n++] = strdup(item);
+    }
+    words[n] = NULL;
+    return words;
+}
+
+static void* work(void* arg) {
+    Worker* worker = arg;
+    Pool* pool = worker->pool;
+    void* p;
+    while (deque_take(pool->deques, pool->n, worker->self, &p) == 0) {
+        Job* job = p;
+        char** words = job_words(pool, job->item);
+        pid_t pid = spawn_words(words, pool->null);
+        job->status = pid < 0 ? 127 : wait_pid(pid);
+        for (char** w = words; *w != NULL; ++w) {
+            free(*w);
+        }
+        free(words);
+
+        if (job->status != 0 || pool->verbose) {
+            pthread_mutex_lock(&pool->report);
+            fprintf(stderr, "parallel: job %zu (%s) exited with %d\n", job->index + 1, job->item, job->status);
+            pthread_mutex_unlock(&pool->report);
+        }
+        if (job->status != 0) {
+            __atomic_add_fetch(&pool->failed, 1, __ATOMIC_RELAXED);
+        }
+    }
+    return NULL;
+}
+
+// The lines of stdin, without their newline.
+static size_t read_items(char*** items) {
+    size_t n = 0, cap = 64;
+    *items = malloc(cap * sizeof(char*));
+    char* line = NULL;
+    size_t line_cap = 0;
+    ssize_t len;
+    while ((len = getline(&line, &line_cap, stdin)) >= 0) {
+        if (len > 0 && line[len - 1] == '\n') line[--len] = '\0';
+        if (len == 0) continue;
+        if (n == cap) {
+            cap *= 2;
+            *items = realloc(*items, cap * sizeof(char*));
+        }
+        (*items)[n++] = strdup(line);
+    }
+    free(line);
+    clearerr(stdin);
+    return n;
+}
+
+int simple_parallel(size_t n, char** words){
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    int verbose = 0;
+    size_t i = 1;
+    for (; i < n && words[i][0] == '-'; ++i) {
+        if (!strcmp(words[i], "-v")) {
+            verbose = 1;
+        } else if (!strncmp(words[i], "-j", 2)) {
+            const char* value = words[i][2] ? words[i] + 2 : (i + 1 < n ? words[++i] : "");
+            char* end;
+            jobs = strtol(value, &end, 10);
+            if (*end != '\0' || jobs <= 0) {
+                fprintf(stderr, "parallel: bad job count %s\n", value);
+                return 2;
+            }
+        } else {
+            break;
+        }
+    }
+    size_t n_cmd = 0;
+    while (i + n_cmd < n && strcmp(words[i + n_cmd], ":::")) n_cmd++;
+    if (n_cmd == 0) {
+        fprintf(stderr, "usage: parallel [-j N] [-v] cmd [arg...] [::: item...]\n");
+        return 2;
+    }
+
+    char** items;
+    size_t n_items;
+    int from_stdin = i + n_cmd == n;
+    if (from_stdin) {
+        n_items = read_items(&items);
+    } else {
+        items = words + i + n_cmd + 1;
+        n_items = n - (i + n_cmd + 1);
+    }
+
+    Pool pool = {
+        .cmd = words + i,
+        .n_cmd = n_cmd,
+        .has_braces = 0,
+        .n = jobs < (long)n_items ? (size_t)jobs : n_items,
+        .verbose = verbose,
+        .null = open("/dev/null", O_RDONLY | O_CLOEXEC),
+        .failed = 0
+    };
+    for (size_t k = 0; k < n_cmd; ++k) {
+        if (strstr(pool.cmd[k], "{}") != NULL) pool.has_braces = 1;
+    }
+    pthread_mutex_init(&pool.report, NULL);
+
+    // Fill the command table now, the workers fork concurrently.
+    if (strstr(pool.cmd[0], "{}") == NULL) {
+        resolve_command(pool.cmd[0]);
+    }
+    // Otherwise the jobs would write the buffered output again.
+    fflush(stdout);
+    fflush(stderr);
+
+    Job* job = malloc(n_items * sizeof(Job));
+    pool.deques = malloc((pool.n ? pool.n : 1) * sizeof(Deque));
+    for (size_t k = 0; k < pool.n; ++k) {
+        deque_init(pool.deques + k);
+    }
+    // Backwards, so each worker pops its jobs in order.
+    for (size_t k = n_items; k-- > 0;) {
+        job[k] = (Job){ .index = k, .item = items[k], .status = 0 };
+        deque_push(pool.deques + k % pool.n, job + k);
+    }
+
+    // The workers wait through the event loop, SIGCHLD must be blocked in them.
+    jobs_init();
+    pthread_t* threads = malloc((pool.n ? pool.n : 1) * sizeof(pthread_t));
+    Worker* workers = malloc((pool.n ? pool.n : 1) * sizeof(Worker));
+    for (size_t k = 0; k < pool.n; ++k) {
+        workers[k] = (Worker){ &pool, k };
+        pthread_create(threads + k, NULL, work, workers + k);
+    }
+    // All of them before the deques go, the last ones may still steal.
+    for (size_t k = 0; k < pool.n; ++k) {
+        pthread_join(threads[k], NULL);
+    }
+    for (size_t k = 0; k < pool.n; ++k) {
+        deque_destroy(pool.deques + k);
+    }
+
+    free(workers);
+    free(threads);
+    free(pool.deques);
+    free(job);
+    if (pool.null >= 0) close(pool.null);
+    pthread_mutex_destroy(&pool.report);
+    if (from_stdin) {
+        for (size_t k = 0; k < n_items; ++k) free(items[k]);
+        free(items);
+    }
+    // Like GNU parallel, the number of failed jobs up to 101.
+    return pool.failed > 101 ? 101 : (int)pool.failed;
+}
\ No newline at end of file
@@ -1,43 +1,301 @@
 #include "parser.h"
 
-static char* token_cpy(const Token* t) {
-    if (t->kind != WORD) {
-        perror("internal error: non-word in token copy.");
-        exit(-1);
+/// The parser is LL(1) and driven by tables: a stack of grammar symbols
+/// starts with cmd-list, a nonterminal on top is replaced by the rule
+/// which 'predict' gives for the next token, a terminal on top has to be
+/// that token. Nothing is ever tried twice. The actions among the symbols
+/// of a rule build the tree as the tokens go by.
+
+/// The terminals, which are the token kinds with the keywords told apart
+/// from the other words. The words come first.
+typedef enum {
+    T_WORD,
+    T_IN,           // in
+    T_FOR,          // for
+    T_WHILE,        // while
+    T_UNTIL,        // until
+    T_DO,           // do
+    T_DONE,         // done
+    T_LBRACE,       // {
+    T_RBRACE,       // }
+    T_LT,
+    T_RT,
+    T_PARENTL,
+    T_PARENTR,
+    T_PIPE,
+    T_BACKGROUND,
+    T_SEMI,
+    T_NEWLINE,
+    T_END,
+    N_TERMINAL
+} Terminal;
+
+/// The nonterminals, see the grammar in parser.h.
+enum {
+    NT_LIST = 32,   // cmd-list
+    NT_NEWLINES,    // Newlines where one more part has to come.
+    NT_REST,        // What follows a command of the list.
+    NT_MORE,        // What follows a separator.
+    NT_CMD,
+    NT_TAIL,        // After the first word, func-def or the rest of a pipe-cmd.
+    NT_ITEMS,       // The words and redirections of a redir-cmd.
+    NT_PIPES,
+    NT_FOR_IN,
+    NT_FOR_WORDS,
+    NT_SEPARATOR,
+    NT_LAST
+};
+enum { N_NONTERMINAL = NT_LAST - NT_LIST };
+
+/// The actions, they work on the last word matched.
+enum {
+    A_PIPE = 64,    // A new pipe-cmd in the list.
+    A_REDIR,        // The next redir-cmd of the pipe.
+    A_WORD,
+    A_IN,
+    A_OUT,
+    A_SIMPLE,       // The redir-cmd is complete, it needs a word.
+    A_FOR,
+    A_VAR,
+    A_IN_WORDS,
+    A_FOR_WORD,
+    A_WHILE,
+    A_UNTIL,
+    A_FUNC,         // The pipe-cmd so far is the name of a function.
+    A_SUB,          // A cmd-list inside the last command starts.
+    A_END,          // and ends.
+    A_BACKGROUND
+};
+
+enum {
+    R_NONE,
+    R_EMPTY,
+    R_LIST,
+    R_NEWLINES,
+    R_REST_SEMI,
+    R_REST_BACKGROUND,
+    R_NEWLINE_MORE,
+    R_MORE_CMD,
+    R_FOR,
+    R_WHILE,
+    R_UNTIL,
+    R_WORD_CMD,
+    R_REDIR_CMD,
+    R_FUNC,
+    R_TAIL,
+    R_ITEM_WORD,
+    R_ITEM_IN,
+    R_ITEM_OUT,
+    R_PIPE,
+    R_FOR_IN,
+    R_FOR_WORD,
+    R_SEMI,
+    R_NEWLINE
+};
+
+// A rule is its length and its symbols.
+#define RULE(...) { sizeof((unsigned char[]){ __VA_ARGS__ }), __VA_ARGS__ }
+
+static const unsigned char rules[][13] = {
+    [R_NONE] = { 0 },
+    [R_EMPTY] = { 0 },
+    [R_LIST] = RULE(NT_NEWLINES, NT_CMD, NT_REST),
+    [R_NEWLINES] = RULE(T_NEWLINE, NT_NEWLINES),
+    [R_REST_SEMI] = RULE(T_SEMI, NT_MORE),
+    [R_REST_BACKGROUND] = RULE(T_BACKGROUND, A_BACKGROUND, NT_MORE),
+    [R_NEWLINE_MORE] = RULE(T_NEWLINE, NT_MORE),
+    [R_MORE_CMD] = RULE(NT_CMD, NT_REST),
+    [R_FOR] = RULE(T_FOR, A_FOR, T_WORD, A_VAR, NT_FOR_IN, NT_SEPARATOR, NT_NEWLINES,
+        T_DO, A_SUB, NT_LIST, A_END, T_DONE),
+    [R_WHILE] = RULE(T_WHILE, A_WHILE, A_SUB, NT_LIST, A_END,
+        T_DO, A_SUB, NT_LIST, A_END, T_DONE),
+    [R_UNTIL] = RULE(T_UNTIL, A_UNTIL, A_SUB, NT_LIST, A_END,
+        T_DO, A_SUB, NT_LIST, A_END, T_DONE),
+    [R_WORD_CMD] = RULE(T_WORD, A_PIPE, A_WORD, NT_TAIL),
+    [R_REDIR_CMD] = RULE(A_PIPE, NT_ITEMS, A_SIMPLE, NT_PIPES),
+    [R_FUNC] = RULE(T_PARENTL, T_PARENTR, A_FUNC, NT_NEWLINES,
+        T_LBRACE, A_SUB, NT_LIST, A_END, T_RBRACE),
+    [R_TAIL] = RULE(NT_ITEMS, A_SIMPLE, NT_PIPES),
+    [R_ITEM_WORD] = RULE(T_WORD, A_WORD, NT_ITEMS),
+    [R_ITEM_IN] = RULE(T_LT, T_WORD, A_IN, NT_ITEMS),
+    [R_ITEM_OUT] = RULE(T_RT, T_WORD, A_OUT, NT_ITEMS),
+    [R_PIPE] = RULE(T_PIPE, A_REDIR, NT_NEWLINES, NT_ITEMS, A_SIMPLE, NT_PIPES),
+    [R_FOR_IN] = RULE(T_IN, A_IN_WORDS, NT_FOR_WORDS),
+    [R_FOR_WORD] = RULE(T_WORD, A_FOR_WORD, NT_FOR_WORDS),
+    [R_SEMI] = RULE(T_SEMI),
+    [R_NEWLINE] = RULE(T_NEWLINE)
+};
+
+// Any word, a keyword is a plain word after the first word of a command.
+#define WORDS(rule) \
+    [T_WORD] = rule, [T_IN] = rule, [T_FOR] = rule, [T_WHILE] = rule, [T_UNTIL] = rule, \
+    [T_DO] = rule, [T_DONE] = rule, [T_LBRACE] = rule, [T_RBRACE] = rule
+
+// The tokens which start a command.
+#define CMD_START(rule) \
+    [T_WORD] = rule, [T_IN] = rule, [T_LBRACE] = rule, [T_FOR] = rule, \
+    [T_WHILE] = rule, [T_UNTIL] = rule, [T_LT] = rule, [T_RT] = rule
+
+/// The rule for a nonterminal and the next token, R_NONE takes the
+/// fallback of the nonterminal.
+static const unsigned char predict[N_NONTERMINAL][N_TERMINAL] = {
+    [NT_LIST - NT_LIST] = { CMD_START(R_LIST), [T_NEWLINE] = R_LIST },
+    [NT_NEWLINES - NT_LIST] = { [T_NEWLINE] = R_NEWLINES },
+    [NT_REST - NT_LIST] = {
+        [T_SEMI] = R_REST_SEMI, [T_BACKGROUND] = R_REST_BACKGROUND, [T_NEWLINE] = R_NEWLINE_MORE
+    },
+    [NT_MORE - NT_LIST] = { CMD_START(R_MORE_CMD), [T_NEWLINE] = R_NEWLINE_MORE },
+    [NT_CMD - NT_LIST] = {
+        [T_WORD] = R_WORD_CMD, [T_IN] = R_WORD_CMD, [T_LBRACE] = R_WORD_CMD,
+        [T_FOR] = R_FOR, [T_WHILE] = R_WHILE, [T_UNTIL] = R_UNTIL,
+        [T_LT] = R_REDIR_CMD, [T_RT] = R_REDIR_CMD
+    },
+    [NT_TAIL - NT_LIST] = { [T_PARENTL] = R_FUNC },
+    [NT_ITEMS - NT_LIST] = { WORDS(R_ITEM_WORD), [T_LT] = R_ITEM_IN, [T_RT] = R_ITEM_OUT },
+    [NT_PIPES - NT_LIST] = { [T_PIPE] = R_PIPE },
+    [NT_FOR_IN - NT_LIST] = { [T_IN] = R_FOR_IN },
+    [NT_FOR_WORDS - NT_LIST] = { WORDS(R_FOR_WORD) },
+    [NT_SEPARATOR - NT_LIST] = { [T_SEMI] = R_SEMI, [T_NEWLINE] = R_NEWLINE }
+};
+
+/// The rule for the tokens left out of 'predict', R_NONE is an error.
+static const unsigned char fallback[N_NONTERMINAL] = {
+    [NT_NEWLINES - NT_LIST] = R_EMPTY,
+    [NT_REST - NT_LIST] = R_EMPTY,
+    [NT_MORE - NT_LIST] = R_EMPTY,
+    [NT_TAIL - NT_LIST] = R_TAIL,
+    [NT_ITEMS - NT_LIST] = R_EMPTY,
+    [NT_PIPES - NT_LIST] = R_EMPTY,
+    [NT_FOR_IN - NT_LIST] = R_EMPTY,
+    [NT_FOR_WORDS - NT_LIST] = R_EMPTY
+};
+
+static Terminal classify(const Tokens* tokens, size_t i) {
+    static const Terminal terminals[] = {
+        [WORD] = T_WORD,
+        [LT] = T_LT,
+        [RT] = T_RT,
+        [PARENTL] = T_PARENTL,
+        [PARENTR] = T_PARENTR,
+        [PIPE] = T_PIPE,
+        [BACKGROUND] = T_BACKGROUND,
+        [SEMI] = T_SEMI,
+        [NEWLINE] = T_NEWLINE,
+        [BLANK] = T_END,    // Never lexed as a token.
+        [END] = T_END
+    };
+    if (tokens->kinds[i] != WORD) {
+        return terminals[tokens->kinds[i]];
     }
-    char* dst = malloc(strlen(t->data.word) + sizeof(char));
-    strcpy(dst, t->data.word);
-    return dst;
+    const char* word = token_word(tokens, i);
+    switch (word[0]) {
+        case 'i': if (!strcmp(word, "in")) return T_IN; break;
+        case 'f': if (!strcmp(word, "for")) return T_FOR; break;
+        case 'w': if (!strcmp(word, "while")) return T_WHILE; break;
+        case 'u': if (!strcmp(word, "until")) return T_UNTIL; break;
+        case 'd':
+            if (!strcmp(word, "do")) return T_DO;
+            if (!strcmp(word, "done")) return T_DONE;
+            break;
+        case '{': if (word[1] == '\0') return T_LBRACE; break;
+        case '}': if (word[1] == '\0') return T_RBRACE; break;
+    }
+    return T_WORD;
 }
 
-/// This function consumes one specific kind of token
-/// and return it.
-static const Token* expect(const Token** ts, T_Kind kind) {
-    if ((*ts) == NULL || (*ts)->kind != kind) {
-        return NULL;
-    } else {
-        const Token* t = *ts;
-        // Move the token stream to next one.
-        *ts = (*ts)->next;
-        return t;
+int is_process_subst(const char* word) {
+    return (word[0] == '<' || word[0] == '>') && word[1] == '(';
+}
+
+int is_here_word(const char* word) {
+    return word[0] == '<' && word[1] == '<';
+}
+
+// Parse the 'n' bytes of commands at 'at' in the word, which may be blank.
+static int check_inner(const char* word, size_t at, size_t n, ParseError* error) {
+    size_t blank = 0;
+    while (blank < n && strchr(" \t\n", word[at + blank]) != NULL) blank++;
+    if (blank == n) return 1;
+    char* inner = strndup(word + at, n);
+    Cmd* cmd = parse_source(inner, error);
+    free(inner);
+    if (cmd == NULL) {
+        error->at += at;
+        return 0;
     }
+    delete_cmd(cmd);
+    return 1;
 }
 
-static SimpleCmd* make_simple_cmd(const Token* words, size_t n) {
-    SimpleCmd* cmd = malloc(sizeof(SimpleCmd));
-    cmd->words = malloc((n + 1) * sizeof(char*));
-    cmd->n = n;
-    const Token* t = words;
-    for (size_t i = 0; i < n; ++i, t = t->next) {
-        cmd->words[i] = token_cpy(t);
+// The commands of a process substitution or of a command substitution
+// have to parse too, and a here word needs its word or delimiter.
+// Returns 0 and sets '*error', its offset in the word, if not.
+static int check_word(const char* word, ParseError* error) {
+    if (is_here_word(word)) {
+        const char* rest = word + 2;
+        if (*rest == '<') rest++;
+        else if (*rest == '-') rest++;
+        if (*rest != '\0' && *rest != '\n') return 1;
+        *error = (ParseError){ "missing here-document delimiter", 0 };
+        return 0;
     }
+    if (is_process_subst(word)) {
+        return check_inner(word, 2, strlen(word) - 3, error);
+    }
+    if (strstr(word, "$(") == NULL) return 1;
+    // Each '$(' which is not quoted, the lexer found its ')'.
+    int dquote = 0;
+    for (size_t i = 0; word[i] != '\0';) {
+        if (word[i] == '\\' && word[i + 1] != '\0') {
+            i += 2;
+        } else if (word[i] == '\'' && !dquote) {
+            i = strchr(word + i + 1, '\'') - word + 1;
+        } else if (word[i] == '"') {
+            dquote = !dquote;
+            i++;
+        } else if (word[i] == '$' && word[i + 1] == '(') {
+            size_t n = subst_length(word + i);
+            if (!check_inner(word, i + 2, n - 3, error)) return 0;
+            i += n;
+        } else {
+            i++;
+        }
+    }
+    return 1;
+}
 
+/// A simple command with room for 'room' words.
+static SimpleCmd* make_simple_cmd(size_t room) {
+    SimpleCmd* cmd = malloc(sizeof(SimpleCmd));
+    cmd->n = 0;
+    cmd->words = malloc((room + 1) * sizeof(char*));
     // Set the last pointer to NULL so that exec
     // can recognize.
-    cmd->words[n] = NULL;
+    cmd->words[0] = NULL;
     return cmd;
 }
 
+static void add_word(SimpleCmd* cmd, char* word) {
+    cmd->words[cmd->n++] = word;
+    cmd->words[cmd->n] = NULL;
+}
+
+/// The number of words from the i-th token to the end of the redir-cmd,
+/// which is all the words it gets: the kinds are scanned ahead so the
+/// words are allocated once.
+static size_t count_words(const Tokens* tokens, size_t i) {
+    size_t n = 0;
+    for (; tokens->kinds[i] == WORD || tokens->kinds[i] == LT || tokens->kinds[i] == RT; ++i) {
+        if (tokens->kinds[i] == WORD) {
+            n++;
+        } else if (tokens->kinds[i + 1] == WORD) {
+            // The target of the redirection.
+            i++;
+        }
+    }
+    return n;
+}
+
 static void delete_simple_cmd(SimpleCmd* cmd) {
     for (size_t i = 0; i < cmd->n; ++i) {
         free(cmd->words[i]);
@@ -47,46 +305,13 @@ static void delete_simple_cmd(SimpleCmd* cmd) {
 }
 
 void print_simple_cmd(const SimpleCmd* cmd) {
-    printf("SimpleCmd(%s", cmd->words[0]);
-    for (size_t i = 1; i < cmd->n; ++i) {
-        printf(" %s", cmd->words[i]);
+    printf("SimpleCmd(");
+    for (size_t i = 0; i < cmd->n; ++i) {
+        printf(i == 0 ? "%s" : " %s", cmd->words[i]);
     }
     printf(")");
 }
 
-/// Grammar:
-/// simple-cmd
-/// : word-list
-/// ;
-/// A simple command is just a none empty list of word.
-static SimpleCmd* parse_simple_cmd(const Token** tokens) {
-    const Token* start = *tokens;
-    if ((*tokens)->kind == WORD) {
-        // Parse succeed.
-        size_t n = 0;
-        while (*tokens != NULL && (*tokens)->kind == WORD) {
-            n++;
-            *tokens = (*tokens)->next;
-        }
-        return make_simple_cmd(start, n);
-    } else {
-        // Parse failed and returns NULL.
-        return NULL;
-    }
-}
-
-/// Notice that this function doesn't copy SimpleCmd,
-/// so if the simple command is freed,
-/// the pointer 'cmd' in redirection command will be indeterminate.
-static RedirCmd* make_redir_cmd(SimpleCmd* simple, const Token* lt, const Token* rt) {
-    RedirCmd* cmd = malloc(sizeof(RedirCmd));
-    cmd->simple = simple;
-    cmd->lhs = lt != NULL ? token_cpy(lt) : NULL;
-    cmd->rhs = rt != NULL ? token_cpy(rt) : NULL;
-    return cmd;
-}
-
-
 static void delete_redir_cmd(RedirCmd* cmd) {
     delete_simple_cmd(cmd->simple);
     if (cmd->lhs != NULL) free(cmd->lhs);
@@ -97,7 +322,10 @@ static void delete_redir_cmd(RedirCmd* cmd) {
 void print_redir_cmd(const RedirCmd* cmd) {
     printf("Redir(");
     print_simple_cmd(cmd->simple);
-    if (cmd->lhs != NULL) {
+    if (cmd->lhs != NULL && is_here_word(cmd->lhs)) {
+        // Without the body of a here-document.
+        printf(" %.*s", (int)strcspn(cmd->lhs, "\n"), cmd->lhs);
+    } else if (cmd->lhs != NULL) {
         printf(" < %s", cmd->lhs);
     }
     if (cmd->rhs != NULL) {
@@ -106,142 +334,22 @@ void print_redir_cmd(const RedirCmd* cmd) {
     printf(")");
 }
 
-/// This is our first 'real' recursive descent parser.
-/// Grammar:
-/// redir-cmd:
-///     : simple-cmd RT WORD LT WORD
-///     | simple-cmd LT WORD RT WORD
-///     | simple-cmd LT WORD
-///     | simple-cmd RT WORD
-///     | simple-cmd
-///     ;
-/// We apply each expansion (or rule) until we find one legal and construct the RedirCmd structure.
-/// This version is very inefficient, we will see how to improve it.
-static RedirCmd* parse_redir_cmd_waste(const Token** tokens) {
-    // Backup the token stream so that we can
-    // start again when one rule failed.
-    const Token* backup = *tokens;
-    SimpleCmd* simple;
-    const Token* lt;
-    const Token* rt;
-
-    // redir-cmd: simple-cmd RT WORD LT WORD;
-    if ((simple = parse_simple_cmd(tokens)) != NULL &&
-        (expect(tokens, RT)) != NULL &&
-        (rt = expect(tokens, WORD)) != NULL &&
-        (expect(tokens, LT)) != NULL &&
-        (lt = expect(tokens, WORD)) != NULL) {
-        return make_redir_cmd(simple, lt, rt);
-    }
-
-    // Failed the last rule.
-    // Restore the backup.
-    *tokens = backup;
-
-    // redir-cmd: simple-cmd LT WORD RT WORD;
-    if ((simple = parse_simple_cmd(tokens)) != NULL &&
-        (expect(tokens, LT)) != NULL &&
-        (lt = expect(tokens, WORD)) != NULL &&
-        (expect(tokens, RT)) != NULL &&
-        (rt = expect(tokens, WORD)) != NULL) {
-        return make_redir_cmd(simple, lt, rt);
-    }
-
-    // Failed the last rule.
-    // Restore the backup.
-    *tokens = backup;
-
-    // redir-cmd: simple-cmd LT WORD;
-    if ((simple = parse_simple_cmd(tokens)) != NULL &&
-        (expect(tokens, LT)) != NULL &&
-        (lt = expect(tokens, WORD)) != NULL) {
-        return make_redir_cmd(simple, lt, NULL);
-    }
-
-    // Failed the last rule.
-    // Restore the backup.
-    *tokens = backup;
-
-    // redir-cmd: simple-cmd RT WORD;
-    if ((simple = parse_simple_cmd(tokens)) != NULL &&
-        (expect(tokens, RT)) != NULL &&
-        (rt = expect(tokens, WORD)) != NULL) {
-        return make_redir_cmd(simple, NULL, rt);
-    }
-
-    *tokens = backup;
-    // redir-cmd: simple-cmd;
-    if ((simple = parse_simple_cmd(tokens)) != NULL) {
-        return make_redir_cmd(simple, NULL, NULL);
-    }
-
-    // Failed all rules, return NULL.
-    return NULL;
-}
-
-/// However, 'parse_redir_cmd_waste' is really inefficient:
-/// it calls 'parse_simple_cmd' five times!
-/// 
-/// This can be improved by factoring the common part and rewrite the rule as
-/// redir-cmd
-///     : simple-cmd redir-cmd-tail
-///     ;
-/// 
-/// redir-cmd-tail
-///     : LT WORD RT WORD
-///     | RT WORD LT WORD
-///     | LT WORD
-///     | RT WORD
-///     | epsilon
-///     ;
-static RedirCmd* parse_redir_cmd_better(const Token** tokens) {
-    SimpleCmd* simple;
-    const Token* lt;
-    const Token* rt;
-
-    if ((simple = parse_simple_cmd(tokens)) == NULL) {
-        return NULL;
-    }
-
-    const Token* backup = *tokens;
-    if ((expect(tokens, RT)) != NULL &&
-        (rt = expect(tokens, WORD)) != NULL) {
-        if ((expect(tokens, LT)) != NULL &&
-            (lt = expect(tokens, WORD)) != NULL) {
-            return make_redir_cmd(simple, lt, rt);
-        } else {
-            return make_redir_cmd(simple, NULL, rt);
-        }
-    }
-
-    *tokens = backup;
-    if ((expect(tokens, LT)) != NULL &&
-        (lt = expect(tokens, WORD)) != NULL) {
-        if ((expect(tokens, RT)) != NULL &&
-            (rt = expect(tokens, WORD)) != NULL) {
-            return make_redir_cmd(simple, lt, rt);
-        } else {
-            return make_redir_cmd(simple, lt, NULL);            
-        }
-    } else {
-        return make_redir_cmd(simple, NULL, NULL);
-    }
-    
-}
-
-/// Therefore we will use the better version.
-static RedirCmd* parse_redir_cmd(const Token** tokens) {
-    return parse_redir_cmd_better(tokens);
-}
-
-static PipeCmd* make_pipe_cmd(RedirCmd* redir) {
+/// An empty redir-cmd, the words and redirections are added as they
+/// come. The words are allocated with the first one.
+static PipeCmd* make_pipe_cmd(void) {
+    RedirCmd* redir = malloc(sizeof(RedirCmd));
+    redir->simple = malloc(sizeof(SimpleCmd));
+    redir->simple->n = 0;
+    redir->simple->words = NULL;
+    redir->lhs = NULL;
+    redir->rhs = NULL;
     PipeCmd* cmd = malloc(sizeof(PipeCmd));
     cmd->redir = redir;
     cmd->next = NULL;
     return cmd;
 }
 
-static void delete_pipe_cmd(PipeCmd* cmd) {
+void delete_pipe_cmd(PipeCmd* cmd) {
     while (cmd != NULL) {
         PipeCmd* next = cmd->next;
         delete_redir_cmd(cmd->redir);
@@ -260,59 +368,599 @@ void print_pipe_cmd(const PipeCmd* cmd) {
     printf(")");
 }
 
-/// TODO: RECURSIVE DESCENT PARSING PIPE COMMAND USING GRAMMAR:
-/// pipe-cmd
-///     : redir-cmd PIPE pipe-cmd
-///     | redir-cmd
-///     ;
-/// 
-/// FOR NOW, PIPE-CMD IS JUST REDIR-CMD.
-static PipeCmd* parse_pipe_cmd(const Token** tokens) {
-    
-    //const Token* pipe;
-    PipeCmd* pipe;
-    RedirCmd* redir = parse_redir_cmd(tokens);
-    if (redir == NULL) {
+static Cmd* make_cmd(C_Kind kind) {
+    Cmd* cmd = calloc(1, sizeof(Cmd));
+    cmd->kind = kind;
+    return cmd;
+}
+
+/// A cmd-list being built.
+typedef struct {
+    Cmd* head;
+    Cmd* last;
+} Frame;
+
+typedef struct {
+    const Tokens* tokens;
+    size_t pos;         // The next token.
+    size_t word;        // The last token matched.
+    Frame* frames;      // The lists of the commands being built, the inner one last.
+    size_t depth;
+    size_t cap;
+    PipeCmd* pipe;      // The redir-cmd being built.
+    ParseError* error;
+    Frame small[8];     // The frames unless the loops nest deeper.
+} Parser;
+
+static void push_frame(Parser* p) {
+    if (p->depth == p->cap) {
+        p->cap *= 2;
+        if (p->frames == p->small) {
+            p->frames = memcpy(malloc(p->cap * sizeof(Frame)), p->small, sizeof(p->small));
+        } else {
+            p->frames = realloc(p->frames, p->cap * sizeof(Frame));
+        }
+    }
+    p->frames[p->depth++] = (Frame){ NULL, NULL };
+}
+
+static void append_cmd(Parser* p, Cmd* cmd) {
+    Frame* frame = &p->frames[p->depth - 1];
+    if (frame->last != NULL) {
+        frame->last->next = cmd;
+    } else {
+        frame->head = cmd;
+    }
+    frame->last = cmd;
+}
+
+static char* word_cpy(const Parser* p) {
+    // The span has the length with it.
+    size_t len = p->tokens->spans[p->word].len;
+    char* word = malloc(len + 1);
+    memcpy(word, token_word(p->tokens, p->word), len + 1);
+    return word;
+}
+
+// The word of the last token matched, checked.
+static char* checked_word(Parser* p) {
+    char* word = word_cpy(p);
+    if (!check_word(word, p->error)) {
+        p->error->at += p->tokens->starts[p->word];
+        free(word);
         return NULL;
     }
-    else{
-        const Token* backup = *tokens;
-        if(expect(tokens, PIPE) != NULL && (pipe = parse_pipe_cmd(tokens)) != NULL) {
-            PipeCmd* head = make_pipe_cmd(redir);
-            head->next = pipe;
-            return head;
+    return word;
+}
+
+// Set a redirection, the last one of a kind wins.
+static int redirect(Parser* p, char** target) {
+    char* word = checked_word(p);
+    if (word == NULL) {
+        return 0;
+    }
+    free(*target);
+    *target = word;
+    return 1;
+}
+
+/// Run an action, returns 0 if the tokens are wrong after all.
+static int act(Parser* p, int action) {
+    Cmd* last = p->frames[p->depth - 1].last;
+    switch (action) {
+        case A_PIPE: {
+            Cmd* cmd = make_cmd(CMD_PIPE);
+            cmd->data.pipe = p->pipe = make_pipe_cmd();
+            append_cmd(p, cmd);
+            return 1;
+        }
+        case A_REDIR:
+            p->pipe = p->pipe->next = make_pipe_cmd();
+            return 1;
+        case A_WORD: {
+            char* word = checked_word(p);
+            if (word == NULL) {
+                return 0;
+            }
+            SimpleCmd* simple = p->pipe->redir->simple;
+            if (simple->words == NULL) {
+                simple->words = malloc((count_words(p->tokens, p->word) + 1) * sizeof(char*));
+            }
+            add_word(simple, word);
+            return 1;
         }
-        else{
-            *tokens = backup;
-            return make_pipe_cmd(redir);
+        case A_IN:
+            return redirect(p, &p->pipe->redir->lhs);
+        case A_OUT:
+            return redirect(p, &p->pipe->redir->rhs);
+        case A_SIMPLE:
+            if (p->pipe->redir->simple->n > 0) return 1;
+            *p->error = (ParseError){ "missing command", p->tokens->starts[p->pos] };
+            return 0;
+        case A_FOR:
+            append_cmd(p, make_cmd(CMD_FOR));
+            return 1;
+        case A_VAR:
+            last->data.loop_for.var = word_cpy(p);
+            return 1;
+        case A_IN_WORDS:
+            last->data.loop_for.words = make_simple_cmd(count_words(p->tokens, p->word + 1));
+            return 1;
+        case A_FOR_WORD:
+            add_word(last->data.loop_for.words, word_cpy(p));
+            return 1;
+        case A_WHILE:
+            append_cmd(p, make_cmd(CMD_WHILE));
+            return 1;
+        case A_UNTIL:
+            append_cmd(p, make_cmd(CMD_UNTIL));
+            return 1;
+        case A_FUNC: {
+            // Only the name was read, the words have no redirections.
+            SimpleCmd* simple = last->data.pipe->redir->simple;
+            char* name = simple->words[0];
+            simple->n = 0;
+            delete_pipe_cmd(last->data.pipe);
+            last->kind = CMD_FUNC;
+            last->data.func.name = name;
+            last->data.func.body = NULL;
+            return 1;
         }
+        case A_SUB:
+            push_frame(p);
+            return 1;
+        case A_END: {
+            Cmd* list = p->frames[--p->depth].head;
+            Cmd* owner = p->frames[p->depth - 1].last;
+            if (owner->kind == CMD_PIPE) {
+                perror("internal error: a list in a pipe.");
+                exit(-1);
+            }
+            switch (owner->kind) {
+                case CMD_FOR:
+                    owner->data.loop_for.body = list;
+                    break;
+                case CMD_WHILE:
+                case CMD_UNTIL:
+                    if (owner->data.loop_while.cond == NULL) {
+                        owner->data.loop_while.cond = list;
+                    } else {
+                        owner->data.loop_while.body = list;
+                    }
+                    break;
+                case CMD_FUNC:
+                    owner->data.func.body = list;
+                    break;
+                case CMD_PIPE:
+                    break;
+            }
+            return 1;
+        }
+        case A_BACKGROUND:
+            last->background = 1;
+            return 1;
+        default:
+            perror("internal error: unknown action.");
+            exit(-1);
     }
 }
 
+// What has to come instead of the next token, for the terminals which
+// are matched after the first symbol of a rule.
+static const char* const expected[N_TERMINAL] = {
+    [T_WORD] = "expected a word",
+    [T_DO] = "expected 'do'",
+    [T_DONE] = "expected 'done'",
+    [T_LBRACE] = "expected '{'",
+    [T_RBRACE] = "expected '}'",
+    [T_PARENTR] = "expected ')'",
+    [T_END] = "unexpected token"
+};
+
+/// Grammar: see parser.h.
+/// A NEWLINE separates commands like a SEMI, blank lines are skipped.
+Cmd* parse_tokens(const Tokens* tokens, ParseError* error) {
+    if (tokens->error != NULL) {
+        *error = (ParseError){ tokens->error, tokens->at };
+        return NULL;
+    }
 
-Cmd* parse(const Token* tokens) {
-    // For now support simple command only.
-    Cmd* cmd = parse_pipe_cmd(&tokens);
+    Parser p;
+    p.tokens = tokens;
+    p.word = 0;
+    p.pos = 0;
+    p.frames = p.small;
+    p.depth = 0;
+    p.cap = sizeof(p.small) / sizeof(p.small[0]);
+    p.pipe = NULL;
+    p.error = error;
+    push_frame(&p);
+
+    // Like the frames, the symbols are kept on the C stack first.
+    unsigned char small[128];
+    size_t cap = sizeof(small);
+    size_t top = 0;
+    unsigned char* stack = small;
+    stack[top++] = T_END;
+    stack[top++] = NT_LIST;
+
+    Terminal next = classify(tokens, p.pos);
+    int failed = 0;
+    while (top > 0 && !failed) {
+        unsigned char symbol = stack[--top];
+        if (symbol < N_TERMINAL) {
+            // T_WORD takes a keyword too.
+            if (symbol != next && !(symbol == T_WORD && next <= T_RBRACE)) {
+                *error = (ParseError){ expected[symbol], tokens->starts[p.pos] };
+                failed = 1;
+            } else if (next != T_END) {
+                p.word = p.pos++;
+                next = classify(tokens, p.pos);
+            }
+        } else if (symbol < A_PIPE) {
+            unsigned char rule = predict[symbol - NT_LIST][next];
+            if (rule == R_NONE) rule = fallback[symbol - NT_LIST];
+            if (rule == R_NONE) {
+                const char* message = next == T_END ? "unexpected end of input" : "unexpected token";
+                *error = (ParseError){ message, tokens->starts[p.pos] };
+                failed = 1;
+                break;
+            }
+            const unsigned char* symbols = rules[rule] + 1;
+            size_t n = rules[rule][0];
+            if (n > 0 && symbols[0] < N_TERMINAL) {
+                // The rule was predicted by its first terminal, which is
+                // the next token: no need to push it and match it.
+                p.word = p.pos++;
+                next = classify(tokens, p.pos);
+                symbols++;
+                n--;
+            }
+            if (top + n > cap) {
+                while (top + n > cap) cap *= 2;
+                stack = stack == small ? memcpy(malloc(cap), small, top) : realloc(stack, cap);
+            }
+            // The first symbol of the rule goes on top.
+            while (n > 0) stack[top++] = symbols[--n];
+        } else if (!act(&p, symbol)) {
+            failed = 1;
+        }
+    }
+    if (stack != small) free(stack);
 
-    if (cmd == NULL) {
-        perror("Failed parsing: unknown expansion.");
-        return NULL;
+    Cmd* cmd = p.frames[0].head;
+    if (failed) {
+        while (p.depth > 0) delete_cmd(p.frames[--p.depth].head);
+        cmd = NULL;
     }
+    if (p.frames != p.small) free(p.frames);
+    return cmd;
+}
 
-    // Make sure that there are no remain tokens.
-    if (tokens != NULL) {
-        perror("Failed parsing: there are remain tokens.");
-        delete_cmd(cmd);
-        return NULL;
+Cmd* parse(const Tokens* tokens) {
+    ParseError error;
+    Cmd* cmd = parse_tokens(tokens, &error);
+    if (cmd == NULL) {
+        fprintf(stderr, "Failed parsing: %s.\n", error.message);
     }
+    return cmd;
+}
 
+Cmd* parse_source(const char* source, ParseError* error) {
+    Tokens* tokens = lex(source);
+    Cmd* cmd = parse_tokens(tokens, error);
+    delete_tokens(tokens);
     return cmd;
 }
 
+// Follow the loops, function bodies and pipes through the tokens. Only the
+// words at the start of a command are keywords: not one which goes on
+// with a word left open on the previous line, which set 'start' to 0.
+static void nest_tokens(Incomplete* in, const Tokens* tokens) {
+    for (size_t i = 0; i < tokens->n; ++i) {
+        T_Kind kind = tokens->kinds[i];
+        if (kind != NEWLINE) in->last = kind;
+        if (kind != WORD) {
+            in->start = kind != LT && kind != RT && kind != PARENTL;
+            continue;
+        }
+        if (!in->start) continue;
+        switch (classify(tokens, i)) {
+            case T_WHILE:
+            case T_UNTIL:
+            case T_LBRACE:
+                in->depth++;
+                break;
+            case T_FOR:
+                in->depth++;
+                in->start = 0;
+                break;
+            case T_DONE:
+            case T_RBRACE:
+                in->depth--;
+                in->start = 0;
+                break;
+            case T_DO:
+                break;
+            default:
+                in->start = 0;
+                break;
+        }
+    }
+}
+
+// A here-document, its body comes after the line.
+static void add_delimiter(Incomplete* in, const char* word, size_t n) {
+    int strip;
+    char* delim = here_delimiter(word, n, &strip);
+    if (delim == NULL) return;
+    in->delims = realloc(in->delims, (in->n_delims + 1) * sizeof(char*));
+    in->strip = realloc(in->strip, (in->n_delims + 1) * sizeof(int));
+    in->delims[in->n_delims] = delim;
+    in->strip[in->n_delims++] = strip;
+}
+
+static void add_delimiters(Incomplete* in, const Tokens* tokens) {
+    for (size_t i = 1; i < tokens->n; ++i) {
+        if (tokens->kinds[i] != WORD || tokens->kinds[i - 1] != LT) continue;
+        const char* word = token_word(tokens, i);
+        add_delimiter(in, word, strcspn(word, "\n"));
+    }
+}
+
+void incomplete_init(Incomplete* in) {
+    *in = (Incomplete){ .start = 1, .last = NEWLINE };
+}
+
+void incomplete_free(Incomplete* in) {
+    for (size_t i = 0; i < in->n_delims; ++i) {
+        free(in->delims[i]);
+    }
+    free(in->delims);
+    free(in->strip);
+    free(in->open.stack);
+    free(in->here);
+    incomplete_init(in);
+}
+
+// Whether the line is the delimiter of the here-document 'k'.
+static int is_delimiter(const Incomplete* in, size_t k, const char* line, size_t n) {
+    if (n > 0 && line[n - 1] == '\n') n--;
+    size_t at = 0;
+    while (in->strip[k] && at < n && line[at] == '\t') at++;
+    return n - at == strlen(in->delims[k]) && !memcmp(line + at, in->delims[k], n - at);
+}
+
+// Whether the backslash-newline ending the line is within a word.
+static int is_glued(const char* line, size_t n) {
+    LexOpen open = { NULL, 0, 0 };
+    size_t i = 0, word = n;
+    while (i < n) {
+        if (!is_not_metachar(line[i])) {
+            i++;
+            continue;
+        }
+        word = i;
+        i = lex_resume(line, i, n, &open);
+    }
+    free(open.stack);
+    // The backslash-newline ends a word begun before it.
+    return word + 2 < n;
+}
+
+int incomplete_line(Incomplete* in, const char* line, size_t n) {
+    // In the bodies of the here-documents only the delimiters matter.
+    if (in->next_delim < in->n_delims) {
+        if (is_delimiter(in, in->next_delim, line, n)) in->next_delim++;
+    } else {
+        in->escaped = 0;
+        size_t i = 0;
+        // A word which goes on is scanned to its end first, a '#' in it
+        // does not start a comment.
+        int word = in->open.depth > 0 || (in->glued && is_not_metachar(line[0]));
+        in->glued = 0;
+        while (1) {
+            if (word) {
+                // The rest of the word from the line before, a here
+                // word is kept for its delimiter.
+                size_t from = i;
+                i = lex_resume(line, i, n, &in->open);
+                if (in->here != NULL) {
+                    in->here = realloc(in->here, in->here_len + i - from + 1);
+                    memcpy(in->here + in->here_len, line + from, i - from);
+                    in->here_len += i - from;
+                    if (in->open.depth == 0) {
+                        add_delimiter(in, in->here, in->here_len);
+                        free(in->here);
+                        in->here = NULL;
+                    }
+                }
+                if (i == n) {
+                    // Closed just before a backslash-newline, the word
+                    // goes on.
+                    in->escaped = in->open.depth == 0 && n > 0 && line[n - 1] == '\n';
+                    in->glued = in->escaped;
+                    break;
+                }
+            }
+            char* rest = strndup(line + i, n - i);
+            int open;
+            Tokens* tokens = lex_partial(rest, &open);
+            size_t n_delims = in->n_delims;
+            nest_tokens(in, tokens);
+            add_delimiters(in, tokens);
+            size_t at = tokens->at;
+            delete_tokens(tokens);
+            // Continued without a new here-document: a backslash-newline,
+            // in a word if it comes right after one.
+            in->escaped = open == LEX_CONTINUED && in->n_delims == n_delims;
+            in->glued = in->escaped && is_glued(rest, n - i);
+            if (open != LEX_UNTERMINATED) {
+                free(rest);
+                break;
+            }
+            // The word left open is scanned on from its start, a here
+            // word from its delimiter.
+            in->last = WORD;
+            in->start = 0;
+            if (rest[at] == '<' && rest[at + 1] == '<') {
+                size_t head = at + 2;
+                while (strchr("<- \t", rest[head]) != NULL && rest[head] != '\0') head++;
+                if (rest[at + 2] != '<') in->here = strndup(rest + at, head - at);
+                in->here_len = head - at;
+                at = head;
+            }
+            free(rest);
+            i += at;
+            word = 1;
+        }
+    }
+    int more = in->open.depth > 0 || in->next_delim < in->n_delims || in->escaped ||
+        in->depth > 0 || in->last == PIPE;
+    if (!more) incomplete_free(in);
+    return more;
+}
+
+int parse_incomplete(const char* source) {
+    Incomplete in;
+    incomplete_init(&in);
+    int more = 0;
+    while (*source) {
+        const char* nl = strchr(source, '\n');
+        size_t n = nl != NULL ? (size_t)(nl - source + 1) : strlen(source);
+        more = incomplete_line(&in, source, n);
+        source += n;
+    }
+    incomplete_free(&in);
+    return more;
+}
+
 void delete_cmd(Cmd* cmd) {
-    delete_pipe_cmd(cmd);
+    while (cmd != NULL) {
+        Cmd* next = cmd->next;
+        switch (cmd->kind) {
+            case CMD_PIPE:
+                delete_pipe_cmd(cmd->data.pipe);
+                break;
+            case CMD_FOR:
+                free(cmd->data.loop_for.var);
+                if (cmd->data.loop_for.words != NULL) {
+                    delete_simple_cmd(cmd->data.loop_for.words);
+                }
+                delete_cmd(cmd->data.loop_for.body);
+                break;
+            case CMD_WHILE:
+            case CMD_UNTIL:
+                delete_cmd(cmd->data.loop_while.cond);
+                delete_cmd(cmd->data.loop_while.body);
+                break;
+            case CMD_FUNC:
+                free(cmd->data.func.name);
+                delete_cmd(cmd->data.func.body);
+                break;
+        }
+        free(cmd);
+        cmd = next;
+    }
 }
 
 void print_cmd(const Cmd* cmd) {
-    print_pipe_cmd(cmd);
+    for (const Cmd* iter = cmd; iter != NULL; iter = iter->next) {
+        if (iter != cmd) {
+            printf("; ");
+        }
+        switch (iter->kind) {
+            case CMD_PIPE:
+                print_pipe_cmd(iter->data.pipe);
+                break;
+            case CMD_FOR:
+                printf("For(%s", iter->data.loop_for.var);
+                if (iter->data.loop_for.words != NULL) {
+                    printf(" in ");
+                    print_simple_cmd(iter->data.loop_for.words);
+                }
+                printf("; ");
+                print_cmd(iter->data.loop_for.body);
+                printf(")");
+                break;
+            case CMD_WHILE:
+            case CMD_UNTIL:
+                printf(iter->kind == CMD_WHILE ? "While(" : "Until(");
+                print_cmd(iter->data.loop_while.cond);
+                printf("; Do(");
+                print_cmd(iter->data.loop_while.body);
+                printf("))");
+                break;
+            case CMD_FUNC:
+                printf("Func(%s; ", iter->data.func.name);
+                print_cmd(iter->data.func.body);
+                printf(")");
+                break;
+        }
+        if (iter->background) {
+            printf(" &");
+        }
+    }
+}
+
+
+static SimpleCmd* copy_simple_cmd(const SimpleCmd* cmd) {
+    SimpleCmd* copy = malloc(sizeof(SimpleCmd));
+    copy->n = cmd->n;
+    copy->words = malloc((cmd->n + 1) * sizeof(char*));
+    for (size_t i = 0; i < cmd->n; ++i) {
+        copy->words[i] = strdup(cmd->words[i]);
+    }
+    copy->words[cmd->n] = NULL;
+    return copy;
+}
+
+static PipeCmd* copy_pipe_cmd(const PipeCmd* cmd) {
+    PipeCmd* head = NULL;
+    PipeCmd** link = &head;
+    for (const PipeCmd* iter = cmd; iter != NULL; iter = iter->next) {
+        RedirCmd* redir = malloc(sizeof(RedirCmd));
+        redir->simple = copy_simple_cmd(iter->redir->simple);
+        redir->lhs = iter->redir->lhs ? strdup(iter->redir->lhs) : NULL;
+        redir->rhs = iter->redir->rhs ? strdup(iter->redir->rhs) : NULL;
+        PipeCmd* pipe = malloc(sizeof(PipeCmd));
+        pipe->redir = redir;
+        pipe->next = NULL;
+        *link = pipe;
+        link = &pipe->next;
+    }
+    return head;
 }
+
+Cmd* copy_cmd(const Cmd* cmd) {
+    Cmd* head = NULL;
+    Cmd** link = &head;
+    for (const Cmd* iter = cmd; iter != NULL; iter = iter->next) {
+        Cmd* copy = make_cmd(iter->kind);
+        copy->background = iter->background;
+        switch (iter->kind) {
+            case CMD_PIPE:
+                copy->data.pipe = copy_pipe_cmd(iter->data.pipe);
+                break;
+            case CMD_FOR:
+                copy->data.loop_for.var = strdup(iter->data.loop_for.var);
+                if (iter->data.loop_for.words != NULL) {
+                    copy->data.loop_for.words = copy_simple_cmd(iter->data.loop_for.words);
+                }
+                copy->data.loop_for.body = copy_cmd(iter->data.loop_for.body);
+                break;
+            case CMD_WHILE:
+            case CMD_UNTIL:
+                copy->data.loop_while.cond = copy_cmd(iter->data.loop_while.cond);
+                copy->data.loop_while.body = copy_cmd(iter->data.loop_while.body);
+                break;
+            case CMD_FUNC:
+                copy->data.func.name = strdup(iter->data.func.name);
+                copy->data.func.body = copy_cmd(iter->data.func.body);
+                break;
+        }
+        *link = copy;
+        link = &copy->next;
+    }
+    return head;
+}
\ No newline at end of file
@@ -8,19 +8,70 @@
 ///     ;
 /// 	ls 
 ///		cd
+///
+/// word
+///     : WORD
+///     | '<(' cmd-list ')'     lexed as one WORD, the list runs concurrently
+///     | '>(' cmd-list ')'     and the word becomes /dev/fd/N of a pipe to it
+///     ;
+///
+/// The input of a redir-cmd can also be a here-string '<<<' WORD, or a
+/// here-document '<<' DELIM with its body on the next lines. They are
+/// lexed as LT and one WORD, '<<<word' or '<<DELIM\nbody'.
 /// redir-cmd
-///     : simple-cmd RT WORD LT WORD
-///     | simple-cmd LT WORD RT WORD
-///     | simple-cmd LT WORD
-///     | simple-cmd RT WORD
-///     | simple-cmd
+///     : item
+///     | item redir-cmd
+///     ;
+///
+/// item
+///     : word
+///     | LT WORD
+///     | RT WORD
 ///     ;
+/// The redirections can come anywhere among the words, the last one of a
+/// kind wins, and there has to be one word at least.
 ///
 /// pipe-cmd
 ///     : redir-cmd
 ///     | redir-cmd PIPE pipe-cmd
 ///     ;
 ///
+/// The keywords 'for', 'while', 'until', 'do', 'done', '{' and '}' are
+/// only keywords where a command starts, elsewhere they are words.
+///
+/// cmd
+///     : for-cmd
+///     | while-cmd
+///     | until-cmd
+///     | func-def
+///     | pipe-cmd
+///     ;
+///
+/// for-cmd
+///     : 'for' WORD SEMI 'do' cmd-list 'done'
+///     | 'for' WORD 'in' word-list SEMI 'do' cmd-list 'done'
+///     ;
+///
+/// while-cmd
+///     : 'while' cmd-list 'do' cmd-list 'done'
+///     ;
+///
+/// until-cmd
+///     : 'until' cmd-list 'do' cmd-list 'done'
+///     ;
+///
+/// func-def
+///     : WORD PARENTL PARENTR '{' cmd-list '}'
+///     ;
+///
+/// cmd-list
+///     : cmd
+///     | cmd SEMI
+///     | cmd BACKGROUND
+///     | cmd SEMI cmd-list
+///     | cmd BACKGROUND cmd-list
+///     ;
+///
 ///
 ///
 ///
@@ -49,9 +100,90 @@ typedef struct PipeCmd {
 } PipeCmd;
 
 void print_pipe_cmd(const PipeCmd* cmd);
+void delete_pipe_cmd(PipeCmd* cmd);
+
+typedef enum {
+    CMD_PIPE,
+    CMD_FOR,
+    CMD_WHILE,
+    CMD_UNTIL,
+    CMD_FUNC
+} C_Kind;
+
+/// A command of a cmd-list, the commands of the list are linked by 'next'.
+typedef struct Cmd {
+    C_Kind kind;
+    union {
+        PipeCmd* pipe;
+        struct {
+            char* var;
+            SimpleCmd* words;       // NULL without 'in'.
+            struct Cmd* body;
+        } loop_for;
+        struct {
+            struct Cmd* cond;
+            struct Cmd* body;
+        } loop_while;               // Also for until.
+        struct {
+            char* name;
+            struct Cmd* body;
+        } func;
+    } data;
+    int background;                 // Followed by '&', not waited for.
+    struct Cmd* next;
+} Cmd;
+
+/// Parse the tokens, a source which does not parse is reported on stderr.
+Cmd* parse(const Tokens* tokens);
+
+/// Why a source does not parse.
+typedef struct {
+    const char* message;
+    size_t at;              // The offset in the source.
+} ParseError;
+
+/// Parse without printing anything, '*error' tells why it fails. Safe to
+/// call on several threads at once.
+Cmd* parse_tokens(const Tokens* tokens, ParseError* error);
+/// The same for a source, which is lexed first.
+Cmd* parse_source(const char* source, ParseError* error);
 
-typedef PipeCmd Cmd;
+/// Whether the source stops in the middle of a command: in a quote, a
+/// loop, a function body or a here-document, after a '|' or a
+/// backslash-newline. The next lines belong to it then.
+int parse_incomplete(const char* source);
+
+/// The same for a command which comes line by line, each line is only
+/// scanned once: what is still open at its end is kept for the next.
+typedef struct {
+    int depth;              // Loops and function bodies.
+    int start;              // The next word may be a keyword.
+    T_Kind last;            // The last token which is not a newline.
+    int escaped;            // The line ends with a backslash-newline,
+    int glued;              // in a word which goes on.
+    LexOpen open;           // Quotes and substitutions.
+    char* here;             // A here word left open, up to the line end.
+    size_t here_len;
+    char** delims;          // Of the here-documents, the bodies come next.
+    int* strip;
+    size_t n_delims;
+    size_t next_delim;      // The body being read.
+} Incomplete;
 
-Cmd* parse(const Token* tokens);
+void incomplete_init(Incomplete* in);
+void incomplete_free(Incomplete* in);
+
+/// Feed the next 'n' bytes line, which ends with its newline unless it is
+/// the last one. Returns whether the command goes on after it, if not the
+/// state is ready for the next command.
+int incomplete_line(Incomplete* in, const char* line, size_t n);
+
+/// Whether the word is a process substitution, '<(cmd)' or '>(cmd)'.
+int is_process_subst(const char* word);
+/// Whether the word is a here-string or a here-document.
+int is_here_word(const char* word);
 void print_cmd(const Cmd* cmd);
-void delete_cmd(Cmd* cmd);
\ No newline at end of file
+void delete_cmd(Cmd* cmd);
+
+/// A deep copy of the list, for trees which outlive the parse cache.
+Cmd* copy_cmd(const Cmd* cmd);
\ No newline at end of file
@@ -0,0 +1,131 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include "ring.h"
+
+// Rounds of polling before going to sleep, the other side is usually
+// about to move. Not on a single core, where it cannot while we poll.
+#define SPINS 200
+
+static void relax(void) {
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    __builtin_ia32_pause();
+#endif
+}
+
+static void futex_wait(_Atomic uint32_t* word, uint32_t value) {
+    syscall(SYS_futex, (uint32_t*)word, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
+
+// The sleeper sets 'waits' before checking a last time, and the other
+// side reads it after publishing (both sequentially consistent), so one
+// of them sees the other: either the sleeper sees the change, or it is
+// told. The bump makes a futex_wait which comes late return at once.
+static void wake(_Atomic uint32_t* waits, _Atomic uint32_t* event) {
+    if (atomic_load(waits)) {
+        atomic_fetch_add(event, 1);
+        syscall(SYS_futex, (uint32_t*)event, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+}
+
+// Read once, the rings are made by the main thread.
+static long cores = 0;
+
+Ring* ring_new(uint32_t size) {
+    if (cores == 0) cores = sysconf(_SC_NPROCESSORS_ONLN);
+    Ring* ring = aligned_alloc(64, sizeof(Ring));
+    memset(ring, 0, sizeof(Ring));
+    ring->bytes = malloc(size);
+    ring->size = size;
+    ring->spins = cores > 1 ? SPINS : 0;
+    return ring;
+}
+
+void ring_free(Ring* ring) {
+    free(ring->bytes);
+    free(ring);
+}
+
+ssize_t ring_write(Ring* ring, const char* data, size_t n) {
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t done = 0;
+    int spins = 0;
+    while (done < n) {
+        if (atomic_load_explicit(&ring->reader_gone, memory_order_acquire)) {
+            errno = EPIPE;
+            return -1;
+        }
+        uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        uint32_t room = ring->size - (tail - head);
+        if (room == 0) {
+            if (spins++ < ring->spins) {
+                relax();
+                continue;
+            }
+            uint32_t event = atomic_load(&ring->space);
+            atomic_store(&ring->writer_waits, 1);
+            if (atomic_load(&ring->head) == head && !atomic_load(&ring->reader_gone)) {
+                futex_wait(&ring->space, event);
+            }
+            atomic_store(&ring->writer_waits, 0);
+            continue;
+        }
+        spins = 0;
+        uint32_t chunk = n - done < room ? (uint32_t)(n - done) : room;
+        uint32_t at = tail & (ring->size - 1);
+        uint32_t first = chunk < ring->size - at ? chunk : ring->size - at;
+        memcpy(ring->bytes + at, data + done, first);
+        memcpy(ring->bytes, data + done + first, chunk - first);
+        tail += chunk;
+        done += chunk;
+        atomic_store(&ring->tail, tail);
+        wake(&ring->reader_waits, &ring->data);
+    }
+    return (ssize_t)n;
+}
+
+size_t ring_read(Ring* ring, char* data, size_t n) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t tail;
+    int spins = 0;
+    while ((tail = atomic_load_explicit(&ring->tail, memory_order_acquire)) == head) {
+        if (atomic_load_explicit(&ring->writer_gone, memory_order_acquire)) {
+            // It may have written just before leaving.
+            tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+            if (tail != head) break;
+            return 0;
+        }
+        if (spins++ < ring->spins) {
+            relax();
+            continue;
+        }
+        uint32_t event = atomic_load(&ring->data);
+        atomic_store(&ring->reader_waits, 1);
+        if (atomic_load(&ring->tail) == head && !atomic_load(&ring->writer_gone)) {
+            futex_wait(&ring->data, event);
+        }
+        atomic_store(&ring->reader_waits, 0);
+    }
+    uint32_t chunk = tail - head < n ? tail - head : (uint32_t)n;
+    uint32_t at = head & (ring->size - 1);
+    uint32_t first = chunk < ring->size - at ? chunk : ring->size - at;
+    memcpy(data, ring->bytes + at, first);
+    memcpy(data + first, ring->bytes, chunk - first);
+    atomic_store(&ring->head, head + chunk);
+    wake(&ring->writer_waits, &ring->space);
+    return chunk;
+}
+
+void ring_close_write(Ring* ring) {
+    atomic_store(&ring->writer_gone, 1);
+    wake(&ring->reader_waits, &ring->data);
+}
+
+void ring_close_read(Ring* ring) {
+    atomic_store(&ring->reader_gone, 1);
+    wake(&ring->writer_waits, &ring->space);
+}
\ No newline at end of file
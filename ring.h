@@ -0,0 +1,37 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/// Single-producer single-consumer ring of bytes, between two threads of
+/// a pipeline. The writer only moves 'tail' and the reader only 'head',
+/// so passing data takes no lock: each side copies, then publishes its
+/// counter. A side which finds the ring full or empty spins a little,
+/// then sleeps on a futex the other side only wakes when told it sleeps.
+typedef struct {
+    _Alignas(64) _Atomic uint32_t head;    // Bytes read so far.
+    _Atomic uint32_t reader_waits;
+    _Atomic uint32_t reader_gone;
+    _Atomic uint32_t space;                 // Bumped to wake the writer.
+    _Alignas(64) _Atomic uint32_t tail;    // Bytes written so far.
+    _Atomic uint32_t writer_waits;
+    _Atomic uint32_t writer_gone;
+    _Atomic uint32_t data;                  // Bumped to wake the reader.
+    _Alignas(64) char* bytes;
+    uint32_t size;                          // A power of two.
+    int spins;                              // Polls before sleeping.
+} Ring;
+
+Ring* ring_new(uint32_t size);
+void ring_free(Ring* ring);
+
+/// Write all of 'n' bytes, waiting for room. Returns -1 with errno EPIPE
+/// once the reader is gone, like a pipe.
+ssize_t ring_write(Ring* ring, const char* data, size_t n);
+
+/// Read up to 'n' bytes, waiting for some. Returns 0 once the writer is
+/// gone and everything was read.
+size_t ring_read(Ring* ring, char* data, size_t n);
+
+/// Each side says when it is done, the other one stops waiting.
+void ring_close_write(Ring* ring);
+void ring_close_read(Ring* ring);
\ No newline at end of file
@@ -0,0 +1,129 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "ush.h"
+#include "vars.h"
+#include "sched.h"
+
+// Parse a list like "0-3,6" into 'set'.
+static int parse_cpus(const char* list, cpu_set_t* set) {
+    CPU_ZERO(set);
+    const char* p = list;
+    while (*p) {
+        char* end;
+        long lo = strtol(p, &end, 10);
+        if (end == p || lo < 0) return -1;
+        long hi = lo;
+        p = end;
+        if (*p == '-') {
+            hi = strtol(p + 1, &end, 10);
+            if (end == p + 1 || hi < lo) return -1;
+            p = end;
+        }
+        if (hi >= CPU_SETSIZE) return -1;
+        for (long cpu = lo; cpu <= hi; ++cpu) {
+            CPU_SET(cpu, set);
+        }
+        if (*p == ',') p++;
+        else if (*p) return -1;
+    }
+    return CPU_COUNT(set) > 0 ? 0 : -1;
+}
+
+int simple_sched(size_t n, char** words){
+    size_t i = 1;
+    const char* cpus = NULL;
+    const char* niceness = NULL;
+    int batch = 0;
+    for (; i < n && words[i][0] == '-'; ++i) {
+        if (!strcmp(words[i], "-b")) {
+            batch = 1;
+        } else if (!strcmp(words[i], "-c") && i + 1 < n) {
+            cpus = words[++i];
+        } else if (!strcmp(words[i], "-n") && i + 1 < n) {
+            niceness = words[++i];
+        } else {
+            break;
+        }
+    }
+    if (i == n) {
+        fprintf(stderr, "usage: sched [-c cpus] [-n nice] [-b] cmd [arg...]\n");
+        return 2;
+    }
+
+    if (cpus != NULL) {
+        cpu_set_t set;
+        if (parse_cpus(cpus, &set) < 0) {
+            fprintf(stderr, "sched: bad cpu list %s\n", cpus);
+            return 2;
+        }
+        if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+            fprintf(stderr, "sched: %s, %s\n", cpus, strerror(errno));
+            return 1;
+        }
+    }
+    if (niceness != NULL) {
+        char* end;
+        long inc = strtol(niceness, &end, 10);
+        if (*end != '\0') {
+            fprintf(stderr, "sched: bad nice value %s\n", niceness);
+            return 2;
+        }
+        // Relative, like nice -n.
+        errno = 0;
+        int prio = getpriority(PRIO_PROCESS, 0);
+        if (errno == 0 && setpriority(PRIO_PROCESS, 0, prio + (int)inc) < 0) {
+            fprintf(stderr, "sched: nice %s, %s\n", niceness, strerror(errno));
+            return 1;
+        }
+    }
+    if (batch) {
+        struct sched_param param = { .sched_priority = 0 };
+        if (sched_setscheduler(0, SCHED_BATCH, &param) < 0) {
+            fprintf(stderr, "sched: SCHED_BATCH, %s\n", strerror(errno));
+            return 1;
+        }
+    }
+    return exec_simple_cmd(n - i, words + i);
+}
+
+// The cores the shell may run on, read once.
+static cpu_set_t allowed;
+static int n_allowed = -1;
+static size_t next_core = 0;
+
+int sched_spread(size_t n) {
+    const char* spread = var_get("USH_SPREAD");
+    if (spread == NULL || spread[0] == '\0' || !strcmp(spread, "0")) return -1;
+    if (n_allowed < 0) {
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0) {
+            n_allowed = 0;
+        } else {
+            n_allowed = CPU_COUNT(&allowed);
+        }
+    }
+    if (n_allowed == 0) return -1;
+    int start = (int)(next_core % n_allowed);
+    next_core += n;
+    return start;
+}
+
+void sched_pin(size_t i) {
+    if (n_allowed <= 0) return;
+    size_t k = i % n_allowed;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (!CPU_ISSET(cpu, &allowed)) continue;
+        if (k-- == 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            sched_setaffinity(0, sizeof(set), &set);
+            return;
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,17 @@
+#include <stddef.h>
+
+/// sched [-c cpus] [-n nice] [-b] cmd [arg...]
+/// Runs the command pinned to 'cpus' (e.g. "0-3,6"), with its niceness
+/// raised by 'nice' and under SCHED_BATCH with -b. It always runs in a
+/// child, like an executable, so the shell itself is not affected.
+int simple_sched(size_t n, char** words);
+
+/// Automatic mode: while USH_SPREAD is set (and not "0"), the stages of a
+/// pipeline are pinned to distinct cores of the shell's affinity set.
+/// Returns the core to start the pipeline of 'n' stages at, or -1 if the
+/// mode is off. Successive pipelines start at different cores.
+int sched_spread(size_t n);
+
+/// Pin the calling process to the i-th core of the shell's affinity set,
+/// modulo the number of cores.
+void sched_pin(size_t i);
\ No newline at end of file
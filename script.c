@@ -0,0 +1,595 @@
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "parser.h"
+#include "ush.h"
+#include "script.h"
+
+/// Compiled script format (.ushc).
+///
+/// All the references inside the file are offsets, so it can be mapped
+/// anywhere and decoded in place:
+///
+///     header
+///     records     one per command line
+///     strings     NUL terminated, shared between equal words
+///
+/// record
+///     : 'C' list                          a parsed line
+///     | 'F' u32:text                      a line which failed to parse
+///     ;
+/// list
+///     : u32:n-cmds cmd...
+///     ;
+/// cmd
+///     : 'P' u32:n-stages stage...         a pipe-cmd
+///     | 'R' u32:var u32:n-words u32:word... list
+///                                         a for loop, n-words is NONE without 'in'
+///     | 'W' list list                     a while loop, its condition and body
+///     | 'U' list list                     an until loop
+///     | 'N' u32:name list                 a function definition
+///     | 'B' cmd                           the cmd followed by '&'
+///     ;
+/// stage
+///     : u32:n-words u32:word... u32:lhs u32:rhs
+///     ;
+///
+/// Strings are u32 offsets into the string table, NONE for a missing redirection.
+/// Integers are stored in host byte order, the cache is not meant to be shared.
+
+#define USHC_MAGIC "USHC"
+#define USHC_VERSION 7
+#define NONE 0xFFFFFFFFu
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t src_size;
+    int64_t src_sec;
+    int64_t src_nsec;
+    uint64_t src_hash;
+    uint32_t n_records;
+    uint32_t records_off;
+    uint32_t strings_off;
+    uint32_t strings_size;
+} Header;
+
+// Growable byte buffer used by the compiler.
+typedef struct {
+    char* data;
+    size_t len;
+    size_t cap;
+} Buffer;
+
+static void put(Buffer* b, const void* data, size_t n) {
+    while (b->len + n > b->cap) {
+        b->cap = b->cap ? b->cap * 2 : 4096;
+        b->data = realloc(b->data, b->cap);
+    }
+    memcpy(b->data + b->len, data, n);
+    b->len += n;
+}
+
+static void put_u32(Buffer* b, uint32_t v) {
+    put(b, &v, sizeof(v));
+}
+
+// FNV-1a.
+static uint64_t hash_bytes(const char* s, size_t n) {
+    uint64_t h = 14695981039346656037UL;
+    for (size_t i = 0; i < n; ++i) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211UL;
+    }
+    return h;
+}
+
+/// String table with deduplication, an open addressing set of offsets.
+typedef struct {
+    Buffer text;
+    uint32_t* slots;
+    size_t n_slots;
+    size_t n;
+} Strings;
+
+static uint32_t intern(Strings* s, const char* str) {
+    if (str == NULL) return NONE;
+    size_t len = strlen(str);
+    if ((s->n + 1) * 2 > s->n_slots) {
+        // Grow and reinsert every string.
+        size_t n_slots = s->n_slots ? s->n_slots * 2 : 1024;
+        uint32_t* slots = malloc(n_slots * sizeof(uint32_t));
+        memset(slots, 0xFF, n_slots * sizeof(uint32_t));
+        for (size_t i = 0; i < s->n_slots; ++i) {
+            if (s->slots[i] == NONE) continue;
+            const char* old = s->text.data + s->slots[i];
+            size_t j = hash_bytes(old, strlen(old)) & (n_slots - 1);
+            while (slots[j] != NONE) j = (j + 1) & (n_slots - 1);
+            slots[j] = s->slots[i];
+        }
+        free(s->slots);
+        s->slots = slots;
+        s->n_slots = n_slots;
+    }
+    size_t j = hash_bytes(str, len) & (s->n_slots - 1);
+    while (s->slots[j] != NONE) {
+        if (!strcmp(s->text.data + s->slots[j], str)) return s->slots[j];
+        j = (j + 1) & (s->n_slots - 1);
+    }
+    uint32_t off = (uint32_t)s->text.len;
+    put(&s->text, str, len + 1);
+    s->slots[j] = off;
+    s->n++;
+    return off;
+}
+
+static void encode_pipe_cmd(Buffer* b, Strings* s, const PipeCmd* cmd) {
+    uint32_t n = 0;
+    for (const PipeCmd* iter = cmd; iter != NULL; iter = iter->next) n++;
+    put(b, "P", 1);
+    put_u32(b, n);
+    for (const PipeCmd* iter = cmd; iter != NULL; iter = iter->next) {
+        const RedirCmd* redir = iter->redir;
+        put_u32(b, (uint32_t)redir->simple->n);
+        for (size_t i = 0; i < redir->simple->n; ++i) {
+            put_u32(b, intern(s, redir->simple->words[i]));
+        }
+        put_u32(b, intern(s, redir->lhs));
+        put_u32(b, intern(s, redir->rhs));
+    }
+}
+
+static void encode_cmd_list(Buffer* b, Strings* s, const Cmd* cmd) {
+    uint32_t n = 0;
+    for (const Cmd* iter = cmd; iter != NULL; iter = iter->next) n++;
+    put_u32(b, n);
+    for (const Cmd* iter = cmd; iter != NULL; iter = iter->next) {
+        if (iter->background) {
+            put(b, "B", 1);
+        }
+        switch (iter->kind) {
+            case CMD_PIPE:
+                encode_pipe_cmd(b, s, iter->data.pipe);
+                break;
+            case CMD_FOR: {
+                const SimpleCmd* words = iter->data.loop_for.words;
+                put(b, "R", 1);
+                put_u32(b, intern(s, iter->data.loop_for.var));
+                put_u32(b, words == NULL ? NONE : (uint32_t)words->n);
+                for (size_t i = 0; words != NULL && i < words->n; ++i) {
+                    put_u32(b, intern(s, words->words[i]));
+                }
+                encode_cmd_list(b, s, iter->data.loop_for.body);
+                break;
+            }
+            case CMD_WHILE:
+            case CMD_UNTIL:
+                put(b, iter->kind == CMD_WHILE ? "W" : "U", 1);
+                encode_cmd_list(b, s, iter->data.loop_while.cond);
+                encode_cmd_list(b, s, iter->data.loop_while.body);
+                break;
+            case CMD_FUNC:
+                put(b, "N", 1);
+                put_u32(b, intern(s, iter->data.func.name));
+                encode_cmd_list(b, s, iter->data.func.body);
+                break;
+        }
+    }
+}
+
+/// Decoding reads the mapped file, 'p' is moved past what was read.
+typedef struct {
+    const char* p;
+    const char* end;
+    const char* strings;
+    uint32_t strings_size;
+} Reader;
+
+static int get_u32(Reader* r, uint32_t* v) {
+    if (r->end - r->p < (long)sizeof(uint32_t)) return -1;
+    memcpy(v, r->p, sizeof(uint32_t));
+    r->p += sizeof(uint32_t);
+    return 0;
+}
+
+static int get_str(Reader* r, char** str) {
+    uint32_t off;
+    if (get_u32(r, &off) < 0) return -1;
+    if (off == NONE) {
+        *str = NULL;
+        return 0;
+    }
+    if (off >= r->strings_size) return -1;
+    *str = strdup(r->strings + off);
+    return 0;
+}
+
+static PipeCmd* decode_pipe_cmd(Reader* r) {
+    uint32_t n;
+    if (get_u32(r, &n) < 0 || n == 0) return NULL;
+    PipeCmd* head = NULL;
+    PipeCmd** link = &head;
+    for (uint32_t i = 0; i < n; ++i) {
+        uint32_t n_words;
+        if (get_u32(r, &n_words) < 0 || n_words == 0 ||
+            n_words > (uint32_t)(r->end - r->p) / sizeof(uint32_t)) {
+            break;
+        }
+        SimpleCmd* simple = malloc(sizeof(SimpleCmd));
+        simple->n = n_words;
+        simple->words = calloc(n_words + 1, sizeof(char*));
+        RedirCmd* redir = malloc(sizeof(RedirCmd));
+        redir->simple = simple;
+        redir->lhs = redir->rhs = NULL;
+        PipeCmd* pipe = malloc(sizeof(PipeCmd));
+        pipe->redir = redir;
+        pipe->next = NULL;
+        *link = pipe;
+        link = &pipe->next;
+
+        int failed = 0;
+        for (uint32_t j = 0; j < n_words && !failed; ++j) {
+            failed = get_str(r, simple->words + j) < 0;
+        }
+        if (failed || get_str(r, &redir->lhs) < 0 || get_str(r, &redir->rhs) < 0) {
+            break;
+        }
+        if (i + 1 == n) return head;
+    }
+    // Corrupted record, delete_pipe_cmd copes with the missing words.
+    delete_pipe_cmd(head);
+    return NULL;
+}
+
+static Cmd* decode_cmd_list(Reader* r);
+
+static Cmd* decode_cmd(Reader* r) {
+    if (r->p >= r->end) return NULL;
+    char kind = *r->p++;
+    if (kind == 'B') {
+        Cmd* cmd = decode_cmd(r);
+        if (cmd != NULL) cmd->background = 1;
+        return cmd;
+    }
+    Cmd* cmd = calloc(1, sizeof(Cmd));
+    switch (kind) {
+        case 'P':
+            cmd->kind = CMD_PIPE;
+            if ((cmd->data.pipe = decode_pipe_cmd(r)) == NULL) break;
+            return cmd;
+        case 'R': {
+            cmd->kind = CMD_FOR;
+            uint32_t n_words;
+            if (get_str(r, &cmd->data.loop_for.var) < 0 || cmd->data.loop_for.var == NULL ||
+                get_u32(r, &n_words) < 0) {
+                break;
+            }
+            if (n_words != NONE) {
+                if (n_words > (uint32_t)(r->end - r->p) / sizeof(uint32_t)) break;
+                SimpleCmd* words = malloc(sizeof(SimpleCmd));
+                words->n = n_words;
+                words->words = calloc(n_words + 1, sizeof(char*));
+                cmd->data.loop_for.words = words;
+                int failed = 0;
+                for (uint32_t i = 0; i < n_words && !failed; ++i) {
+                    failed = get_str(r, words->words + i) < 0;
+                }
+                if (failed) break;
+            }
+            if ((cmd->data.loop_for.body = decode_cmd_list(r)) == NULL) break;
+            return cmd;
+        }
+        case 'W':
+        case 'U':
+            cmd->kind = kind == 'W' ? CMD_WHILE : CMD_UNTIL;
+            if ((cmd->data.loop_while.cond = decode_cmd_list(r)) == NULL ||
+                (cmd->data.loop_while.body = decode_cmd_list(r)) == NULL) {
+                break;
+            }
+            return cmd;
+        case 'N':
+            cmd->kind = CMD_FUNC;
+            if (get_str(r, &cmd->data.func.name) < 0 || cmd->data.func.name == NULL ||
+                (cmd->data.func.body = decode_cmd_list(r)) == NULL) {
+                break;
+            }
+            return cmd;
+        default:
+            free(cmd);
+            return NULL;
+    }
+    delete_cmd(cmd);
+    return NULL;
+}
+
+static Cmd* decode_cmd_list(Reader* r) {
+    uint32_t n;
+    if (get_u32(r, &n) < 0 || n == 0) return NULL;
+    Cmd* head = NULL;
+    Cmd** link = &head;
+    for (uint32_t i = 0; i < n; ++i) {
+        if ((*link = decode_cmd(r)) == NULL) {
+            delete_cmd(head);
+            return NULL;
+        }
+        link = &(*link)->next;
+    }
+    return head;
+}
+
+static void add_line(Script* script, size_t* cap, Cmd* cmd, char* failed) {
+    if (script->n == *cap) {
+        *cap = *cap ? *cap * 2 : 256;
+        script->cmds = realloc(script->cmds, *cap * sizeof(Cmd*));
+        script->failed = realloc(script->failed, *cap * sizeof(char*));
+    }
+    script->cmds[script->n] = cmd;
+    script->failed[script->n] = failed;
+    script->n++;
+}
+
+static char* read_file(const char* path, size_t* size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return NULL;
+    }
+    char* text = malloc(st.st_size + 1);
+    size_t n = 0;
+    while (n < (size_t)st.st_size) {
+        ssize_t got = read(fd, text + n, st.st_size - n);
+        if (got <= 0) break;
+        n += got;
+    }
+    close(fd);
+    text[n] = '\0';
+    *size = n;
+    return text;
+}
+
+// Lex and parse every line, skipping blank lines and comments.
+// A command which goes on in the next lines takes them too.
+static void parse_text(char* text, Script* script) {
+    size_t cap = 0;
+    char* line = text;
+    Incomplete incomplete;
+    incomplete_init(&incomplete);
+    while (*line) {
+        char* end = strchr(line, '\n');
+        for (char* from = line; end != NULL; end = strchr(from, '\n')) {
+            if (!incomplete_line(&incomplete, from, end + 1 - from)) break;
+            from = end + 1;
+        }
+        // Left open at the end of the text.
+        incomplete_free(&incomplete);
+        if (end != NULL) *end = '\0';
+
+        const char* first = line;
+        while (*first == ' ' || *first == '\t') first++;
+        if (*first != '\0' && *first != '#') {
+            Tokens* tokens = lex(line);
+            Cmd* cmd = parse(tokens);
+            delete_tokens(tokens);
+            add_line(script, &cap, cmd, cmd == NULL ? strdup(line) : NULL);
+        }
+
+        if (end == NULL) break;
+        line = end + 1;
+    }
+}
+
+static char* cache_path(const char* path) {
+    size_t len = strlen(path);
+    char* cache = malloc(len + 6);
+    strcpy(cache, path);
+    if (len > 4 && !strcmp(path + len - 4, ".ush")) {
+        strcat(cache, "c");
+    } else {
+        strcat(cache, ".ushc");
+    }
+    return cache;
+}
+
+// Write the compiled form of 'script' next to the source.
+static int write_cache(const char* path, const struct stat* st, uint64_t hash, const Script* script) {
+    Buffer records = {0};
+    Strings strings = {0};
+    for (size_t i = 0; i < script->n; ++i) {
+        if (script->cmds[i] != NULL) {
+            put(&records, "C", 1);
+            encode_cmd_list(&records, &strings, script->cmds[i]);
+        } else {
+            put(&records, "F", 1);
+            put_u32(&records, intern(&strings, script->failed[i]));
+        }
+    }
+
+    Header header;
+    memcpy(header.magic, USHC_MAGIC, 4);
+    header.version = USHC_VERSION;
+    header.src_size = st->st_size;
+    header.src_sec = st->st_mtim.tv_sec;
+    header.src_nsec = st->st_mtim.tv_nsec;
+    header.src_hash = hash;
+    header.n_records = (uint32_t)script->n;
+    header.records_off = sizeof(Header);
+    header.strings_off = (uint32_t)(sizeof(Header) + records.len);
+    header.strings_size = (uint32_t)strings.text.len;
+
+    // Write a temporary file and rename it, so readers never see half of it.
+    char* cache = cache_path(path);
+    char* tmp = malloc(strlen(cache) + 8);
+    sprintf(tmp, "%s.XXXXXX", cache);
+    int fd = mkstemp(tmp);
+    int result = -1;
+    if (fd >= 0) {
+        if (write(fd, &header, sizeof(header)) == sizeof(header) &&
+            write(fd, records.data, records.len) == (ssize_t)records.len &&
+            write(fd, strings.text.data, strings.text.len) == (ssize_t)strings.text.len &&
+            rename(tmp, cache) == 0) {
+            result = 0;
+        } else {
+            unlink(tmp);
+        }
+        close(fd);
+    }
+    free(tmp);
+    free(cache);
+    free(records.data);
+    free(strings.text.data);
+    free(strings.slots);
+    return result;
+}
+
+// Decode the compiled file if it matches the source.
+static int read_cache(const char* path, const struct stat* st, Script* script) {
+    // Read-only, the compiled file may be in a directory we cannot write.
+    char* cache = cache_path(path);
+    int fd = open(cache, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        free(cache);
+        return -1;
+    }
+
+    struct stat cst;
+    if (fstat(fd, &cst) < 0 || cst.st_size < (off_t)sizeof(Header)) {
+        close(fd);
+        free(cache);
+        return -1;
+    }
+    char* map = mmap(NULL, cst.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        free(cache);
+        return -1;
+    }
+
+    int result = -1;
+    Header header;
+    memcpy(&header, map, sizeof(Header));
+    if (memcmp(header.magic, USHC_MAGIC, 4) || header.version != USHC_VERSION ||
+        header.src_size != (uint64_t)st->st_size ||
+        (uint64_t)header.strings_off + header.strings_size > (uint64_t)cst.st_size) {
+        goto out;
+    }
+    if (header.src_sec != st->st_mtim.tv_sec || header.src_nsec != st->st_mtim.tv_nsec) {
+        // Touched but maybe not changed, compare the content.
+        size_t size;
+        char* text = read_file(path, &size);
+        if (text == NULL) goto out;
+        uint64_t hash = hash_bytes(text, size);
+        free(text);
+        if (hash != header.src_hash) goto out;
+        header.src_sec = st->st_mtim.tv_sec;
+        header.src_nsec = st->st_mtim.tv_nsec;
+        int wfd = open(cache, O_WRONLY | O_CLOEXEC);
+        if (wfd >= 0 && pwrite(wfd, &header, sizeof(header), 0) != sizeof(header)) {
+            // Still valid, we will just hash again next time.
+        }
+        if (wfd >= 0) close(wfd);
+    }
+
+    Reader r = {
+        .p = map + header.records_off,
+        .end = map + header.strings_off,
+        .strings = map + header.strings_off,
+        .strings_size = header.strings_size
+    };
+    size_t cap = 0;
+    for (uint32_t i = 0; i < header.n_records; ++i) {
+        if (r.p >= r.end) break;
+        char kind = *r.p++;
+        if (kind == 'C') {
+            Cmd* cmd = decode_cmd_list(&r);
+            if (cmd == NULL) break;
+            add_line(script, &cap, cmd, NULL);
+        } else if (kind == 'F') {
+            char* text;
+            if (get_str(&r, &text) < 0 || text == NULL) break;
+            add_line(script, &cap, NULL, text);
+        } else {
+            break;
+        }
+    }
+    if (script->n == header.n_records) {
+        result = 0;
+    } else {
+        delete_script(script);
+    }
+
+out:
+    munmap(map, cst.st_size);
+    close(fd);
+    free(cache);
+    return result;
+}
+
+int load_script(const char* path, Script* script, int use_cache) {
+    memset(script, 0, sizeof(Script));
+    struct stat st;
+    if (stat(path, &st) < 0) return -1;
+    if (use_cache && read_cache(path, &st, script) == 0) {
+        return 0;
+    }
+
+    size_t size;
+    char* text = read_file(path, &size);
+    if (text == NULL) return -1;
+    uint64_t hash = hash_bytes(text, size);
+    parse_text(text, script);
+    free(text);
+    if (use_cache && write_cache(path, &st, hash, script) < 0) {
+        // Not fatal, e.g. the directory is read only.
+    }
+    return 0;
+}
+
+void delete_script(Script* script) {
+    for (size_t i = 0; i < script->n; ++i) {
+        if (script->cmds[i] != NULL) delete_cmd(script->cmds[i]);
+        free(script->failed[i]);
+    }
+    free(script->cmds);
+    free(script->failed);
+    memset(script, 0, sizeof(Script));
+}
+
+int compile_script(const char* path) {
+    Script script;
+    struct stat st;
+    size_t size;
+    char* text;
+    if (stat(path, &st) < 0 || (text = read_file(path, &size)) == NULL) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    memset(&script, 0, sizeof(Script));
+    uint64_t hash = hash_bytes(text, size);
+    parse_text(text, &script);
+    free(text);
+    int result = write_cache(path, &st, hash, &script);
+    if (result < 0) {
+        fprintf(stderr, "%s: cannot write the compiled script, %s\n", path, strerror(errno));
+    }
+    delete_script(&script);
+    return result;
+}
+
+int run_script(const char* path) {
+    Script script;
+    if (load_script(path, &script, 1) < 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    for (size_t i = 0; i < script.n; ++i) {
+        if (script.cmds[i] == NULL) {
+            printf("Failed: %s\n", script.failed[i]);
+        } else {
+            run_cmd(script.cmds[i]);
+        }
+    }
+    delete_script(&script);
+    return 0;
+}
\ No newline at end of file
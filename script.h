@@ -0,0 +1,23 @@
+#include <stddef.h>
+
+struct Cmd;
+
+/// The parsed commands of a script, in source order.
+/// Lines which failed to parse have a NULL command and keep their text.
+typedef struct {
+    size_t n;
+    struct Cmd** cmds;
+    char** failed;
+} Script;
+
+/// Read the script at 'path'.
+/// With 'use_cache' the compiled file next to the script (path + "c" for
+/// a .ush script, path + ".ushc" otherwise) is loaded when it is up to date,
+/// and rewritten when it is not.
+int load_script(const char* path, Script* script, int use_cache);
+void delete_script(Script* script);
+
+/// Parse the script and write its compiled file.
+int compile_script(const char* path);
+
+int run_script(const char* path);
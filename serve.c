@@ -0,0 +1,305 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "ush.h"
+#include "vars.h"
+#include "serve.h"
+#include "jobs.h"
+
+// Payloads are read and relayed in pieces of this size.
+#define CHUNK 65536
+
+static int read_all(int fd, void* data, size_t n) {
+    char* p = data;
+    while (n > 0) {
+        ssize_t r = read(fd, p, n);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return -1;
+        p += r;
+        n -= r;
+    }
+    return 0;
+}
+
+// MSG_NOSIGNAL, a client which went away must not kill the shell.
+static int send_frame(int fd, char type, const void* data, uint32_t n) {
+    char header[5];
+    header[0] = type;
+    memcpy(header + 1, &n, sizeof(n));
+    struct iovec iov[2] = {
+        { .iov_base = header, .iov_len = sizeof(header) },
+        { .iov_base = (void*)data, .iov_len = n }
+    };
+    struct msghdr msg = { .msg_iov = iov, .msg_iovlen = 2 };
+    size_t left = sizeof(header) + n;
+    while (left > 0) {
+        ssize_t w = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (w < 0 && errno == EINTR) continue;
+        if (w < 0) return -1;
+        left -= w;
+        // Skip what was sent.
+        while (msg.msg_iovlen > 0 && (size_t)w >= msg.msg_iov->iov_len) {
+            w -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (msg.msg_iovlen > 0) {
+            msg.msg_iov->iov_base = (char*)msg.msg_iov->iov_base + w;
+            msg.msg_iov->iov_len -= w;
+        }
+    }
+    return 0;
+}
+
+static int recv_header(int fd, char* type, uint32_t* n) {
+    char header[5];
+    if (read_all(fd, header, sizeof(header)) < 0) return -1;
+    *type = header[0];
+    memcpy(n, header + 1, sizeof(*n));
+    return 0;
+}
+
+/// Copies the output of a command to the client while it runs.
+/// Only read, poll and sendmsg are called here: the shell forks while
+/// this thread runs, and the children only get the forking thread.
+typedef struct {
+    int out;
+    int err;
+    int client;
+} Relay;
+
+static void* relay(void* arg) {
+    Relay* r = arg;
+    char buf[CHUNK];
+    struct pollfd fds[2] = {
+        { .fd = r->out, .events = POLLIN },
+        { .fd = r->err, .events = POLLIN }
+    };
+    int left = 2;
+    while (left > 0) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (int k = 0; k < 2; ++k) {
+            if (fds[k].fd < 0 || !(fds[k].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            ssize_t n = read(fds[k].fd, buf, sizeof(buf));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                fds[k].fd = -1;
+                left--;
+                continue;
+            }
+            // Keep draining if the client is gone, the command must not block.
+            send_frame(r->client, k == 0 ? 'O' : 'E', buf, (uint32_t)n);
+        }
+    }
+    return NULL;
+}
+
+// Run one command line with stdout and stderr going to the client.
+static void handle_request(int client, const char* line) {
+    int out[2], err[2];
+    if (pipe2(out, O_CLOEXEC) < 0) {
+        perror("pipe");
+        exit(1);
+    }
+    if (pipe2(err, O_CLOEXEC) < 0) {
+        perror("pipe");
+        exit(1);
+    }
+    fflush(stdout);
+    fflush(stderr);
+    int saved_out = fcntl(1, F_DUPFD_CLOEXEC, 3);
+    int saved_err = fcntl(2, F_DUPFD_CLOEXEC, 3);
+    dup2(out[1], 1);
+    dup2(err[1], 2);
+    close(out[1]);
+    close(err[1]);
+
+    Relay r = { .out = out[0], .err = err[0], .client = client };
+    pthread_t thread;
+    pthread_create(&thread, NULL, relay, &r);
+
+    run(line);
+
+    // Closing the last write ends lets the relay see the end of the output.
+    fflush(stdout);
+    fflush(stderr);
+    dup2(saved_out, 1);
+    dup2(saved_err, 2);
+    close(saved_out);
+    close(saved_err);
+    pthread_join(thread, NULL);
+    close(out[0]);
+    close(err[0]);
+
+    int32_t status = vars_status();
+    send_frame(client, 'X', &status, sizeof(status));
+}
+
+static void worker(int listener) {
+    // Its own event loop, the server's children are not its jobs.
+    jobs_child();
+    jobs_init();
+    ush_pid = getpid();
+    // Do not outlive the server.
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    int null = open("/dev/null", O_RDONLY);
+    if (null >= 0) {
+        dup2(null, 0);
+        close(null);
+    }
+
+    while (1) {
+        int client = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            perror("accept");
+            exit(1);
+        }
+        char type;
+        uint32_t n;
+        while (recv_header(client, &type, &n) == 0 && type == 'C') {
+            char* line = malloc(n + 1);
+            if (read_all(client, line, n) < 0) {
+                free(line);
+                break;
+            }
+            line[n] = '\0';
+            handle_request(client, line);
+            free(line);
+        }
+        close(client);
+    }
+}
+
+static volatile sig_atomic_t stopping = 0;
+
+static void on_stop(int sig) {
+    stopping = 1;
+}
+
+static pid_t spawn_worker(int listener) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "failed to fork, %s\n", strerror(errno));
+    } else if (pid == 0) {
+        worker(listener);
+    }
+    return pid;
+}
+
+int serve(const char* path, int workers) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "serve: socket path too long, %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0) {
+        perror("socket");
+        return -1;
+    }
+    unlink(path);
+    if (bind(listener, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(listener, 128) < 0) {
+        fprintf(stderr, "serve: %s, %s\n", path, strerror(errno));
+        close(listener);
+        return -1;
+    }
+
+    // Not SA_RESTART, wait() has to return to notice it.
+    struct sigaction sa = { .sa_handler = on_stop };
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    ush_trace = 0;
+    fflush(stdout);
+    pid_t* pids = calloc(workers, sizeof(pid_t));
+    for (int i = 0; i < workers; ++i) {
+        pids[i] = spawn_worker(listener);
+    }
+
+    // Replace the workers which died, e.g. a builtin called exit.
+    while (!stopping) {
+        int status;
+        pid_t pid = wait(&status);
+        if (pid < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (int i = 0; i < workers; ++i) {
+            if (pids[i] == pid && !stopping) {
+                pids[i] = spawn_worker(listener);
+            }
+        }
+    }
+
+    for (int i = 0; i < workers; ++i) {
+        if (pids[i] > 0) kill(pids[i], SIGTERM);
+    }
+    while (wait(NULL) > 0 || errno == EINTR) {
+    }
+    free(pids);
+    close(listener);
+    unlink(path);
+    return 0;
+}
+
+int serve_connect(const char* path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int serve_request(int fd, const char* line, int out, int err) {
+    if (send_frame(fd, 'C', line, (uint32_t)strlen(line)) < 0) return -1;
+    char buf[CHUNK];
+    char type;
+    uint32_t n;
+    while (recv_header(fd, &type, &n) == 0) {
+        if (type == 'X') {
+            int32_t status;
+            if (n != sizeof(status) || read_all(fd, &status, sizeof(status)) < 0) return -1;
+            return status;
+        }
+        int to = type == 'O' ? out : type == 'E' ? err : -1;
+        while (n > 0) {
+            uint32_t piece = n < sizeof(buf) ? n : sizeof(buf);
+            if (read_all(fd, buf, piece) < 0) return -1;
+            if (to >= 0 && write(to, buf, piece) < 0) {
+                // The output is dropped, the reply still has to be read.
+            }
+            n -= piece;
+        }
+    }
+    return -1;
+}
\ No newline at end of file
@@ -0,0 +1,25 @@
+#include <stddef.h>
+
+/// Command server: 'ush --serve path' runs the command lines sent to a
+/// Unix domain socket in a pool of pre-forked shells.
+///
+/// Both sides send frames, a type byte and a u32 payload length in host
+/// byte order (the socket is local) followed by the payload:
+///     'C'     a command line, client to server
+///     'O'     output of the command on stdout
+///     'E'     output of the command on stderr
+///     'X'     exit status of the command as an int32, ends the reply
+/// A connection may send any number of command lines, one after the other.
+
+#define SERVE_WORKERS 4
+
+/// Listen on 'path' with 'workers' shells, until SIGINT or SIGTERM.
+/// The shells are forked from this one, so they start with its state.
+int serve(const char* path, int workers);
+
+/// Client side, returns the connected socket or -1.
+int serve_connect(const char* path);
+
+/// Run 'line' on the server and copy its output to the 'out' and 'err'
+/// descriptors (dropped if -1). Returns the exit status, -1 on an error.
+int serve_request(int fd, const char* line, int out, int err);
\ No newline at end of file
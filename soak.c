@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "ush.h"
+#include "vars.h"
+
+// Soak test, run as ./soak [rounds]: drives run() through a mix of
+// commands for a long time and fails if the resident memory, the heap in
+// use or the number of open descriptors of the shell keeps growing.
+//
+// Each round runs the cheap commands, builtins, loops, functions,
+// redirections, here words and failing ones, in the shell process.
+// Every FORK_EVERY rounds the commands which fork run too. The first
+// sample is the baseline, taken once the caches and tables are full.
+//
+// The resident size is taken after giving the free pages back, it still
+// creeps up a little while the free space of the heap gets fragmented.
+// The bytes the allocator has handed out do not, they catch small leaks.
+
+#define FORK_EVERY 100
+#define SAMPLES 20
+#define RSS_SLACK (1 << 20)
+#define HEAP_SLACK (64 << 10)
+
+static const char* CHEAP[] = {
+    "true",
+    "false",
+    "pwd",
+    "pwd -P",
+    "x=%d",
+    "export Y=%d; unset Y",
+    "cd sub; cd ..",
+    "cd sub; cd -",
+    "pushd sub; pushd ..; popd; popd",
+    "dirs",
+    "cd /nonexistent/%d",
+    "ls",
+    "ls sub",
+    "ls /nonexistent",
+    "wc in",
+    "wc < in > out",
+    "head -n 2 < in",
+    "tail -n 2 in",
+    "sort < in > out",
+    "grep line%d in",
+    "cat in | grep line%d | wc",
+    "cat < in | head -n 2 | sort > out",
+    "wc <<< word%d",
+    "wc <<EOF\nhere $x\nEOF",
+    "wc < /nonexistent/in",
+    "wc < in > /nonexistent/out",
+    "pwd > out > /nonexistent/out",
+    "for i in a b c; do x=$i; done",
+    "while false; do true; done",
+    "x=$(pwd)$(wc <<< %d); for i in $(grep -c line in); do x=$i; done",
+    "f() { wc < in; pwd; }; f; f",
+    "g() { f; }; g",
+    "Z=%d true; Z=1 f; Z=2 export",
+    "hash; cache",
+    "jobs; wait",
+    "ls |",
+    "for do",
+    "> out",
+    "unknown%d",
+    "# comment %d"
+};
+
+static const char* FORKED[] = {
+    "ls | wc",
+    "cat in | sort | head -n 1",
+    "/bin/true",
+    "hash -r; cat in > out",
+    "wc < <(ls)",
+    "true > >(wc)",
+    "sched -b true",
+    "true &",
+    "wait",
+    "parallel true ::: a b",
+    "x=$(ls | wc) $(/bin/echo %d)"
+};
+
+static size_t rss(void) {
+    FILE* f = fopen("/proc/self/statm", "r");
+    size_t size = 0, resident = 0;
+    if (f == NULL || fscanf(f, "%zu %zu", &size, &resident) != 2) {
+        perror("/proc/self/statm");
+        exit(2);
+    }
+    fclose(f);
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+static size_t open_fds(void) {
+    DIR* dir = opendir("/proc/self/fd");
+    if (dir == NULL) {
+        perror("/proc/self/fd");
+        exit(2);
+    }
+    size_t n = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] != '.') n++;
+    }
+    closedir(dir);
+    // Not the one of the directory itself.
+    return n - 1;
+}
+
+static void run_all(const char** commands, size_t n, int round) {
+    char line[256];
+    for (size_t i = 0; i < n; ++i) {
+        // A number in the line makes most of them new to the parse
+        // cache, which has to evict the old ones.
+        snprintf(line, sizeof(line), commands[i], round % 1000);
+        run(line);
+    }
+}
+
+int main(int argc, char** argv) {
+    int rounds = argc > 1 ? atoi(argv[1]) : 100000;
+    if (rounds < SAMPLES) {
+        fprintf(stderr, "usage: %s [rounds], at least %d\n", argv[0], SAMPLES);
+        return 2;
+    }
+
+    char dir[] = "/tmp/ush-soak-XXXXXX";
+    if (mkdtemp(dir) == NULL || chdir(dir) < 0) {
+        perror(dir);
+        return 2;
+    }
+    FILE* f = fopen("in", "w");
+    for (int i = 0; i < 100; ++i) {
+        fprintf(f, "line%d of the soak input\n", 100 - i);
+    }
+    fclose(f);
+    mkdir("sub", 0755);
+
+    ush_init();
+    ush_trace = 0;
+    var_set("PWD", dir);
+
+    // The report goes to the real stdout, the commands to /dev/null.
+    fflush(stdout);
+    int report = dup(1);
+    int null = open("/dev/null", O_RDWR);
+    dup2(null, 0);
+    dup2(null, 1);
+    dup2(null, 2);
+    close(null);
+
+    size_t n_cheap = sizeof(CHEAP) / sizeof(CHEAP[0]);
+    size_t n_forked = sizeof(FORKED) / sizeof(FORKED[0]);
+    int every = rounds / SAMPLES;
+    size_t base_rss = 0, base_heap = 0, base_fds = 0;
+    size_t last_rss = 0, last_heap = 0, last_fds = 0;
+    size_t commands = 0;
+    time_t start = time(NULL);
+    for (int round = 1; round <= rounds; ++round) {
+        run_all(CHEAP, n_cheap, round);
+        commands += n_cheap;
+        if (round % FORK_EVERY == 0) {
+            run_all(FORKED, n_forked, round);
+            commands += n_forked;
+        }
+        if (round % every != 0) continue;
+        fflush(stdout);
+        malloc_trim(0);
+        last_rss = rss();
+        last_heap = mallinfo2().uordblks;
+        last_fds = open_fds();
+        if (round == every) {
+            base_rss = last_rss;
+            base_heap = last_heap;
+            base_fds = last_fds;
+        }
+        dprintf(report, "%9zu commands  rss %6zu KB  heap %6zu KB  fds %zu\n",
+            commands, last_rss >> 10, last_heap >> 10, last_fds);
+    }
+    run("wait");
+
+    int failed = 0;
+    if (last_fds != base_fds) {
+        dprintf(report, "soak: fds grew from %zu to %zu\n", base_fds, last_fds);
+        failed = 1;
+    }
+    if (last_rss > base_rss + RSS_SLACK) {
+        dprintf(report, "soak: rss grew from %zu KB to %zu KB\n", base_rss >> 10, last_rss >> 10);
+        failed = 1;
+    }
+    if (last_heap > base_heap + HEAP_SLACK) {
+        dprintf(report, "soak: heap grew from %zu KB to %zu KB\n", base_heap >> 10, last_heap >> 10);
+        failed = 1;
+    }
+    dprintf(report, "soak: %zu commands in %lds, %s\n", commands, (long)(time(NULL) - start), failed ? "FAILED" : "ok");
+
+    char cmd[64];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    if (system(cmd) != 0) {
+        dprintf(report, "soak: cannot remove %s\n", dir);
+    }
+    return failed;
+}
\ No newline at end of file
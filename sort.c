@@ -0,0 +1,637 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "ush.h"
+
+/// sort [-nru] [-k N[,M]] [-t c] [-S size] [file...]
+///
+/// Sorts the lines of the files, or of stdin, by bytes or with -n by
+/// their leading number; -r reverses, -u keeps the first line of each
+/// run of equal keys. -k sorts by the fields N to M, fields are split by
+/// 'c' with -t, else each one is a run of blanks and the word after it.
+/// A key may carry its own n and r, e.g. -k 2,2nr.
+///
+/// The input is read in large blocks into one buffer, up to the memory
+/// given with -S (K by default, or b, K, M, G). The buffer is cut into
+/// one slice per core; each thread makes a record per line holding the
+/// first 8 bytes of its key, or its number, as an integer, so most
+/// comparisons never touch the lines, then sorts them. The slices are
+/// merged straight to the output if that was all the input, else to a
+/// sorted run in a temporary file, and the runs are merged at the end.
+
+#define BLOCK (1 << 20)
+#define DEFAULT_MEMORY (256L << 20)
+
+typedef struct {
+    int numeric;
+    int reverse;
+    int unique;
+    size_t key_start;       // Fields from 1, 0 for the whole line.
+    size_t key_end;         // 0 for the end of the line.
+    int key_numeric;
+    int key_reverse;
+    char tab;               // Field separator, 0 for blanks.
+    size_t memory;
+} Options;
+
+typedef struct {
+    uint64_t prefix;        // Orders like the key, ties compare the key.
+    const char* line;       // Followed by its '\n'.
+    uint32_t len;
+    uint32_t key;           // Offset of the key in the line.
+    uint32_t key_len;
+} Rec;
+
+static int is_blank(char c) {
+    return c == ' ' || c == '\t';
+}
+
+// Where the field starting at 'pos' ends, and where the next one starts.
+static size_t field_end(const char* line, size_t len, size_t pos, const Options* o) {
+    if (o->tab) {
+        const char* sep = memchr(line + pos, o->tab, len - pos);
+        return sep ? (size_t)(sep - line) : len;
+    }
+    while (pos < len && is_blank(line[pos])) pos++;
+    while (pos < len && !is_blank(line[pos])) pos++;
+    return pos;
+}
+
+static size_t next_field(const char* line, size_t len, size_t pos, const Options* o) {
+    size_t end = field_end(line, len, pos, o);
+    return o->tab && end < len ? end + 1 : end;
+}
+
+static void find_key(const char* line, size_t len, const Options* o, size_t* start, size_t* end) {
+    if (o->key_start == 0) {
+        *start = 0;
+        *end = len;
+        return;
+    }
+    size_t pos = 0;
+    for (size_t field = 1; field < o->key_start; ++field) {
+        pos = next_field(line, len, pos, o);
+    }
+    *start = pos;
+    if (o->key_end == 0) {
+        *end = len;
+    } else if (o->key_end < o->key_start) {
+        *end = pos;
+    } else {
+        for (size_t field = o->key_start; field < o->key_end; ++field) {
+            pos = next_field(line, len, pos, o);
+        }
+        *end = field_end(line, len, pos, o);
+    }
+}
+
+// A decimal number: its sign, its integer digits without leading zeros
+// and its fraction digits without trailing zeros.
+typedef struct {
+    int negative;
+    const char* digits;
+    size_t n_int;
+    const char* frac;
+    size_t n_frac;
+} Number;
+
+static Number parse_number(const char* s, size_t len) {
+    Number n = { 0 };
+    size_t i = 0;
+    while (i < len && is_blank(s[i])) i++;
+    if (i < len && s[i] == '-') {
+        n.negative = 1;
+        i++;
+    }
+    while (i < len && s[i] == '0') i++;
+    n.digits = s + i;
+    while (i < len && s[i] >= '0' && s[i] <= '9') i++;
+    n.n_int = s + i - n.digits;
+    if (i < len && s[i] == '.') {
+        n.frac = s + ++i;
+        while (i < len && s[i] >= '0' && s[i] <= '9') i++;
+        n.n_frac = s + i - n.frac;
+        while (n.n_frac > 0 && n.frac[n.n_frac - 1] == '0') n.n_frac--;
+    }
+    // Minus zero is zero.
+    if (n.n_int == 0 && n.n_frac == 0) n.negative = 0;
+    return n;
+}
+
+static int compare_numbers(const Number* a, const Number* b) {
+    int sign_a = a->negative ? -1 : (a->n_int || a->n_frac) ? 1 : 0;
+    int sign_b = b->negative ? -1 : (b->n_int || b->n_frac) ? 1 : 0;
+    if (sign_a != sign_b) return sign_a < sign_b ? -1 : 1;
+    int c = 0;
+    if (a->n_int != b->n_int) {
+        c = a->n_int < b->n_int ? -1 : 1;
+    } else if ((c = memcmp(a->digits, b->digits, a->n_int)) == 0) {
+        size_t n = a->n_frac > b->n_frac ? a->n_frac : b->n_frac;
+        for (size_t i = 0; i < n && c == 0; ++i) {
+            char x = i < a->n_frac ? a->frac[i] : '0';
+            char y = i < b->n_frac ? b->frac[i] : '0';
+            c = (x > y) - (x < y);
+        }
+    }
+    return sign_a < 0 ? -c : c;
+}
+
+// The number as a double, mapped to an integer of the same order. The
+// conversion rounds, equal prefixes are compared again exactly.
+static uint64_t number_prefix(const Number* n) {
+    char text[64];
+    double value;
+    if (n->n_int > 30) {
+        value = HUGE_VAL;
+    } else {
+        size_t n_frac = n->n_frac > 20 ? 20 : n->n_frac;
+        snprintf(text, sizeof(text), "%.*s.%.*s", (int)n->n_int, n->digits, (int)n_frac, n->frac ? n->frac : "");
+        value = strtod(text, NULL);
+    }
+    if (n->negative) value = -value;
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits >> 63 ? ~bits : bits | (1ULL << 63);
+}
+
+static uint64_t bytes_prefix(const char* s, size_t len) {
+    uint64_t prefix = 0;
+    for (size_t i = 0; i < 8; ++i) {
+        prefix = prefix << 8 | (i < len ? (unsigned char)s[i] : 0);
+    }
+    return prefix;
+}
+
+static void make_rec(const char* line, size_t len, const Options* o, Rec* rec) {
+    size_t start, end;
+    find_key(line, len, o, &start, &end);
+    rec->line = line;
+    rec->len = (uint32_t)len;
+    rec->key = (uint32_t)start;
+    rec->key_len = (uint32_t)(end - start);
+    if (o->key_numeric) {
+        Number n = parse_number(line + start, end - start);
+        rec->prefix = number_prefix(&n);
+    } else {
+        rec->prefix = bytes_prefix(line + start, end - start);
+    }
+}
+
+static int compare_bytes(const char* a, size_t n, const char* b, size_t m) {
+    int c = memcmp(a, b, n < m ? n : m);
+    return c != 0 ? c : (n > m) - (n < m);
+}
+
+static int compare_keys(const Rec* a, const Rec* b, const Options* o) {
+    int c;
+    if (a->prefix != b->prefix) {
+        c = a->prefix < b->prefix ? -1 : 1;
+    } else if (o->key_numeric) {
+        Number x = parse_number(a->line + a->key, a->key_len);
+        Number y = parse_number(b->line + b->key, b->key_len);
+        c = compare_numbers(&x, &y);
+    } else {
+        c = compare_bytes(a->line + a->key, a->key_len, b->line + b->key, b->key_len);
+    }
+    return o->key_reverse ? -c : c;
+}
+
+// Lines with equal keys compare as a whole, except with -u where they
+// are the same line for the output.
+static int compare(const Rec* a, const Rec* b, const Options* o) {
+    int c = compare_keys(a, b, o);
+    if (c != 0 || o->unique) return c;
+    if (o->key_start == 0 && !o->key_numeric) return 0;
+    c = compare_bytes(a->line, a->len, b->line, b->len);
+    return o->reverse ? -c : c;
+}
+
+// Most pairs differ in their prefix, the rest go through compare.
+static inline int less(const Rec* a, const Rec* b, const Options* o) {
+    if (a->prefix != b->prefix) {
+        return (a->prefix < b->prefix) != o->key_reverse;
+    }
+    return compare(a, b, o) < 0;
+}
+
+// A stable merge sort, so with -u the first of equal lines stays first.
+// Runs of 16 are sorted by insertion, then merged between 'recs' and 'tmp'.
+static void sort_recs(Rec* recs, Rec* tmp, size_t n, const Options* o) {
+    const size_t RUN = 16;
+    for (size_t from = 0; from < n; from += RUN) {
+        size_t to = from + RUN < n ? from + RUN : n;
+        for (size_t i = from + 1; i < to; ++i) {
+            Rec r = recs[i];
+            size_t j = i;
+            for (; j > from && less(&r, recs + j - 1, o); --j) {
+                recs[j] = recs[j - 1];
+            }
+            recs[j] = r;
+        }
+    }
+    Rec* src = recs;
+    Rec* dst = tmp;
+    for (size_t width = RUN; width < n; width *= 2) {
+        for (size_t from = 0; from < n; from += 2 * width) {
+            size_t mid = from + width < n ? from + width : n;
+            size_t to = from + 2 * width < n ? from + 2 * width : n;
+            size_t i = from, j = mid, k = from;
+            while (i < mid && j < to) {
+                dst[k++] = less(src + j, src + i, o) ? src[j++] : src[i++];
+            }
+            memcpy(dst + k, src + i, (mid - i) * sizeof(Rec));
+            k += mid - i;
+            memcpy(dst + k, src + j, (to - j) * sizeof(Rec));
+        }
+        Rec* t = src;
+        src = dst;
+        dst = t;
+    }
+    if (src != recs) {
+        memcpy(recs, src, n * sizeof(Rec));
+    }
+}
+
+typedef struct {
+    const char* begin;      // Whole lines, each ending with '\n'.
+    const char* end;
+    const Options* o;
+    Rec* recs;
+    size_t n;
+} Slice;
+
+static void* sort_slice(void* arg) {
+    Slice* s = arg;
+    size_t cap = (s->end - s->begin) / 32 + 16;
+    s->recs = malloc(cap * sizeof(Rec));
+    s->n = 0;
+    for (const char* p = s->begin; p < s->end;) {
+        const char* nl = memchr(p, '\n', s->end - p);
+        if (s->n == cap) {
+            cap *= 2;
+            s->recs = realloc(s->recs, cap * sizeof(Rec));
+        }
+        make_rec(p, nl - p, s->o, s->recs + s->n++);
+        p = nl + 1;
+    }
+    Rec* tmp = malloc((s->n ? s->n : 1) * sizeof(Rec));
+    sort_recs(s->recs, tmp, s->n, s->o);
+    free(tmp);
+    return NULL;
+}
+
+/// What the merge reads from: a sorted slice or a run in a file.
+typedef struct {
+    Rec* recs;
+    size_t n;
+    size_t next;
+    FILE* file;
+    char* line;
+    size_t cap;
+    Rec head;
+} Source;
+
+static int advance(Source* s, const Options* o) {
+    if (s->file == NULL) {
+        if (s->next == s->n) return 0;
+        s->head = s->recs[s->next++];
+        return 1;
+    }
+    ssize_t len = getline(&s->line, &s->cap, s->file);
+    if (len <= 0) return 0;
+    // Every line of a run ends with '\n'.
+    make_rec(s->line, (size_t)len - 1, o, &s->head);
+    return 1;
+}
+
+// Earlier sources hold earlier input, they come first among equals.
+static int source_less(const Source* sources, size_t i, size_t j, const Options* o) {
+    int c = compare(&sources[i].head, &sources[j].head, o);
+    return c != 0 ? c < 0 : i < j;
+}
+
+static void sift_down(size_t* heap, size_t n, size_t i, const Source* sources, const Options* o) {
+    while (1) {
+        size_t least = i;
+        size_t l = 2 * i + 1, r = 2 * i + 2;
+        if (l < n && source_less(sources, heap[l], heap[least], o)) least = l;
+        if (r < n && source_less(sources, heap[r], heap[least], o)) least = r;
+        if (least == i) return;
+        size_t t = heap[i];
+        heap[i] = heap[least];
+        heap[least] = t;
+        i = least;
+    }
+}
+
+static void merge(Source* sources, size_t n, const Options* o, FILE* out) {
+    size_t* heap = malloc((n ? n : 1) * sizeof(size_t));
+    size_t size = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (advance(sources + i, o)) heap[size++] = i;
+    }
+    for (size_t i = size / 2; i-- > 0;) {
+        sift_down(heap, size, i, sources, o);
+    }
+
+    // With -u, a copy of the last line written.
+    char* last = NULL;
+    size_t last_cap = 0;
+    Rec last_rec;
+    int have_last = 0;
+    while (size > 0) {
+        Source* s = sources + heap[0];
+        if (!o->unique || !have_last || compare_keys(&last_rec, &s->head, o) != 0) {
+            // Only this thread writes, the lock on each line costs.
+            fwrite_unlocked(s->head.line, 1, s->head.len + 1, out);
+            if (o->unique) {
+                if (last_cap < s->head.len + 1) {
+                    last_cap = s->head.len + 1;
+                    last = realloc(last, last_cap);
+                }
+                memcpy(last, s->head.line, s->head.len + 1);
+                last_rec = s->head;
+                last_rec.line = last;
+                have_last = 1;
+            }
+        }
+        if (!advance(s, o)) {
+            heap[0] = heap[--size];
+        }
+        sift_down(heap, size, 0, sources, o);
+    }
+    free(last);
+    free(heap);
+}
+
+typedef struct {
+    Options o;
+    char* data;
+    size_t len;
+    size_t cap;
+    size_t lines;           // Complete lines in data.
+    FILE** runs;
+    size_t n_runs;
+} Sorter;
+
+// Sort the whole lines of the buffer on the threads and merge them,
+// after the runs, to 'out'.
+static void sort_buffer(Sorter* s, size_t len, FILE* out) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t n = s->lines / 65536 + 1;
+    if (n > (size_t)cores) n = cores > 0 ? (size_t)cores : 1;
+
+    Slice* slices = malloc(n * sizeof(Slice));
+    pthread_t* threads = malloc(n * sizeof(pthread_t));
+    const char* p = s->data;
+    const char* end = s->data + len;
+    for (size_t i = 0; i < n; ++i) {
+        const char* to = i + 1 == n ? end : s->data + len / n * (i + 1);
+        if (to < p) to = p;
+        if (to < end) {
+            const char* nl = memchr(to, '\n', end - to);
+            to = nl + 1;
+        }
+        slices[i] = (Slice){ .begin = p, .end = to, .o = &s->o };
+        p = to;
+    }
+    // A slice whose thread could not be started is sorted here.
+    char* started = calloc(n, 1);
+    for (size_t i = 1; i < n; ++i) {
+        started[i] = pthread_create(threads + i, NULL, sort_slice, slices + i) == 0;
+    }
+    sort_slice(slices);
+    for (size_t i = 1; i < n; ++i) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        } else {
+            sort_slice(slices + i);
+        }
+    }
+    free(started);
+
+    Source* sources = calloc(s->n_runs + n, sizeof(Source));
+    for (size_t i = 0; i < s->n_runs; ++i) {
+        rewind(s->runs[i]);
+        sources[i].file = s->runs[i];
+    }
+    for (size_t i = 0; i < n; ++i) {
+        sources[s->n_runs + i].recs = slices[i].recs;
+        sources[s->n_runs + i].n = slices[i].n;
+    }
+    merge(sources, s->n_runs + n, &s->o, out);
+
+    for (size_t i = 0; i < s->n_runs + n; ++i) {
+        free(sources[i].line);
+        free(sources[i].recs);
+    }
+    free(sources);
+    free(threads);
+    free(slices);
+}
+
+static FILE* temp_file(void) {
+    const char* dir = getenv("TMPDIR");
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/ush-sort-XXXXXX", dir && *dir ? dir : "/tmp");
+    int fd = mkostemp(path, O_CLOEXEC);
+    if (fd < 0) return NULL;
+    unlink(path);
+    FILE* f = fdopen(fd, "w+");
+    if (f == NULL) {
+        close(fd);
+        return NULL;
+    }
+    setvbuf(f, NULL, _IOFBF, BLOCK);
+    return f;
+}
+
+// The buffer is full: write its whole lines as a sorted run and keep
+// the start of the next line.
+static int spill(Sorter* s) {
+    const char* nl = memrchr(s->data, '\n', s->len);
+    size_t complete = nl + 1 - s->data;
+    FILE* run = temp_file();
+    if (run == NULL) {
+        fprintf(stderr, "sort: temporary file, %s\n", strerror(errno));
+        return -1;
+    }
+    // The runs are merged when the input ends, not here.
+    size_t n_runs = s->n_runs;
+    s->n_runs = 0;
+    sort_buffer(s, complete, run);
+    s->n_runs = n_runs;
+    if (fflush(run) != 0) {
+        fprintf(stderr, "sort: temporary file, %s\n", strerror(errno));
+        fclose(run);
+        return -1;
+    }
+    s->runs = realloc(s->runs, (s->n_runs + 1) * sizeof(FILE*));
+    s->runs[s->n_runs++] = run;
+    memmove(s->data, s->data + complete, s->len - complete);
+    s->len -= complete;
+    s->lines = 0;
+    return 0;
+}
+
+static size_t count_lines(const char* p, const char* end) {
+    size_t n = 0;
+    while ((p = memchr(p, '\n', end - p)) != NULL) {
+        n++;
+        p++;
+    }
+    return n;
+}
+
+static int read_input(Sorter* s, int fd) {
+    while (1) {
+        if (s->cap - s->len < BLOCK) {
+            s->cap = s->cap ? s->cap * 2 : 4 * BLOCK;
+            s->data = realloc(s->data, s->cap);
+        }
+        ssize_t got = builtin_read(fd, s->data + s->len, s->cap - s->len - 1);
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0) return -1;
+        if (got == 0) break;
+        s->lines += count_lines(s->data + s->len, s->data + s->len + got);
+        s->len += got;
+        // Each line costs a record and a second one to merge, besides its bytes.
+        if (s->lines > 0 && s->len + 2 * s->lines * sizeof(Rec) >= s->o.memory && spill(s) < 0) {
+            return -1;
+        }
+    }
+    // The last line of a file may lack its newline.
+    if (s->len > 0 && s->data[s->len - 1] != '\n') {
+        s->data[s->len++] = '\n';
+        s->lines++;
+    }
+    return 0;
+}
+
+// A size like -S: K by default, or b, K, M or G.
+static int parse_size(const char* text, size_t* size) {
+    char* end;
+    unsigned long long n = strtoull(text, &end, 10);
+    if (end == text) return -1;
+    unsigned long long unit = 1024;
+    if (*end != '\0') {
+        switch (*end++) {
+            case 'b': unit = 1; break;
+            case 'K': case 'k': unit = 1024; break;
+            case 'M': case 'm': unit = 1024 * 1024; break;
+            case 'G': case 'g': unit = 1024 * 1024 * 1024; break;
+            default: return -1;
+        }
+    }
+    if (*end != '\0') return -1;
+    *size = (size_t)(n * unit);
+    return 0;
+}
+
+// N[,M] with optional n and r after each field.
+static int parse_key(const char* text, Options* o) {
+    char* end;
+    o->key_start = strtoul(text, &end, 10);
+    if (end == text || o->key_start == 0) return -1;
+    int own = 0;
+    for (; *end == 'n' || *end == 'r'; ++end) {
+        own = 1;
+        if (*end == 'n') o->key_numeric = 1; else o->key_reverse = 1;
+    }
+    if (*end == ',') {
+        const char* from = end + 1;
+        o->key_end = strtoul(from, &end, 10);
+        if (end == from || o->key_end == 0) return -1;
+        for (; *end == 'n' || *end == 'r'; ++end) {
+            own = 1;
+            if (*end == 'n') o->key_numeric = 1; else o->key_reverse = 1;
+        }
+    }
+    // A key with options of its own does not take the global ones.
+    return *end == '\0' ? own : -1;
+}
+
+static size_t parse_options(size_t n, char** words, Options* o) {
+    *o = (Options){ .memory = DEFAULT_MEMORY };
+    int own_key = 0;
+    size_t i = 1;
+    for (; i < n && words[i][0] == '-' && words[i][1] != '\0'; ++i) {
+        if (!strcmp(words[i], "--")) {
+            i++;
+            break;
+        }
+        for (const char* f = words[i] + 1; *f != '\0'; ++f) {
+            if (*f == 'n') {
+                o->numeric = 1;
+            } else if (*f == 'r') {
+                o->reverse = 1;
+            } else if (*f == 'u') {
+                o->unique = 1;
+            } else if (*f == 'k' || *f == 't' || *f == 'S') {
+                const char* value = f[1] ? f + 1 : (i + 1 < n ? words[++i] : NULL);
+                int bad = value == NULL;
+                if (!bad && *f == 'k') {
+                    int own = parse_key(value, o);
+                    bad = own < 0;
+                    own_key = own > 0;
+                } else if (!bad && *f == 't') {
+                    bad = strlen(value) != 1;
+                    if (!bad) o->tab = value[0];
+                } else if (!bad) {
+                    bad = parse_size(value, &o->memory) < 0;
+                }
+                if (bad) {
+                    fprintf(stderr, "sort: bad -%c %s\n", *f, value ? value : "");
+                    return 0;
+                }
+                break;
+            } else {
+                fprintf(stderr, "usage: sort [-nru] [-k N[,M]] [-t c] [-S size] [file...]\n");
+                return 0;
+            }
+        }
+    }
+    if (!own_key) {
+        o->key_numeric = o->numeric;
+        o->key_reverse = o->reverse;
+    }
+    if (o->memory < 4 * BLOCK) o->memory = 4 * BLOCK;
+    return i;
+}
+
+int simple_sort(size_t n, char** words){
+    Sorter s = { 0 };
+    size_t first = parse_options(n, words, &s.o);
+    if (first == 0) return 2;
+
+    int status = 0;
+    if (first == n && read_input(&s, builtin_stdin()) < 0) {
+        fprintf(stderr, "sort: %s\n", strerror(errno));
+        status = 2;
+    }
+    for (size_t i = first; i < n && status == 0; ++i) {
+        int fd = open(words[i], O_RDONLY | O_CLOEXEC);
+        if (fd < 0 || read_input(&s, fd) < 0) {
+            fprintf(stderr, "sort: %s: %s\n", words[i], strerror(errno));
+            status = 2;
+        }
+        if (fd >= 0) close(fd);
+    }
+
+    if (status == 0) {
+        sort_buffer(&s, s.len, builtin_stdout());
+    }
+    for (size_t i = 0; i < s.n_runs; ++i) {
+        fclose(s.runs[i]);
+    }
+    free(s.runs);
+    free(s.data);
+    return status;
+}
\ No newline at end of file
@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "parser.h"
+#include "ush.h"
+#include "stream.h"
+
+#define CHUNK 65536
+
+void stream_init(Stream* stream) {
+    *stream = (Stream){ NULL, 0, 0, 0, 0, 0 };
+    incomplete_init(&stream->incomplete);
+}
+
+void stream_free(Stream* stream) {
+    free(stream->data);
+    incomplete_free(&stream->incomplete);
+    stream_init(stream);
+}
+
+void stream_feed(Stream* stream, const char* chunk, size_t n) {
+    // Drop what was handed out already.
+    if (stream->start > 0) {
+        memmove(stream->data, stream->data + stream->start, stream->len - stream->start);
+        stream->len -= stream->start;
+        stream->scan -= stream->start;
+        stream->line -= stream->start;
+        stream->start = 0;
+    }
+    if (stream->len + n > stream->cap) {
+        stream->cap = stream->cap > 0 ? stream->cap : CHUNK;
+        while (stream->len + n > stream->cap) stream->cap *= 2;
+        stream->data = realloc(stream->data, stream->cap);
+    }
+    memcpy(stream->data + stream->len, chunk, n);
+    stream->len += n;
+}
+
+static char* take(Stream* stream, size_t stop) {
+    char* source = strndup(stream->data + stream->start, stop - stream->start);
+    stream->start = stop;
+    stream->scan = stop;
+    stream->line = stop;
+    incomplete_free(&stream->incomplete);
+    return source;
+}
+
+char* stream_next(Stream* stream, int end) {
+    if (stream->data == NULL) return NULL;
+    while (1) {
+        const char* nl = memchr(stream->data + stream->scan, '\n', stream->len - stream->scan);
+        if (nl == NULL) {
+            stream->scan = stream->len;
+            if (!end || stream->start == stream->len) return NULL;
+            return take(stream, stream->len);
+        }
+        // A command can only end at a newline. Each line is looked at
+        // once, what is open at its end is kept for the next.
+        size_t stop = nl - stream->data + 1;
+        stream->scan = stop;
+        const char* line = stream->data + stream->line;
+        stream->line = stop;
+        if (!incomplete_line(&stream->incomplete, line, stop - (line - stream->data))) {
+            return take(stream, stop);
+        }
+    }
+}
+
+int run_stream(int fd) {
+    Stream stream;
+    stream_init(&stream);
+    char* chunk = malloc(CHUNK);
+    int status = 0;
+    int done = 0;
+    while (!done) {
+        ssize_t got = read(fd, chunk, CHUNK);
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0) {
+            perror("read");
+            status = -1;
+            break;
+        }
+        stream_feed(&stream, chunk, (size_t)got);
+        char* source;
+        while (!done && (source = stream_next(&stream, got == 0)) != NULL) {
+            done = run(source) == USH_EXIT;
+            free(source);
+        }
+        if (got == 0) break;
+    }
+    free(chunk);
+    stream_free(&stream);
+    return status;
+}
\ No newline at end of file
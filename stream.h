@@ -0,0 +1,25 @@
+#include <stddef.h>
+
+/// Commands read in chunks of any size. The text is kept until a newline
+/// ends a complete command, see incomplete_line, which is handed out at
+/// once: a piped script runs while the rest of it is still being read.
+typedef struct {
+    char* data;
+    size_t len;
+    size_t cap;
+    size_t start;   // The first byte not handed out yet.
+    size_t scan;    // Where the search for the next newline goes on.
+    size_t line;    // The first line not looked at yet.
+    Incomplete incomplete;
+} Stream;
+
+void stream_init(Stream* stream);
+void stream_free(Stream* stream);
+void stream_feed(Stream* stream, const char* chunk, size_t n);
+
+/// The source of the next complete command, malloc'ed, or NULL until more
+/// is fed. At the 'end' of the input what is left is handed out as it is.
+char* stream_next(Stream* stream, int end);
+
+/// Run the commands read from 'fd' as soon as each one is complete.
+int run_stream(int fd);
\ No newline at end of file
@@ -0,0 +1,98 @@
+#include <stdlib.h>
+#include <string.h>
+#include "table.h"
+
+// Marks a removed key, probing continues past it.
+static char TOMBSTONE[1];
+
+// FNV-1a.
+unsigned long table_hash(const char* key, size_t len) {
+    unsigned long h = 14695981039346656037UL;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= (unsigned char)key[i];
+        h *= 1099511628211UL;
+    }
+    return h;
+}
+
+int table_live(const Table* table, size_t i) {
+    return table->slots[i].key != NULL && table->slots[i].key != TOMBSTONE;
+}
+
+// Index of the key, or -1.
+static long find(const Table* table, const char* key, size_t len, unsigned long hash) {
+    if (table->cap == 0) return -1;
+    size_t mask = table->cap - 1;
+    for (size_t i = hash & mask; table->slots[i].key != NULL; i = (i + 1) & mask) {
+        const Slot* slot = table->slots + i;
+        if (slot->key != TOMBSTONE && slot->hash == hash &&
+            !strncmp(slot->key, key, len) && slot->key[len] == '\0') {
+            return (long)i;
+        }
+    }
+    return -1;
+}
+
+// Rebuild with room for twice the live keys, dropping the tombstones.
+static void grow(Table* table) {
+    size_t cap = 16;
+    while (cap < table->n * 4) cap *= 2;
+    Slot* old = table->slots;
+    size_t n_old = table->cap;
+    table->slots = calloc(cap, sizeof(Slot));
+    table->cap = cap;
+    table->used = table->n;
+    for (size_t i = 0; i < n_old; ++i) {
+        if (old[i].key == NULL || old[i].key == TOMBSTONE) continue;
+        size_t j = old[i].hash & (cap - 1);
+        while (table->slots[j].key != NULL) j = (j + 1) & (cap - 1);
+        table->slots[j] = old[i];
+    }
+    free(old);
+}
+
+void* table_getn(const Table* table, const char* key, size_t len) {
+    long i = find(table, key, len, table_hash(key, len));
+    return i < 0 ? NULL : table->slots[i].value;
+}
+
+void* table_get(const Table* table, const char* key) {
+    return table_getn(table, key, strlen(key));
+}
+
+void** table_put(Table* table, const char* key) {
+    size_t len = strlen(key);
+    unsigned long hash = table_hash(key, len);
+    long i = find(table, key, len, hash);
+    if (i >= 0) return &table->slots[i].value;
+
+    // Keep the load, tombstones included, under 3/4.
+    if ((table->used + 1) * 4 > table->cap * 3) grow(table);
+    size_t j = hash & (table->cap - 1);
+    while (table_live(table, j)) j = (j + 1) & (table->cap - 1);
+    if (table->slots[j].key == NULL) table->used++;
+    table->slots[j].key = strdup(key);
+    table->slots[j].hash = hash;
+    table->slots[j].value = NULL;
+    table->n++;
+    return &table->slots[j].value;
+}
+
+void* table_remove(Table* table, const char* key) {
+    long i = find(table, key, strlen(key), table_hash(key, strlen(key)));
+    if (i < 0) return NULL;
+    void* value = table->slots[i].value;
+    free(table->slots[i].key);
+    table->slots[i].key = TOMBSTONE;
+    table->slots[i].value = NULL;
+    table->n--;
+    return value;
+}
+
+void table_clear(Table* table) {
+    for (size_t i = 0; i < table->cap; ++i) {
+        if (table_live(table, i)) free(table->slots[i].key);
+    }
+    free(table->slots);
+    memset(table, 0, sizeof(Table));
+}
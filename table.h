@@ -0,0 +1,33 @@
+#include <stddef.h>
+
+/// Hash table from strings to pointers, using open addressing with
+/// linear probing. Keys are copied, values belong to the caller.
+typedef struct {
+    char* key;
+    unsigned long hash;
+    void* value;
+} Slot;
+
+typedef struct {
+    size_t n;       // Live keys.
+    size_t used;    // Live keys and tombstones.
+    size_t cap;     // Always a power of two.
+    Slot* slots;
+} Table;
+
+unsigned long table_hash(const char* key, size_t len);
+
+/// Lookup with a key which is not NUL terminated, NULL if missing.
+void* table_getn(const Table* table, const char* key, size_t len);
+void* table_get(const Table* table, const char* key);
+
+/// Return the value slot of 'key', inserting it with a NULL value if missing.
+void** table_put(Table* table, const char* key);
+
+/// Remove 'key' and return its value.
+void* table_remove(Table* table, const char* key);
+
+/// Iterate with: for (size_t i = 0; i < table->cap; ++i) if (table_live(table, i)) ...
+int table_live(const Table* table, size_t i);
+
+void table_clear(Table* table);
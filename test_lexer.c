@@ -1,18 +1,23 @@
 #include "lexer.h"
 
 void printTokens(const char* source) {
-    Token* tokens = lex(source);
-    Token* curr = tokens;
-    while (curr != NULL) {
-        switch (curr->kind) {
-            case WORD: printf("WORD(%s) ", curr->data.word); break;
+    Tokens* tokens = lex(source);
+    for (size_t i = 0; i < tokens->n; ++i) {
+        switch (tokens->kinds[i]) {
+            case WORD: printf("WORD(%s) ", token_word(tokens, i)); break;
             case LT: printf("LT "); break;
             case RT: printf("RT "); break;
             case PIPE: printf("PIPE "); break;
             case BACKGROUND: printf("BACKGROUND "); break;
-            default: printf("unknown %d", curr->kind); break;
+            case SEMI: printf("SEMI "); break;
+            case NEWLINE: printf("NEWLINE "); break;
+            case PARENTL: printf("PARENTL "); break;
+            case PARENTR: printf("PARENTR "); break;
+            default: printf("unknown %d", tokens->kinds[i]); break;
         }
-        curr = curr->next;
+    }
+    if (tokens->error != NULL) {
+        printf("ERROR(%s at %zu)", tokens->error, tokens->at);
     }
     delete_tokens(tokens);
     printf("\n");
@@ -25,5 +30,23 @@ int main() {
     printTokens("< < <   > <");
     printTokens("ls");
     printTokens("ls cd chmod");
+    printTokens("echo 'a | b' \"c > d\" e\\ f");
+    printTokens("echo \"it's\"|wc");
+    printTokens("for i in a b; do ls;done");
+    printTokens("greet() { echo hi $1; }");
+    printTokens("echo '(x)' a\\(b");
+    printTokens("echo \"say \\\"hi\\\"\" 'x'\"y\"z");
+    printTokens("diff <(ls | sort) <(ls -a)");
+    printTokens("cat <(echo ')' (x)) >(wc) < <(ls)");
+    printTokens("cat <<<'a b' | wc <<< x");
+    printTokens("cat <<EOF | wc <<-'E'\n$x <<no\nEOF\n\tb\n\tE\nls");
+    printTokens("ls |\n  wc # a comment\nfor i \\\n in a");
+    printTokens("echo ok \"abc");
+    printTokens("cat <(ls 'x) y");
+    printTokens("echo $(ls | wc)x \"a $(echo \")\") b\" '$(' $((x)) y");
+    printTokens("echo $(ls; pwd");
+    printTokens("echo \"abc $(pwd) def");
+    printTokens("echo $(ls \"x");
+    printTokens("cat <(echo $(pwd)");
     return 0;
 }
\ No newline at end of file
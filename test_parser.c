@@ -1,7 +1,7 @@
 #include "parser.h"
 
 void driver(const char* source) {
-    Token* tokens = lex(source);
+    Tokens* tokens = lex(source);
     Cmd* cmd = parse(tokens);
     delete_tokens(tokens);
     if (cmd == NULL) {
@@ -21,11 +21,52 @@ int main() {
     driver("ls < in > out");
     driver("ls < in");
     driver("ls | wc");
+    driver("ls; pwd;");
+    driver("for i in a b c; do ls $i | wc; done");
+    driver("for i; do ls; done; pwd");
+    driver("while ls x; do pwd; ls; done");
+    driver("until ls; do for i in x; do pwd; done; done");
+    driver("greet() { ls $1 | wc; pwd; }; greet /tmp");
+    driver("ls | wc & pwd &");
+    driver("for i in a b; do ls $i & done; wait");
+    driver("diff <(ls | wc) <(for i in a; do ls; done)");
+    driver("cat < <(ls) > >(wc)");
+    driver("cat <<<word > out");
+    driver("cat > out <<EOF\nbody\nEOF");
+    driver("ls\n\npwd\n");
+    driver("for i in a b\ndo\n  ls $i |\n  wc\ndone\necho end");
+    driver("while ls\ndo pwd; done");
+    driver("greet()\n{\n  ls\n}\n");
+    driver("ls > out -l");
+    driver("< in wc -l > out");
+    driver("ls -a >a | > b wc <c -l");
+    driver("ls < in < in");
+    driver("echo for do done { }; ls");
+    driver("x=$(pwd); ls a$(ls | wc)b \"$(for i in a; do ls; done)\" $()");
 
     // illegal test.
-    driver("ls < in < in");
     driver("ls > <");
     driver("| ls");
     driver("ls | |");
+    driver("for i in a b do ls; done");
+    driver("while ls; do done");
+    driver("do ls");
+    driver("; ls");
+    driver("greet() ls");
+    driver("greet() { ls; ");
+    driver("greet( { ls; }");
+    driver("& ls");
+    driver("ls & & pwd");
+    driver("cat <(ls |)");
+    driver("ls > >(;)");
+    driver("cat <<<");
+    driver("> out");
+    driver("ls | < in");
+    driver("ls > out >");
+    driver("echo \"abc");
+    driver("ls\n| wc");
+    driver("for i in a b\n\nls; done");
+    driver("ls $(ls |)");
+    driver("ls \"x $(for i; ls)\"");
     return 0;
 }
\ No newline at end of file
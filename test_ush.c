@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "ush.h"
+#include "vars.h"
+
+void driver(const char* source) {
+    printf("$ %s\n", source);
+    fflush(stdout);
+    run(source);
+    fflush(stdout);
+    printf("status %d\n", vars_status());
+}
+
+int main() {
+    ush_init();
+    ush_trace = 0;
+
+    // Assignments before a command are for that command only.
+    driver("X=1 true; echo \"[$X]\"");
+    driver("f() { echo \"in f [$W]\"; }; W=7 f; echo \"[$W]\"");
+    driver("export Y=old; Y=new true; echo \"[$Y]\"; export | grep '^export Y='");
+    driver("Z=1 pwd > /dev/null; export | grep '^export Z='");
+    driver("V=1 /usr/bin/env | grep '^V='; echo \"[$V]\"");
+    // Except before export and unset.
+    driver("X=1 export X; echo \"[$X]\"; export | grep '^export X='");
+    driver("U=1; U=2 unset U; echo \"[$U]\"");
+
+    // A ']' in a bracket item does not close the bracket.
+    driver("grep '[[:digit:]]x' <<< 1x");
+    driver("grep '[^[:alpha:]]x' <<< 1x");
+    driver("grep '[][:digit:]]x' <<< ]x");
+    driver("grep '[[.l.]]ine1[[=0=]]' <<< line10");
+    driver("grep -c '[[:alpha:]]x' <<< 1x");
+
+    // A wide tree, workers steal directories while the first one is read.
+    char dir[] = "/tmp/test_ush-XXXXXX";
+    if (mkdtemp(dir) == NULL || chdir(dir) < 0) {
+        perror(dir);
+        return 1;
+    }
+    char path[64];
+    for (int i = 0; i < 3000; ++i) {
+        snprintf(path, sizeof(path), "d%d", i);
+        mkdir(path, 0755);
+        snprintf(path, sizeof(path), "d%d/x", i);
+        mkdir(path, 0755);
+    }
+    driver("find -j 1 . | grep -c .");
+    driver("find -j 8 . | grep -c .");
+    driver("find -j 8 . -name x | grep -c .");
+    driver("find -j 32 d1 d2 . -type d | grep -c .");
+    char cmd[64];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    if (system(cmd) != 0) {
+        fprintf(stderr, "cannot remove %s\n", dir);
+    }
+    return 0;
+}
\ No newline at end of file
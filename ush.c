@@ -1,5 +1,29 @@
+#define _GNU_SOURCE
+#include <limits.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdio_ext.h>
+#include <sys/mman.h>
 #include "parser.h"
 #include "ush.h"
+#include "complete.h"
+#include "cache.h"
+#include "vars.h"
+#include "wildcard.h"
+#include "table.h"
+#include "sched.h"
+#include "jobs.h"
+#include "dirs.h"
+#include "ring.h"
+
+// The pipe of a command substitution, and the first buffer its output
+// is read into.
+#define SUBST_PIPE (1 << 20)
+#define SUBST_BUFFER 65536
+
+// The ring between two threaded stages, and the buffer of their output.
+#define STAGE_RING_SIZE (1 << 18)
+#define STAGE_BUFFER 65536
 
 static const char* PATH[] = {
     "/usr/local/sbin",
@@ -11,7 +35,13 @@ static const char* PATH[] = {
 
 struct Builtin{
     const char* cmd;
-    void (*fun)(size_t, char*[]);
+    int (*fun)(size_t, char*[]);
+    int forked;     // Runs in a child like an executable, e.g. a prefix.
+    int subshell;   // Runs in a child in '$(...)': it changes the shell,
+                    // or its commands write to fd 1 rather than stdout.
+    int threaded;   // Runs as a thread in a pipeline: it only reads
+                    // builtin_stdin and writes builtin_stdout.
+    int special;    // Assignments before it stay set, it changes them.
 };
 
 typedef struct Builtin Builtin;
@@ -27,36 +57,279 @@ static Builtin BUILT_IN[] = {
     },
     {
         .cmd = "cd",
-        .fun = simple_cd
+        .fun = simple_cd,
+        .subshell = 1
     },
     {
         .cmd = "pwd",
         .fun = simple_pwd
     },
+    {
+        .cmd = "pushd",
+        .fun = simple_pushd,
+        .subshell = 1
+    },
+    {
+        .cmd = "popd",
+        .fun = simple_popd,
+        .subshell = 1
+    },
+    {
+        .cmd = "dirs",
+        .fun = simple_dirs,
+        .subshell = 1
+    },
     {
         .cmd = "wc",
-        .fun = simple_wc
+        .fun = simple_wc,
+        .threaded = 1
+    },
+    {
+        .cmd = "cat",
+        .fun = simple_cat,
+        .threaded = 1
+    },
+    {
+        .cmd = "cache",
+        .fun = simple_cache,
+        .subshell = 1
+    },
+    {
+        .cmd = "export",
+        .fun = simple_export,
+        .subshell = 1,
+        .special = 1
+    },
+    {
+        .cmd = "unset",
+        .fun = simple_unset,
+        .subshell = 1,
+        .special = 1
+    },
+    {
+        .cmd = "true",
+        .fun = simple_true,
+        .threaded = 1
+    },
+    {
+        .cmd = "false",
+        .fun = simple_false,
+        .threaded = 1
+    },
+    {
+        .cmd = "hash",
+        .fun = simple_hash,
+        .subshell = 1
+    },
+    {
+        .cmd = "wait",
+        .fun = simple_wait,
+        .subshell = 1
+    },
+    {
+        .cmd = "jobs",
+        .fun = simple_jobs
+    },
+    {
+        .cmd = "head",
+        .fun = simple_head,
+        .threaded = 1
+    },
+    {
+        .cmd = "tail",
+        .fun = simple_tail,
+        .threaded = 1
+    },
+    {
+        .cmd = "sort",
+        .fun = simple_sort,
+        .threaded = 1
+    },
+    {
+        .cmd = "grep",
+        .fun = simple_grep,
+        .threaded = 1
+    },
+    {
+        .cmd = "find",
+        .fun = simple_find,
+        .threaded = 1
+    },
+    {
+        .cmd = "parallel",
+        .fun = simple_parallel,
+        .subshell = 1
+    },
+    {
+        .cmd = "sched",
+        .fun = simple_sched,
+        .forked = 1
     }
 };
 
-int is_built_in(const char* cmd){
-    for(size_t i = 0; i != sizeof(BUILT_IN) / sizeof(Builtin); ++i){
-        if(!strcmp(BUILT_IN[i].cmd, cmd)){
-            return 1;
+// A function keeps its body while it runs, it may be redefined meanwhile.
+typedef struct {
+    Cmd* body;
+    size_t refs;
+} Function;
+
+typedef enum {
+    COMMAND_BUILTIN,
+    COMMAND_FUNCTION,
+    COMMAND_EXTERNAL
+} CommandKind;
+
+typedef struct {
+    CommandKind kind;
+    int forked;
+    int subshell;
+    int threaded;
+    int special;
+    union {
+        int (*builtin)(size_t, char*[]);
+        Function* function;
+        char* path;
+    } data;
+} Command;
+
+// Every name a command can refer to, one hash lookup finds it:
+// functions, builtins and the executables found in PATH so far.
+static Table commands;
+
+static void release_function(Function* function) {
+    if (--function->refs == 0) {
+        delete_cmd(function->body);
+        free(function);
+    }
+}
+
+static void add_builtins(void) {
+    for (size_t i = 0; i < sizeof(BUILT_IN) / sizeof(Builtin); ++i) {
+        Command* command = malloc(sizeof(Command));
+        command->kind = COMMAND_BUILTIN;
+        command->forked = BUILT_IN[i].forked;
+        command->subshell = BUILT_IN[i].subshell;
+        command->threaded = BUILT_IN[i].threaded;
+        command->special = BUILT_IN[i].special;
+        command->data.builtin = BUILT_IN[i].fun;
+        *table_put(&commands, BUILT_IN[i].cmd) = command;
+    }
+}
+
+// Search in the Path.
+static char* search_path(const char* name) {
+    for (size_t i = 0; i < sizeof(PATH) / sizeof(char*); ++i) {
+
+        // Concat the path and the file.
+        char* concat = malloc(strlen(PATH[i]) + strlen(name) + 2);
+        strcpy(concat, PATH[i]);
+        concat[strlen(PATH[i])] = '/';
+        strcpy(concat + strlen(PATH[i]) + 1, name);
+
+        // Check if we can execute the file.
+        if (access(concat, F_OK | X_OK) == 0) {
+            return concat;
         }
+        free(concat);
     }
-    return 0;
+    return NULL;
 }
 
-void run_built_in(const SimpleCmd* cmd){
-    for(size_t i = 0; i < sizeof(BUILT_IN) / sizeof(Builtin); ++i){
-        if(!strcmp(BUILT_IN[i].cmd, cmd->words[0])){
-            BUILT_IN[i].fun(cmd->n, cmd->words);
-            break;
+// What 'name' refers to, NULL if it is unknown. An executable is only
+// searched in PATH the first time, 'hash -r' forgets the found ones.
+static Command* lookup_command(const char* name) {
+    if (commands.cap == 0) {
+        add_builtins();
+    }
+    Command* command = table_get(&commands, name);
+    if (command != NULL || is_path(name)) {
+        return command;
+    }
+    char* path = search_path(name);
+    if (path == NULL) {
+        return NULL;
+    }
+    command = malloc(sizeof(Command));
+    command->kind = COMMAND_EXTERNAL;
+    command->forked = 1;
+    command->subshell = 1;
+    command->threaded = 0;
+    command->special = 0;
+    command->data.path = path;
+    *table_put(&commands, name) = command;
+    return command;
+}
+
+static void define_function(const char* name, const Cmd* body) {
+    if (commands.cap == 0) {
+        add_builtins();
+    }
+    // The parsed tree belongs to the parse cache, keep a copy.
+    Function* function = malloc(sizeof(Function));
+    function->body = copy_cmd(body);
+    function->refs = 1;
+
+    Command** slot = (Command**)table_put(&commands, name);
+    if (*slot == NULL) {
+        *slot = malloc(sizeof(Command));
+        complete_add_name(name);
+    } else if ((*slot)->kind == COMMAND_FUNCTION) {
+        release_function((*slot)->data.function);
+    } else if ((*slot)->kind == COMMAND_EXTERNAL) {
+        free((*slot)->data.path);
+    }
+    (*slot)->kind = COMMAND_FUNCTION;
+    (*slot)->forked = 0;
+    (*slot)->subshell = 1;
+    (*slot)->threaded = 0;
+    (*slot)->special = 0;
+    (*slot)->data.function = function;
+}
+
+static int call_function(Function* function, size_t n, char** words) {
+    function->refs++;
+    Args saved = vars_set_args(n - 1, words + 1);
+    int status = run_cmd(function->body);
+    vars_set_args(saved.n, saved.v);
+    release_function(function);
+    return status;
+}
+
+void commands_print(void) {
+    for (size_t i = 0; i < commands.cap; ++i) {
+        if (!table_live(&commands, i)) continue;
+        const Command* command = commands.slots[i].value;
+        if (command->kind == COMMAND_EXTERNAL) {
+            fprintf(stdout, "%s=%s\n", commands.slots[i].key, command->data.path);
         }
     }
 }
 
+void commands_forget(void) {
+    for (size_t i = 0; i < commands.cap; ++i) {
+        if (!table_live(&commands, i)) continue;
+        Command* command = commands.slots[i].value;
+        if (command->kind == COMMAND_EXTERNAL) {
+            table_remove(&commands, commands.slots[i].key);
+            free(command->data.path);
+            free(command);
+        }
+    }
+}
+
+extern char** environ;
+
+void ush_init(void) {
+    ush_pid = getpid();
+    jobs_init();
+    vars_init(environ);
+    dirs_init();
+    complete_set_path(PATH, sizeof(PATH) / sizeof(char*));
+    for (size_t i = 0; i < sizeof(BUILT_IN) / sizeof(Builtin); ++i) {
+        complete_add_name(BUILT_IN[i].cmd);
+    }
+}
+
 // If the string contains a /, then this is a path.
 int is_path(const char* file) {
     for (size_t i = 0; i < strlen(file); ++i) {
@@ -65,202 +338,1039 @@ int is_path(const char* file) {
     return 0;
 }
 
-// Simply call execv.
-static void run_simple_cmd(const SimpleCmd* cmd) {
+// The command named by the first word after the assignments, NULL for
+// an unknown command or if there are only assignments.
+static const Command* resolve(const SimpleCmd* cmd) {
+    size_t i = 0;
+    while (i < cmd->n && assignment(cmd->words[i])) i++;
+    return i == cmd->n ? NULL : lookup_command(cmd->words[i]);
+}
+
+// Commands which have to run in the shell process itself:
+// builtins, functions and plain variable assignments.
+static int in_shell(const SimpleCmd* cmd) {
+    size_t i = 0;
+    while (i < cmd->n && assignment(cmd->words[i])) i++;
+    if (i == cmd->n) {
+        return 1;
+    }
+    const Command* command = resolve(cmd);
+    return command != NULL && !command->forked;
+}
+
+// A variable replaced by a leading assignment, put back after the command.
+typedef struct {
+    const char* name;
+    char* value;
+    int exported;
+} SavedVar;
+
+static void restore_vars(SavedVar* saved, size_t k) {
+    // Backwards, so that with X=1 X=2 the first value saved wins.
+    for (size_t i = k; i-- > 0;) {
+        var_unset(saved[i].name);
+        if (saved[i].value != NULL) var_set(saved[i].name, saved[i].value);
+        if (saved[i].exported) var_export(saved[i].name);
+        free(saved[i].value);
+    }
+    free(saved);
+}
+
+int exec_simple_cmd(size_t n, char** words) {
+    size_t k = 0;
+    while (k < n && assignment(words[k])) {
+        words[k][assignment(words[k])] = '\0';
+        k++;
+    }
+
+    // Only assignments, they stay set in the shell.
+    if (k == n) {
+        for (size_t i = 0; i < k; ++i) {
+            var_set(words[i], words[i] + strlen(words[i]) + 1);
+        }
+        return 0;
+    }
+
+    const Command* command = is_path(words[k]) ? NULL : lookup_command(words[k]);
+
+    // Leading NAME=value words are set and exported for the command only.
+    // Builtins and functions run in this process, so the old variables
+    // are saved and put back when they return. Except for the special
+    // builtins, as in POSIX: they are kept, with what the builtin did to
+    // them, e.g. X=1 export X.
+    size_t n_saved = command != NULL && command->special ? 0 : k;
+    SavedVar* saved = n_saved > 0 ? malloc(n_saved * sizeof(SavedVar)) : NULL;
+    for (size_t i = 0; i < k; ++i) {
+        if (n_saved == 0) {
+            var_set(words[i], words[i] + strlen(words[i]) + 1);
+            continue;
+        }
+        const char* old = var_get(words[i]);
+        saved[i].name = words[i];
+        saved[i].value = old != NULL ? strdup(old) : NULL;
+        saved[i].exported = var_exported(words[i]);
+        var_set(words[i], words[i] + strlen(words[i]) + 1);
+        var_export(words[i]);
+    }
+    words += k;
+    n -= k;
 
     // Check if this is a path.
-    if (is_path(cmd->words[0])) {
-        execv(cmd->words[0], cmd->words);
-    } 
-    else{ 
-        if(is_built_in(cmd->words[0])){
-            run_built_in(cmd);
-        }
-        else{
-            // Search in the Path.
-            for (size_t i = 0; i < sizeof(PATH) / sizeof(char*); ++i) {
-
-                // Concat the path and the file.
-                char* concat = malloc(strlen(PATH[i]) + strlen(cmd->words[0]) + 2);
-                strcpy(concat, PATH[i]);
-                concat[strlen(PATH[i])] = '/';
-                strcpy(concat + strlen(PATH[i]) + 1, cmd->words[0]);
-
-                // Check if we can execute the file.
-                if (access(concat, F_OK | X_OK) < 0) {
-                    free(concat);
-                    continue;
-                } else {
-                    // Execute the command.
-                    execv(concat, cmd->words);
-                }
+    if (is_path(words[0])) {
+        execve(words[0], words, vars_environ());
+        perror(words[0]);
+        exit(126);
+    }
+    if (command == NULL) {
+        fprintf(stderr, "Unknown command: %s\n", words[0]);
+        exit(127);
+    }
+    int status;
+    switch (command->kind) {
+        case COMMAND_BUILTIN:
+            status = command->data.builtin(n, words);
+            restore_vars(saved, n_saved);
+            return status;
+        case COMMAND_FUNCTION:
+            status = call_function(command->data.function, n, words);
+            restore_vars(saved, n_saved);
+            return status;
+        case COMMAND_EXTERNAL:
+            break;
+    }
+    // Execute the command.
+    execve(command->data.path, words, vars_environ());
+    perror(words[0]);
+    exit(126);
+}
+
+static void push_word(char*** words, size_t* n, size_t* cap, char* word) {
+    if (*n + 1 >= *cap) {
+        *cap *= 2;
+        *words = realloc(*words, *cap * sizeof(char*));
+    }
+    (*words)[(*n)++] = word;
+}
+
+// The pipes to the commands of the process substitutions of one command.
+typedef struct {
+    size_t n;
+    int* fds;
+    pid_t* pids;
+} Substs;
+
+// Start the command of '<(cmd)' or '>(cmd)' with its stdout or stdin on a
+// pipe, the word becomes the /dev/fd path of the other end. That end is
+// inherited by the command which opens the path, nothing goes to disk.
+static char* open_subst(const char* word, Substs* substs) {
+    int out = word[0] == '<';
+    int pfds[2];
+    if (pipe(pfds) < 0) {
+        fprintf(stderr, "failed to pipe, %s\n", strerror(errno));
+        return strdup("/dev/null");
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "failed to fork, %s\n", strerror(errno));
+        close(pfds[0]);
+        close(pfds[1]);
+        return strdup("/dev/null");
+    }
+    if (pid == 0) {
+        jobs_child();
+        // A '>(cmd)' only sees the end of its input once every writer is gone.
+        for (size_t i = 0; i < substs->n; ++i) {
+            close(substs->fds[i]);
+        }
+        dup2(out ? pfds[1] : pfds[0], out ? 1 : 0);
+        close(pfds[0]);
+        close(pfds[1]);
+        ush_trace = 0;
+        char* inner = strndup(word + 2, strlen(word) - 3);
+        run(inner);
+        free(inner);
+        fflush(stdout);
+        exit(vars_status());
+    }
+    int fd = out ? pfds[0] : pfds[1];
+    close(out ? pfds[1] : pfds[0]);
+    substs->fds = realloc(substs->fds, (substs->n + 1) * sizeof(int));
+    substs->pids = realloc(substs->pids, (substs->n + 1) * sizeof(pid_t));
+    substs->fds[substs->n] = fd;
+    substs->pids[substs->n] = pid;
+    substs->n++;
+
+    char path[32];
+    snprintf(path, sizeof(path), "/dev/fd/%d", fd);
+    return strdup(path);
+}
+
+// Close the pipes, then wait for the commands to finish with them.
+static void close_substs(Substs* substs) {
+    for (size_t i = 0; i < substs->n; ++i) {
+        close(substs->fds[i]);
+    }
+    for (size_t i = 0; i < substs->n; ++i) {
+        jobs_wait(substs->pids[i]);
+    }
+    free(substs->fds);
+    free(substs->pids);
+}
+
+// Expand the variables and the filename patterns in the words of the command.
+// Unquoted words which came out empty are dropped, and a pattern which
+// matches nothing is kept as it is. Process substitutions are started when
+// 'substs' is not NULL, and stay words otherwise.
+static char** expand_words(const SimpleCmd* cmd, size_t* n, Substs* substs) {
+    size_t cap = cmd->n + 1;
+    char** words = malloc(cap * sizeof(char*));
+    *n = 0;
+    for (size_t i = 0; i < cmd->n; ++i) {
+        // "$@" is one word per positional parameter.
+        if (!strcmp(cmd->words[i], "\"$@\"") || !strcmp(cmd->words[i], "$@")) {
+            Args args = vars_args();
+            for (size_t j = 0; j < args.n; ++j) {
+                push_word(&words, n, &cap, strdup(args.v[j]));
+            }
+            continue;
+        }
+        if (substs != NULL && is_process_subst(cmd->words[i])) {
+            push_word(&words, n, &cap, open_subst(cmd->words[i], substs));
+            continue;
+        }
+        // A lone unquoted '$(cmd)' is one word per field of the output.
+        if (cmd->words[i][0] == '$' && subst_length(cmd->words[i]) == strlen(cmd->words[i])) {
+            char* output = expand_word(cmd->words[i]);
+            char* rest;
+            for (char* field = strtok_r(output, " \t\n", &rest); field != NULL; field = strtok_r(NULL, " \t\n", &rest)) {
+                push_word(&words, n, &cap, strdup(field));
+            }
+            free(output);
+            continue;
+        }
+        int glob = 0;
+        char* word = assignment(cmd->words[i]) ?
+            expand_word(cmd->words[i]) : expand_pattern(cmd->words[i], &glob);
+        if (glob) {
+            char** matches;
+            size_t m = wildcard_expand(word, &matches);
+            for (size_t j = 0; j < m; ++j) {
+                push_word(&words, n, &cap, matches[j]);
             }
-            perror("Unknown command");
-            exit(-1);
+            free(matches);
+            if (m > 0) {
+                free(word);
+                continue;
+            }
+        }
+        if (!assignment(cmd->words[i])) {
+            wildcard_unescape(word);
+        }
+        if (word[0] == '\0' && strpbrk(cmd->words[i], "'\"") == NULL) {
+            free(word);
+            continue;
+        }
+        push_word(&words, n, &cap, word);
+    }
+    words[*n] = NULL;
+    return words;
+}
+
+// The descriptor was closed before the redirection, it is closed again.
+#define SAVED_CLOSED -2
+
+static void restore_redirs(int saved[2]) {
+    for (int fd = 0; fd < 2; ++fd) {
+        if (saved[fd] == SAVED_CLOSED) {
+            close(fd);
+        } else if (saved[fd] >= 0) {
+            dup2(saved[fd], fd);
+            close(saved[fd]);
+        }
+    }
+    // A builtin which read the file through stdin left its end of file
+    // and maybe some of it buffered, the next one would see them.
+    if (saved[0] != -1) {
+        __fpurge(stdin);
+        clearerr(stdin);
+    }
+}
+
+// The words and the redirections after expansion.
+typedef struct {
+    size_t n;
+    char** words;
+    char* lhs;
+    char* rhs;
+    int here;       // The input of a here word, -1 without.
+    Substs substs;
+} Expanded;
+
+// The text of a here word goes to a pipe when the pipe can hold it all,
+// otherwise to an anonymous memory file. Neither needs a file on disk or
+// a process to feed it. Returns the fd to read it from, or -1.
+static int open_here(const char* word) {
+    char* text;
+    if (word[2] == '<') {
+        char* value = expand_word(word + 3);
+        size_t n = strlen(value);
+        text = realloc(value, n + 2);
+        text[n] = '\n';
+        text[n + 1] = '\0';
+    } else {
+        const char* body = strchr(word, '\n') + 1;
+        // Nothing is expanded when the delimiter is quoted.
+        int quoted = strcspn(word, "'\"\\") < (size_t)(body - word);
+        text = quoted ? strdup(body) : expand_text(body);
+    }
+    size_t len = strlen(text);
+    int fd = -1;
+    int pfds[2];
+    if (len <= PIPE_BUF && pipe2(pfds, O_CLOEXEC) == 0) {
+        if (write(pfds[1], text, len) == (ssize_t)len) {
+            fd = pfds[0];
+        } else {
+            close(pfds[0]);
+        }
+        close(pfds[1]);
+    } else if ((fd = memfd_create("here", MFD_CLOEXEC)) >= 0) {
+        for (size_t done = 0; done < len;) {
+            ssize_t n = write(fd, text + done, len - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) {
+                close(fd);
+                fd = -1;
+                break;
+            }
+            done += (size_t)n;
+        }
+        if (fd >= 0) lseek(fd, 0, SEEK_SET);
+    }
+    if (fd < 0) {
+        fprintf(stderr, "cannot write the here-document, %s\n", strerror(errno));
+    }
+    free(text);
+    return fd;
+}
+
+// Open the redirections over stdin and stdout.
+// The replaced descriptors are kept in 'saved' (-1 if not replaced) when it
+// is not NULL. Returns -1 if a file cannot be opened.
+static int apply_redirs(const Expanded* e, int saved[2]) {
+    const char* files[2] = { e->lhs, e->rhs };
+    for (int fd = 0; fd < 2; ++fd) {
+        if (files[fd] == NULL) continue;
+        // Before opening, which would reuse a closed fd.
+        if (saved != NULL) {
+            // Above the standard ones and not inherited by the commands
+            // the builtin or function starts.
+            saved[fd] = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+            if (saved[fd] < 0 && errno == EBADF) saved[fd] = SAVED_CLOSED;
+        }
+        if (fd == 0 && is_here_word(files[fd])) {
+            // Written in the expansion already.
+            if (e->here < 0) return -1;
+            dup2(e->here, fd);
+            continue;
+        }
+        int file = fd == 0 ? open(files[fd], O_RDONLY) : open(files[fd], O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (file < 0) {
+            fprintf(stderr, "cannot open %s, %s\n", files[fd], strerror(errno));
+            return -1;
+        }
+        if (file != fd) {
+            dup2(file, fd);
+            close(file);
+        }
+    }
+    return 0;
+}
+
+static char* expand_target(const char* word, Substs* substs) {
+    if (word == NULL) return NULL;
+    if (is_here_word(word)) return strdup(word);
+    return is_process_subst(word) ? open_subst(word, substs) : expand_word(word);
+}
+
+static Expanded expand_redir_cmd(const RedirCmd* cmd) {
+    // The parsed tree is shared, expand into copies.
+    Expanded e;
+    e.substs = (Substs){ 0, NULL, NULL };
+    e.words = expand_words(cmd->simple, &e.n, &e.substs);
+    e.lhs = expand_target(cmd->lhs, &e.substs);
+    e.rhs = expand_target(cmd->rhs, &e.substs);
+    e.here = e.lhs != NULL && is_here_word(e.lhs) ? open_here(e.lhs) : -1;
+    return e;
+}
+
+static void delete_expanded(Expanded* e) {
+    for (size_t i = 0; i < e->n; ++i) {
+        free(e->words[i]);
+    }
+    free(e->words);
+    free(e->lhs);
+    free(e->rhs);
+    if (e->here >= 0) close(e->here);
+    close_substs(&e->substs);
+}
+
+// Run a stage in a forked child, never returns.
+static void exec_redir_cmd(const RedirCmd* cmd) {
+    Expanded e = expand_redir_cmd(cmd);
+    if (apply_redirs(&e, NULL) < 0) {
+        exit(1);
+    }
+    int status = e.n > 0 ? exec_simple_cmd(e.n, e.words) : 0;
+    fflush(stdout);
+    delete_expanded(&e);
+    exit(status);
+}
+
+// Builtins and assignments run in the shell itself,
+// with stdin and stdout redirected for the time of the command.
+static int run_redir_cmd(const RedirCmd* cmd) {
+    Expanded e = expand_redir_cmd(cmd);
+    int saved[2] = { -1, -1 };
+    int status = 1;
+    // What the shell printed so far goes to its own stdout.
+    fflush(stdout);
+    if (apply_redirs(&e, saved) == 0) {
+        status = e.n > 0 ? exec_simple_cmd(e.n, e.words) : 0;
+    }
+    fflush(stdout);
+    restore_redirs(saved);
+    delete_expanded(&e);
+    return status;
+}
+
+// Whether '$(cmd)' can run cmd in the shell itself: a lone builtin which
+// leaves the shell as it is, with its output not redirected.
+static int capturable(const Cmd* cmd) {
+    if (cmd->next != NULL || cmd->background || cmd->kind != CMD_PIPE) return 0;
+    const PipeCmd* pipe = cmd->data.pipe;
+    if (pipe->next != NULL || pipe->redir->rhs != NULL) return 0;
+    const SimpleCmd* simple = pipe->redir->simple;
+    if (simple->n == 0 || assignment(simple->words[0])) return 0;
+    const Command* command = lookup_command(simple->words[0]);
+    return command != NULL && !command->subshell && !command->forked;
+}
+
+// The builtins write through stdout, which goes to a memory stream for
+// the time of the call: no fork and no system call.
+static char* capture_builtin(const RedirCmd* cmd, size_t* len) {
+    char* output = NULL;
+    Expanded e = expand_redir_cmd(cmd);
+    int saved[2] = { -1, -1 };
+    int status = 1;
+    FILE* out = open_memstream(&output, len);
+    if (out != NULL && apply_redirs(&e, saved) == 0) {
+        FILE* shell = stdout;
+        stdout = out;
+        status = e.n > 0 ? exec_simple_cmd(e.n, e.words) : 0;
+        stdout = shell;
+    }
+    restore_redirs(saved);
+    delete_expanded(&e);
+    if (out != NULL) fclose(out);
+    vars_set_status(status);
+    return output != NULL ? output : calloc(1, 1);
+}
+
+// Anything else runs in a child writing to a pipe, made large so that
+// most outputs come in one read.
+static char* capture_child(const Cmd* cmd, size_t* len) {
+    *len = 0;
+    int pfds[2];
+    if (pipe2(pfds, O_CLOEXEC) < 0) {
+        fprintf(stderr, "failed to pipe, %s\n", strerror(errno));
+        return calloc(1, 1);
+    }
+    // Only a hint, the size may be over the limit.
+    fcntl(pfds[1], F_SETPIPE_SZ, SUBST_PIPE);
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "failed to fork, %s\n", strerror(errno));
+        close(pfds[0]);
+        close(pfds[1]);
+        return calloc(1, 1);
+    }
+    if (pid == 0) {
+        jobs_child();
+        dup2(pfds[1], 1);
+        close(pfds[0]);
+        close(pfds[1]);
+        ush_trace = 0;
+        int status = run_cmd(cmd);
+        fflush(stdout);
+        exit(status);
+    }
+    close(pfds[1]);
+    size_t cap = SUBST_BUFFER;
+    char* output = malloc(cap);
+    ssize_t got;
+    while ((got = read(pfds[0], output + *len, cap - *len - 1)) != 0) {
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "failed to read the output, %s\n", strerror(errno));
+            break;
         }
+        *len += (size_t)got;
+        if (*len + 1 == cap) {
+            cap *= 2;
+            output = realloc(output, cap);
+        }
+    }
+    close(pfds[0]);
+    vars_set_status(jobs_exit_status(jobs_wait(pid)));
+    output[*len] = '\0';
+    return output;
+}
+
+char* command_subst(const char* source) {
+    const char* first = source + strspn(source, " \t\n");
+    if (*first == '\0' || *first == '#') {
+        return calloc(1, 1);
+    }
+    CacheEntry* entry = cache_acquire(source);
+    if (entry == NULL) {
+        return calloc(1, 1);
+    }
+    size_t len;
+    char* output = capturable(entry->cmd) ?
+        capture_builtin(entry->cmd->data.pipe->redir, &len) : capture_child(entry->cmd, &len);
+    cache_release(entry);
+    while (len > 0 && output[len - 1] == '\n') len--;
+    output[len] = '\0';
+    return output;
+}
+
+int ush_trace = 1;
+pid_t ush_pid = 0;
+
+// Wait for the child and return its exit status, 128 + the signal if it was killed.
+static int wait_child(pid_t pid, int report) {
+    int status = jobs_wait(pid);
+    if (!report || !ush_trace) {
+        // Only report the status interactively.
+    } else if (WIFEXITED(status)) {
+        printf("exited, status = %d\n", WEXITSTATUS(status));
+    } else if (WIFSIGNALED(status)) {
+        printf("killed by signal %d\n", WTERMSIG(status));
+    }
+    return jobs_exit_status(status);
+}
+
+// A stage of a pipeline run by run_threaded_pipe: a thread of the shell,
+// or a forked child like in run_pipe_cmd. A thread's input and output are
+// fds it owns, the shell's 0 and 1, or the rings between two threads.
+typedef struct {
+    const RedirCmd* redir;
+    int threaded;
+    int expanded;
+    Expanded e;
+    int in;                 // An fd, 0, STAGE_RING, or -1 once released.
+    Ring* in_ring;
+    int out;                // An fd, 1, STAGE_RING, or -1 once released.
+    Ring* out_ring;
+    FILE* file;             // The buffered output of a thread.
+    int broken;             // Nobody reads the output any more.
+    int started;
+    pthread_t thread;
+    pid_t pid;
+    int status;
+} Stage;
+
+// The stage the calling thread runs, NULL outside of one.
+static __thread Stage* current_stage = NULL;
+
+static void release_input(Stage* s) {
+    if (s->in == STAGE_RING) {
+        ring_close_read(s->in_ring);
+    } else if (s->in > 0) {
+        close(s->in);
     }
+    s->in = -1;
 }
 
-static void run_redir_cmd(const RedirCmd* cmd) {
+static void release_output(Stage* s) {
+    if (s->out == STAGE_RING) {
+        ring_close_write(s->out_ring);
+    } else if (s->out > 1) {
+        close(s->out);
+    }
+    s->out = -1;
+}
 
-    //copy stdin stdout
-    int stdin_cpy, stdout_cpy;
-    int inf, ouf;
-    if(cmd->lhs){
-        if((inf = open(cmd->lhs, O_RDONLY)) < 0){
-            fprintf(stderr, "the file name is %s, the fd is %d\n", cmd->lhs, inf);
-            fprintf(stderr, "the value of lhs is %p\n", cmd->lhs);
-            fprintf(stderr, "cannot open inf %s\n", strerror(errno));
-            exit(-1);
+static ssize_t stage_write(void* cookie, const char* data, size_t n) {
+    Stage* s = cookie;
+    ssize_t done = 0;
+    if (s->out == STAGE_RING) {
+        done = ring_write(s->out_ring, data, n);
+    } else {
+        while ((size_t)done < n) {
+            ssize_t got = write(s->out, data + done, n - done);
+            if (got < 0 && errno == EINTR) continue;
+            if (got < 0) {
+                done = -1;
+                break;
+            }
+            done += got;
         }
-        stdin_cpy = dup(0);
+    }
+    if (done < 0 && errno == EPIPE) s->broken = 1;
+    // Not -1, stdio takes a write function's count as unsigned.
+    return done < 0 ? 0 : done;
+}
+
+static int stage_close(void* cookie) {
+    release_output(cookie);
+    return 0;
+}
+
+int builtin_stdin(void) {
+    return current_stage != NULL ? current_stage->in : 0;
+}
+
+ssize_t builtin_read(int fd, void* buf, size_t n) {
+    Stage* s = current_stage;
+    // Once nothing reads the output there is no point reading on, a
+    // forked stage would have been killed by SIGPIPE.
+    if (s != NULL && s->broken) return 0;
+    if (fd == STAGE_RING) return (ssize_t)ring_read(s->in_ring, buf, n);
+    return read(fd, buf, n);
+}
+
+FILE* builtin_stdout(void) {
+    return current_stage != NULL ? current_stage->file : stdout;
+}
+
+void builtin_close_stdin(void) {
+    if (current_stage != NULL) {
+        release_input(current_stage);
+    } else if (getpid() != ush_pid) {
         close(0);
-        dup2(inf, 0);
     }
-    if(cmd->rhs){
-        if((ouf = open(cmd->rhs, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0){
-            fprintf(stderr, "cannot open file , %s\n", strerror(errno));
-            fprintf(stderr, "the file name is %s, the fd is %d\n", cmd->rhs, ouf);
-            exit(-1);
+}
+
+// Whether the stage can run as a thread: a threaded builtin named as it
+// is, so that its expansion names it too, without process substitutions,
+// whose pipes the other stages would inherit.
+static int threadable(const RedirCmd* redir) {
+    const SimpleCmd* cmd = redir->simple;
+    if (cmd->n == 0 || assignment(cmd->words[0])) return 0;
+    if ((redir->lhs != NULL && is_process_subst(redir->lhs)) ||
+        (redir->rhs != NULL && is_process_subst(redir->rhs))) return 0;
+    for (size_t i = 0; i < cmd->n; ++i) {
+        if (is_process_subst(cmd->words[i])) return 0;
+    }
+    const Command* command = lookup_command(cmd->words[0]);
+    return command != NULL && command->kind == COMMAND_BUILTIN && command->threaded && !command->forked;
+}
+
+static int threads_enabled(void) {
+    const char* threads = var_get("USH_THREADS");
+    return threads == NULL || strcmp(threads, "0") != 0;
+}
+
+// The redirections of a thread replace its input and output, which are
+// released at once so that its neighbours see the end of the data.
+static int open_stage_redirs(Stage* s) {
+    if (s->e.lhs != NULL) {
+        int fd;
+        if (is_here_word(s->e.lhs)) {
+            // Written in the expansion already.
+            fd = s->e.here >= 0 ? fcntl(s->e.here, F_DUPFD_CLOEXEC, 0) : -1;
+        } else {
+            fd = open(s->e.lhs, O_RDONLY | O_CLOEXEC);
+            if (fd < 0) fprintf(stderr, "cannot open %s, %s\n", s->e.lhs, strerror(errno));
         }
-        stdout_cpy = dup(1);
-        close(1);
-        dup2(ouf, 1);
+        if (fd < 0) return -1;
+        release_input(s);
+        s->in = fd;
     }
-    run_simple_cmd(cmd->simple);
-    //close file descriptor
-    //recover stdin stdout
-    if(cmd->lhs){
-        dup2(stdin_cpy, 0);
-        close(stdin_cpy);
-        close(inf);
+    if (s->e.rhs != NULL) {
+        int fd = open(s->e.rhs, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if (fd < 0) {
+            fprintf(stderr, "cannot open %s, %s\n", s->e.rhs, strerror(errno));
+            return -1;
+        }
+        release_output(s);
+        s->out = fd;
     }
-    if(cmd->rhs){
-        dup2(stdout_cpy, 1);
-        close(stdout_cpy);
-        close(ouf);
+    return 0;
+}
+
+static void* run_stage(void* arg) {
+    Stage* s = arg;
+    // A write to a pipe nobody reads fails with EPIPE instead of killing
+    // the shell. The signal stays pending on this thread, which ends.
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    current_stage = s;
+    s->status = s->e.n > 0 ? exec_simple_cmd(s->e.n, s->e.words) : 0;
+    current_stage = NULL;
+    fclose(s->file);
+    release_input(s);
+    return NULL;
+}
+
+// Start a thread for the stage, with its output buffered like stdout.
+static void start_stage(Stage* s) {
+    cookie_io_functions_t io = { .write = stage_write, .close = stage_close };
+    s->file = fopencookie(s, "w", io);
+    if (s->file == NULL) {
+        fprintf(stderr, "failed to open the output, %s\n", strerror(errno));
+    } else {
+        setvbuf(s->file, NULL, s->out == 1 && isatty(1) ? _IOLBF : _IOFBF, STAGE_BUFFER);
+        int error = pthread_create(&s->thread, NULL, run_stage, s);
+        if (error == 0) {
+            s->started = 1;
+            return;
+        }
+        fprintf(stderr, "failed to start a thread, %s\n", strerror(error));
+        fclose(s->file);
     }
+    release_output(s);
+    release_input(s);
+    s->status = 1;
 }
 
+// The builtins of the pipeline which can run as threads do so, the other
+// stages are forked. Two threads next to each other pass the data through
+// a ring, without system calls while neither waits for the other; pipes
+// are only made next to a child. Every child is forked before the first
+// thread starts, so no thread holds a lock the child would need.
+static int run_threaded_pipe(const PipeCmd* cmd, size_t n) {
+    Stage* stages = calloc(n, sizeof(Stage));
+    size_t i = 0;
+    for (const PipeCmd* iter = cmd; iter != NULL; iter = iter->next, ++i) {
+        // Search PATH here, so the next pipelines find the executable too.
+        resolve(iter->redir->simple);
+        stages[i].redir = iter->redir;
+        stages[i].threaded = threadable(iter->redir);
+        stages[i].in = i == 0 ? 0 : -1;
+        stages[i].out = i + 1 == n ? 1 : -1;
+        stages[i].pid = -1;
+    }
+
+    for (i = 0; i + 1 < n; ++i) {
+        if (stages[i].threaded && stages[i + 1].threaded) {
+            Ring* ring = ring_new(STAGE_RING_SIZE);
+            stages[i].out = stages[i + 1].in = STAGE_RING;
+            stages[i].out_ring = stages[i + 1].in_ring = ring;
+            continue;
+        }
+        int pfds[2];
+        if (pipe2(pfds, O_CLOEXEC) < 0) {
+            fprintf(stderr, "failed to pipe, %s\n", strerror(errno));
+            // Nothing started yet.
+            for (size_t k = 0; k <= i; ++k) {
+                release_input(stages + k);
+                release_output(stages + k);
+                if (stages[k].out_ring != NULL) ring_free(stages[k].out_ring);
+            }
+            free(stages);
+            return 1;
+        }
+        stages[i].out = pfds[1];
+        stages[i + 1].in = pfds[0];
+    }
 
+    for (i = 0; i < n; ++i) {
+        Stage* s = stages + i;
+        if (!s->threaded) continue;
+        s->e = expand_redir_cmd(s->redir);
+        s->expanded = 1;
+        if (open_stage_redirs(s) < 0) {
+            release_input(s);
+            release_output(s);
+            s->status = 1;
+        }
+    }
 
-static void run_pipe_cmd(const PipeCmd* cmd) {
-    //printf("pipe\n");
-    if(cmd->next != NULL){
-        if(cmd->redir->rhs != NULL || cmd->next->redir->lhs != NULL){
-            // Check if either the stdout of the first command has been redirected
-            // or the stdin of the second command has been redirected.
-            pid_t pid = fork();
-            if(pid < 0){
-                fprintf(stderr, "failed to fork, %s\n", strerror(errno));
+    // The children keep only their own ends, or a reader would wait for
+    // a writer which is another child holding a copy of its pipe.
+    int* fds = malloc(2 * n * sizeof(int));
+    size_t n_fds = 0;
+    for (i = 0; i < n; ++i) {
+        if (stages[i].in > 0) fds[n_fds++] = stages[i].in;
+        if (stages[i].out > 1) fds[n_fds++] = stages[i].out;
+    }
+    int spread = sched_spread(n);
+    for (i = 0; i < n; ++i) {
+        Stage* s = stages + i;
+        if (s->threaded) continue;
+        s->pid = fork();
+        if (s->pid < 0) {
+            fprintf(stderr, "failed to fork, %s\n", strerror(errno));
+            s->status = 1;
+        } else if (s->pid == 0) {
+            jobs_child();
+            if (s->in > 0) dup2(s->in, 0);
+            if (s->out > 1) dup2(s->out, 1);
+            for (size_t k = 0; k < n_fds; ++k) {
+                close(fds[k]);
             }
-            if(pid == 0){
-                // Remember to close the stdin.
-                close(fileno(stdin));
-                run_pipe_cmd(cmd->next);
-                exit(0);
+            if (spread >= 0) {
+                sched_pin(spread + i);
             }
-            else {
-                run_redir_cmd(cmd->redir);
+            exec_redir_cmd(s->redir);
+        }
+        release_input(s);
+        release_output(s);
+    }
+    free(fds);
+
+    // The threads inherit SIGCHLD blocked, or one of them could take the
+    // signal of a stage and drop it. A child shell starts the loop late.
+    jobs_init();
+    for (i = 0; i < n; ++i) {
+        if (stages[i].threaded && stages[i].out != -1) start_stage(stages + i);
+    }
 
-                // Wait the child.
-                int status;
-                waitpid(pid, &status, WUNTRACED | WCONTINUED);
+    int status = 1;
+    for (i = 0; i < n; ++i) {
+        Stage* s = stages + i;
+        int last = i + 1 == n;
+        if (s->started) {
+            pthread_join(s->thread, NULL);
+            if (last && ush_trace) {
+                printf("exited, status = %d\n", s->status);
             }
+        } else if (s->pid > 0) {
+            s->status = wait_child(s->pid, last);
         }
-        else{
-            int pfds[2];
-            pipe(pfds);
-            pid_t pid = fork();
-            if(pid < 0){
-                fprintf(stderr, "failed to fork, %s\n", strerror(errno));
+        if (last) status = s->status;
+    }
+    for (i = 0; i < n; ++i) {
+        if (stages[i].expanded) delete_expanded(&stages[i].e);
+        if (stages[i].out_ring != NULL) ring_free(stages[i].out_ring);
+    }
+    free(stages);
+    return status;
+}
+
+// Every stage is forked from the shell and connected to the next one
+// with a pipe, unless some may run as threads. The status is the one of
+// the last stage.
+static int run_pipe_cmd(const PipeCmd* cmd) {
+    if (cmd->next == NULL && in_shell(cmd->redir->simple)) {
+        return run_redir_cmd(cmd->redir);
+    }
+
+    // Otherwise the children would write the buffered output again.
+    fflush(stdout);
+
+    size_t n = 0;
+    for (const PipeCmd* iter = cmd; iter != NULL; iter = iter->next) n++;
+    if (n > 1 && threads_enabled()) {
+        for (const PipeCmd* iter = cmd; iter != NULL; iter = iter->next) {
+            if (threadable(iter->redir)) return run_threaded_pipe(cmd, n);
+        }
+    }
+    pid_t* pids = malloc(n * sizeof(pid_t));
+    size_t started = 0;
+    int spread = n > 1 ? sched_spread(n) : -1;
+    int in = -1;
+    for (const PipeCmd* iter = cmd; iter != NULL; iter = iter->next) {
+        // Search PATH here, so the next pipelines find the executable too.
+        resolve(iter->redir->simple);
+
+        int pfds[2] = { -1, -1 };
+        if (iter->next != NULL && pipe(pfds) < 0) {
+            fprintf(stderr, "failed to pipe, %s\n", strerror(errno));
+            break;
+        }
+        pid_t pid = fork();
+        if (pid < 0) {
+            fprintf(stderr, "failed to fork, %s\n", strerror(errno));
+            if (pfds[0] >= 0) {
+                close(pfds[0]);
+                close(pfds[1]);
             }
-            else if(pid == 0){
-                dup2(pfds[0], fileno(stdin));
+            break;
+        }
+        if (pid == 0) {
+            jobs_child();
+            if (in >= 0) {
+                dup2(in, 0);
+                close(in);
+            }
+            if (pfds[1] >= 0) {
+                dup2(pfds[1], 1);
+                close(pfds[0]);
                 close(pfds[1]);
-                run_pipe_cmd(cmd->next);
-                exit(0);
             }
-            else{
-                int stdout_cpy = dup(fileno(stdout));
+            if (spread >= 0) {
+                sched_pin(spread + started);
+            }
+            exec_redir_cmd(iter->redir);
+        }
+        if (in >= 0) close(in);
+        if (pfds[1] >= 0) close(pfds[1]);
+        in = pfds[0];
+        pids[started++] = pid;
+    }
+    if (in >= 0) close(in);
 
-                dup2(pfds[1], fileno(stdout));
-                close(pfds[0]);
+    int status = 1;
+    for (size_t i = 0; i < started; ++i) {
+        int last = i + 1 == n;
+        int s = wait_child(pids[i], last);
+        if (last) status = s;
+    }
+    free(pids);
+    return status;
+}
 
-                run_redir_cmd(cmd->redir);
+int resolve_command(const char* name) {
+    return is_path(name) || lookup_command(name) != NULL;
+}
 
-                dup2(stdout_cpy, fileno(stdout));
-                close(pfds[1]);
-                close(stdout_cpy);
+pid_t spawn_words(char** words, int in) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "failed to fork, %s\n", strerror(errno));
+    } else if (pid == 0) {
+        jobs_child();
+        if (in >= 0) {
+            dup2(in, 0);
+            close(in);
+        }
+        size_t n = 0;
+        while (words[n] != NULL) n++;
+        int status = exec_simple_cmd(n, words);
+        fflush(stdout);
+        exit(status);
+    }
+    return pid;
+}
 
-                // Wait the child.
-                int status;
-                waitpid(pid, &status, WUNTRACED | WCONTINUED);
+int wait_pid(pid_t pid) {
+    return wait_child(pid, 0);
+}
+
+static int run_foreground(const Cmd* cmd) {
+    int status = 0;
+    switch (cmd->kind) {
+        case CMD_PIPE:
+            status = run_pipe_cmd(cmd->data.pipe);
+            break;
+        case CMD_FOR: {
+            // Without 'in' the loop goes over the positional parameters.
+            size_t n;
+            char** words;
+            if (cmd->data.loop_for.words != NULL) {
+                words = expand_words(cmd->data.loop_for.words, &n, NULL);
+            } else {
+                Args args = vars_args();
+                n = args.n;
+                words = malloc((n + 1) * sizeof(char*));
+                for (size_t i = 0; i < n; ++i) {
+                    words[i] = strdup(args.v[i]);
+                }
+            }
+            for (size_t i = 0; i < n; ++i) {
+                var_set(cmd->data.loop_for.var, words[i]);
+                status = run_cmd(cmd->data.loop_for.body);
+            }
+            for (size_t i = 0; i < n; ++i) {
+                free(words[i]);
             }
+            free(words);
+            break;
         }
+        case CMD_WHILE:
+        case CMD_UNTIL:
+            while ((run_cmd(cmd->data.loop_while.cond) == 0) == (cmd->kind == CMD_WHILE)) {
+                status = run_cmd(cmd->data.loop_while.body);
+            }
+            break;
+        case CMD_FUNC:
+            define_function(cmd->data.func.name, cmd->data.func.body);
+            break;
     }
-    else{
-        run_redir_cmd(cmd->redir);
+    return status;
+}
+
+// A command followed by '&' runs in a child which is not waited for,
+// the event loop reaps it whenever it exits.
+static int run_background(const Cmd* cmd) {
+    if (cmd->kind == CMD_PIPE) {
+        for (const PipeCmd* iter = cmd->data.pipe; iter != NULL; iter = iter->next) {
+            resolve(iter->redir->simple);
+        }
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "failed to fork, %s\n", strerror(errno));
+        return 1;
+    }
+    if (pid == 0) {
+        jobs_child();
+        // It must not compete with the shell for the terminal.
+        int null = open("/dev/null", O_RDONLY);
+        if (null >= 0) {
+            dup2(null, 0);
+            close(null);
+        }
+        ush_trace = 0;
+        // A lone executable replaces the child rather than forking again.
+        const PipeCmd* pipe = cmd->kind == CMD_PIPE ? cmd->data.pipe : NULL;
+        if (pipe != NULL && pipe->next == NULL && !in_shell(pipe->redir->simple)) {
+            exec_redir_cmd(pipe->redir);
+        }
+        int status = run_foreground(cmd);
+        fflush(stdout);
+        exit(status);
     }
+    int number = jobs_background(pid);
+    vars_set_background(pid);
+    if (ush_trace) {
+        printf("[%d] %d\n", number, (int)pid);
+    }
+    return 0;
+}
+
+static int run_node(const Cmd* cmd) {
+    return cmd->background ? run_background(cmd) : run_foreground(cmd);
+}
+
+int run_cmd(const Cmd* cmd) {
+    int status = 0;
+    for (const Cmd* iter = cmd; iter != NULL; iter = iter->next) {
+        status = run_node(iter);
+        vars_set_status(status);
+    }
+    return status;
 }
 
 int run(const char* source) {
-    Token* tokens = lex(source);
-    Cmd* cmd = parse(tokens);
-    delete_tokens(tokens);
-    if (cmd == NULL) {
+    // Nothing to do for a blank line or a comment.
+    const char* first = source + strspn(source, " \t\n");
+    if (*first == '\0' || *first == '#') {
+        return USH_CONTINUE;
+    }
+
+    // Repeated lines reuse the tree parsed the first time.
+    CacheEntry* entry = cache_acquire(source);
+    if (entry == NULL) {
         // Failed parsing.
         printf("Failed: %s\n", source);
         return USH_CONTINUE;
     } else {
-        print_cmd(cmd);
-        printf("\n");
-        if(is_built_in(cmd->redir->simple->words[0])){
-            //printf("haha\n");
-            run_pipe_cmd(cmd);
-        }
-        else{
-            pid_t pid;
-            if((pid = fork()) < 0){
-                fprintf(stderr, "%s\n", strerror(errno));
-                exit(-1);
-            }
-            else{
-                if(pid == 0){
-                    //child
-                    run_pipe_cmd(cmd);
-                }
-                else{
-                    //parent
-                    while (1) {
-                        int status;
-                        pid_t end = waitpid(pid, &status, WUNTRACED | WCONTINUED);
-                        if (end == -1) {
-                            perror("Failed waiting for child");
-                            exit(-1);
-                        }
-
-                        if (WIFEXITED(status)) {
-                            printf("exited, status = %d\n", WEXITSTATUS(status));
-                        } else if (WIFSIGNALED(status)) {
-                            printf("killed by signal %d\n", WTERMSIG(status));
-                        } else if (WIFSTOPPED(status)) {
-                            printf("stopped by signal %d\n", WSTOPSIG(status));
-                        } else if (WIFCONTINUED(status)) {
-                            printf("continued\n");
-                        }
-
-                        if (WIFEXITED(status) || WIFSIGNALED(status)) {
-                            break;
-                        }
-                    }
-                }
-            }
+        if (ush_trace) {
+            print_cmd(entry->cmd);
+            printf("\n");
         }
-        delete_cmd(cmd);
+        run_cmd(entry->cmd);
+        cache_release(entry);
         return USH_CONTINUE;
     }
-}
-
-
-
+}
\ No newline at end of file
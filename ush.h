@@ -1,3 +1,4 @@
+#include <stdio.h>
 #include <unistd.h>
 #include <sys/wait.h>
 #include <ctype.h>
@@ -5,10 +6,78 @@
 #define USH_EXIT 1
 #define USH_CONTINUE 0
 
+struct Cmd;
+
+// Print the parsed commands and their exit status, on by default.
+extern int ush_trace;
+
+// The pid of the shell, a builtin sees another one in a pipeline stage.
+extern pid_t ush_pid;
+
+void ush_init(void);
 int run(const char* source);
+/// Run the command list, returns the exit status of the last command.
+int run_cmd(const struct Cmd* cmd);
 int is_path(const char* file);
 
-void simple_ls(size_t n, char** words);
-void simple_cd(size_t n, char** words);
-void simple_pwd(size_t n, char** words);
-void simple_wc(size_t n, char** words);
\ No newline at end of file
+/// Run the words as a command in this process. Only builtins, functions
+/// and assignments return, with their status; an executable replaces it.
+int exec_simple_cmd(size_t n, char** words);
+
+/// Fork a child running the words as one command, a builtin, a function
+/// or an executable, with stdin from 'in' (kept if -1). Returns its pid.
+/// Builtins which start threads call resolve_command first: a lookup
+/// may change the command table, the children only read it.
+pid_t spawn_words(char** words, int in);
+int resolve_command(const char* name);
+
+/// The output of the commands of '$(source)' without its trailing
+/// newlines, malloc'ed; '$?' is their status. A lone builtin which does
+/// not change the shell runs in it, writing to memory, anything else in
+/// a child writing to a pipe.
+char* command_subst(const char* source);
+
+/// In a pipeline, adjacent builtins which only read their input and
+/// write their output run as threads of the shell, connected by rings
+/// (see ring.h) rather than pipes; USH_THREADS=0 forks them instead.
+/// Such a builtin reads and writes through these, which are fd 0 and
+/// stdout anywhere else. builtin_stdin may return STAGE_RING, only
+/// builtin_read reads it.
+#define STAGE_RING -2
+int builtin_stdin(void);
+ssize_t builtin_read(int fd, void* buf, size_t n);
+FILE* builtin_stdout(void);
+
+/// Done with stdin: in a pipeline the stage writing to it stops at once.
+/// The shell's own stdin stays open.
+void builtin_close_stdin(void);
+
+/// Wait for the child, returns its exit status or 128 + the signal.
+int wait_pid(pid_t pid);
+
+/// The executables found in PATH are remembered by name.
+void commands_print(void);
+void commands_forget(void);
+
+int simple_ls(size_t n, char** words);
+int simple_cd(size_t n, char** words);
+int simple_pwd(size_t n, char** words);
+int simple_pushd(size_t n, char** words);
+int simple_popd(size_t n, char** words);
+int simple_dirs(size_t n, char** words);
+int simple_wc(size_t n, char** words);
+int simple_cat(size_t n, char** words);
+int simple_cache(size_t n, char** words);
+int simple_export(size_t n, char** words);
+int simple_unset(size_t n, char** words);
+int simple_true(size_t n, char** words);
+int simple_false(size_t n, char** words);
+int simple_hash(size_t n, char** words);
+int simple_wait(size_t n, char** words);
+int simple_jobs(size_t n, char** words);
+int simple_head(size_t n, char** words);
+int simple_tail(size_t n, char** words);
+int simple_sort(size_t n, char** words);
+int simple_grep(size_t n, char** words);
+int simple_find(size_t n, char** words);
+int simple_parallel(size_t n, char** words);
\ No newline at end of file
@@ -0,0 +1,370 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lexer.h"
+#include "table.h"
+#include "vars.h"
+#include "ush.h"
+
+typedef struct {
+    char* value;
+    int exported;
+} Var;
+
+static Table vars;
+
+// The cached environment and whether it has to be rebuilt.
+static char** environ_cache = NULL;
+static size_t environ_size = 0;
+static int environ_dirty = 1;
+
+// The exit status of the last command, as text for '$?'.
+static int last_status = 0;
+static char status[16] = "0";
+
+static Args args = { 0, NULL };
+
+static char background[16] = "";
+
+static int is_name_start(char c) {
+    return c == '_' || (c <= 'z' && c >= 'a') || (c <= 'Z' && c >= 'A');
+}
+
+static int is_name_char(char c) {
+    return is_name_start(c) || (c <= '9' && c >= '0');
+}
+
+size_t assignment(const char* word) {
+    if (!is_name_start(word[0])) return 0;
+    size_t i = 1;
+    while (is_name_char(word[i])) i++;
+    return word[i] == '=' ? i : 0;
+}
+
+void vars_init(char** envp) {
+    for (char** e = envp; e != NULL && *e != NULL; ++e) {
+        size_t len = assignment(*e);
+        if (len == 0) continue;
+        char* name = strndup(*e, len);
+        var_set(name, *e + len + 1);
+        var_export(name);
+        free(name);
+    }
+}
+
+const char* var_get(const char* name) {
+    Var* var = table_get(&vars, name);
+    return var == NULL ? NULL : var->value;
+}
+
+void var_set(const char* name, const char* value) {
+    Var** slot = (Var**)table_put(&vars, name);
+    if (*slot == NULL) {
+        *slot = calloc(1, sizeof(Var));
+    }
+    free((*slot)->value);
+    (*slot)->value = strdup(value);
+    if ((*slot)->exported) environ_dirty = 1;
+}
+
+void var_export(const char* name) {
+    Var** slot = (Var**)table_put(&vars, name);
+    if (*slot == NULL) {
+        // Exported but not set yet, it stays out of the environment.
+        *slot = calloc(1, sizeof(Var));
+    }
+    if (!(*slot)->exported) {
+        (*slot)->exported = 1;
+        environ_dirty = 1;
+    }
+}
+
+int var_exported(const char* name) {
+    Var* var = table_get(&vars, name);
+    return var != NULL && var->exported;
+}
+
+void var_unset(const char* name) {
+    Var* var = table_remove(&vars, name);
+    if (var == NULL) return;
+    if (var->exported) environ_dirty = 1;
+    free(var->value);
+    free(var);
+}
+
+char** vars_environ(void) {
+    if (!environ_dirty) return environ_cache;
+
+    for (size_t i = 0; i < environ_size; ++i) {
+        free(environ_cache[i]);
+    }
+    environ_size = 0;
+    environ_cache = realloc(environ_cache, (vars.n + 1) * sizeof(char*));
+    for (size_t i = 0; i < vars.cap; ++i) {
+        if (!table_live(&vars, i)) continue;
+        const Var* var = vars.slots[i].value;
+        if (!var->exported || var->value == NULL) continue;
+        const char* name = vars.slots[i].key;
+        char* entry = malloc(strlen(name) + strlen(var->value) + 2);
+        sprintf(entry, "%s=%s", name, var->value);
+        environ_cache[environ_size++] = entry;
+    }
+    environ_cache[environ_size] = NULL;
+    environ_dirty = 0;
+    return environ_cache;
+}
+
+void vars_print_exported(void) {
+    for (size_t i = 0; i < vars.cap; ++i) {
+        if (!table_live(&vars, i)) continue;
+        const Var* var = vars.slots[i].value;
+        if (!var->exported) continue;
+        if (var->value == NULL) {
+            fprintf(stdout, "export %s\n", vars.slots[i].key);
+        } else {
+            fprintf(stdout, "export %s=%s\n", vars.slots[i].key, var->value);
+        }
+    }
+}
+
+Args vars_set_args(size_t n, char** v) {
+    Args saved = args;
+    args.n = n;
+    args.v = v;
+    return saved;
+}
+
+Args vars_args(void) {
+    return args;
+}
+
+void vars_set_status(int value) {
+    last_status = value;
+    snprintf(status, sizeof(status), "%d", value);
+}
+
+int vars_status(void) {
+    return last_status;
+}
+
+void vars_set_background(int pid) {
+    snprintf(background, sizeof(background), "%d", pid);
+}
+
+// Append n bytes to the growable string.
+static void append(char** out, size_t* len, size_t* cap, const char* s, size_t n) {
+    if (*len + n + 1 > *cap) {
+        while (*len + n + 1 > *cap) *cap *= 2;
+        *out = realloc(*out, *cap);
+    }
+    memcpy(*out + *len, s, n);
+    *len += n;
+}
+
+// Append text which came from a quoted part of the word.
+// For a pattern the wildcards in it are escaped so they stay literal.
+static void append_quoted(char** out, size_t* len, size_t* cap, const char* s, size_t n, int pattern) {
+    if (!pattern) {
+        append(out, len, cap, s, n);
+        return;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        if (s[i] == '*' || s[i] == '?' || s[i] == '[' || s[i] == '\\') {
+            append(out, len, cap, "\\", 1);
+        }
+        append(out, len, cap, s + i, 1);
+    }
+}
+
+// Text which is not quoted, its wildcards are live.
+static void append_plain(char** out, size_t* len, size_t* cap, const char* s, size_t n, int pattern, int* glob) {
+    if (pattern) {
+        for (size_t i = 0; i < n; ++i) {
+            if (s[i] == '*' || s[i] == '?' || s[i] == '[') *glob = 1;
+            if (s[i] == '\\') append(out, len, cap, "\\", 1);
+            append(out, len, cap, s + i, 1);
+        }
+    } else {
+        append(out, len, cap, s, n);
+    }
+}
+
+static void append_value(const char* value, char** out, size_t* len, size_t* cap,
+    int quoted, int pattern, int* glob) {
+    if (quoted) {
+        append_quoted(out, len, cap, value, strlen(value), pattern);
+    } else {
+        append_plain(out, len, cap, value, strlen(value), pattern, glob);
+    }
+}
+
+// Append a special parameter: $? $! $# $@ $* or a single digit $N.
+// Returns 0 if 'c' does not name one.
+static int append_special(char c, char** out, size_t* len, size_t* cap,
+    int quoted, int pattern, int* glob) {
+    char num[32];
+    if (c == '?') {
+        append(out, len, cap, status, strlen(status));
+    } else if (c == '!') {
+        append(out, len, cap, background, strlen(background));
+    } else if (c == '#') {
+        snprintf(num, sizeof(num), "%zu", args.n);
+        append(out, len, cap, num, strlen(num));
+    } else if (c == '0') {
+        append(out, len, cap, "ush", 3);
+    } else if (c <= '9' && c >= '1') {
+        size_t i = c - '1';
+        if (i < args.n) append_value(args.v[i], out, len, cap, quoted, pattern, glob);
+    } else if (c == '@' || c == '*') {
+        for (size_t i = 0; i < args.n; ++i) {
+            if (i > 0) append(out, len, cap, " ", 1);
+            append_value(args.v[i], out, len, cap, quoted, pattern, glob);
+        }
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+// Append the value of the variable at 'dollar', or the output of the
+// command substitution, returns what follows it.
+static const char* expand_var(const char* dollar, char** out, size_t* len, size_t* cap,
+    int quoted, int pattern, int* glob) {
+    const char* name = dollar + 1;
+    size_t n = 0;
+    const char* next;
+    if (*name == '(' && (n = subst_length(dollar)) > 0) {
+        char* inner = strndup(dollar + 2, n - 3);
+        char* output = command_subst(inner);
+        append_value(output, out, len, cap, quoted, pattern, glob);
+        free(output);
+        free(inner);
+        return dollar + n;
+    }
+    if (append_special(*name, out, len, cap, quoted, pattern, glob)) {
+        return name + 1;
+    }
+    if (*name == '{') {
+        name++;
+        if (*name <= '9' && *name >= '0') {
+            // ${10} and up, the braces are needed past 9.
+            char* end;
+            unsigned long i = strtoul(name, &end, 10);
+            if (*end == '}') {
+                if (i == 0) append(out, len, cap, "ush", 3);
+                else if (i <= args.n) append_value(args.v[i - 1], out, len, cap, quoted, pattern, glob);
+                return end + 1;
+            }
+        }
+        while (is_name_char(name[n])) n++;
+        next = name + n + 1;
+        // Not a valid ${NAME}.
+        if (n == 0 || !is_name_start(name[0]) || name[n] != '}') n = 0;
+    } else {
+        if (is_name_start(*name)) {
+            while (is_name_char(name[n])) n++;
+        }
+        next = name + n;
+    }
+    if (n == 0) {
+        // A lone '$' stays as it is.
+        append(out, len, cap, "$", 1);
+        return dollar + 1;
+    }
+    const Var* var = table_getn(&vars, name, n);
+    if (var != NULL && var->value != NULL) {
+        append_value(var->value, out, len, cap, quoted, pattern, glob);
+    }
+    return next;
+}
+
+static char* expand(const char* word, int pattern, int* glob) {
+    size_t cap = strlen(word) + 64;
+    size_t len = 0;
+    char* out = malloc(cap);
+    int dquote = 0;
+    const char* p = word;
+    while (*p) {
+        switch (*p) {
+            case '\'':
+                if (!dquote) {
+                    // The lexer made sure that the quote is closed.
+                    const char* close = strchr(p + 1, '\'');
+                    append_quoted(&out, &len, &cap, p + 1, close - p - 1, pattern);
+                    p = close + 1;
+                } else {
+                    append(&out, &len, &cap, p++, 1);
+                }
+                break;
+            case '"':
+                dquote = !dquote;
+                p++;
+                break;
+            case '\\':
+                if (p[1] == '\0') {
+                    p++;
+                } else if (p[1] == '\n') {
+                    // A line continuation.
+                    p += 2;
+                } else if (!dquote || strchr("$`\"\\\n", p[1]) != NULL) {
+                    append_quoted(&out, &len, &cap, p + 1, 1, pattern);
+                    p += 2;
+                } else {
+                    // Inside double quotes other backslashes are kept.
+                    append_quoted(&out, &len, &cap, p, 2, pattern);
+                    p += 2;
+                }
+                break;
+            case '$':
+                p = expand_var(p, &out, &len, &cap, dquote, pattern, glob);
+                break;
+            default: {
+                size_t n = strcspn(p, "$'\"\\");
+                if (dquote) {
+                    append_quoted(&out, &len, &cap, p, n, pattern);
+                } else {
+                    append_plain(&out, &len, &cap, p, n, pattern, glob);
+                }
+                p += n;
+                break;
+            }
+        }
+    }
+    out[len] = '\0';
+    return out;
+}
+
+char* expand_word(const char* word) {
+    if (strpbrk(word, "$'\"\\") == NULL) return strdup(word);
+    return expand(word, 0, NULL);
+}
+
+char* expand_text(const char* text) {
+    if (strpbrk(text, "$\\") == NULL) return strdup(text);
+    size_t cap = strlen(text) + 64;
+    size_t len = 0;
+    char* out = malloc(cap);
+    const char* p = text;
+    while (*p) {
+        if (*p == '\\' && p[1] == '\n') {
+            p += 2;
+        } else if (*p == '\\' && p[1] != '\0' && strchr("$`\\", p[1]) != NULL) {
+            append(&out, &len, &cap, p + 1, 1);
+            p += 2;
+        } else if (*p == '$') {
+            p = expand_var(p, &out, &len, &cap, 1, 0, NULL);
+        } else {
+            size_t n = strcspn(p + 1, "$\\") + 1;
+            append(&out, &len, &cap, p, n);
+            p += n;
+        }
+    }
+    out[len] = '\0';
+    return out;
+}
+
+char* expand_pattern(const char* word, int* glob) {
+    *glob = 0;
+    if (strpbrk(word, "$'\"\\*?[") == NULL) return strdup(word);
+    return expand(word, 1, glob);
+}
\ No newline at end of file
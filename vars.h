@@ -0,0 +1,55 @@
+#include <stddef.h>
+
+/// Shell variables.
+/// The inherited environment is imported as exported variables.
+void vars_init(char** envp);
+
+const char* var_get(const char* name);
+void var_set(const char* name, const char* value);
+void var_export(const char* name);
+void var_unset(const char* name);
+int var_exported(const char* name);
+
+/// The environment for exec, "NAME=value" for every exported variable.
+/// It is only rebuilt after an exported variable changed.
+char** vars_environ(void);
+
+/// Remember the exit status of the last command, '$?' expands to it.
+void vars_set_status(int status);
+int vars_status(void);
+
+/// The pid of the last background job, for '$!'.
+void vars_set_background(int pid);
+
+/// Positional parameters of the running function: $1..., '$#' is their
+/// number and '$@' their list. The words are not copied, they have to
+/// outlive the call.
+typedef struct {
+    size_t n;
+    char** v;
+} Args;
+
+/// Set the positional parameters, returns the ones to restore afterwards.
+Args vars_set_args(size_t n, char** v);
+Args vars_args(void);
+
+/// Print the exported variables as export commands.
+void vars_print_exported(void);
+
+/// If 'word' is NAME=value, return the length of NAME, otherwise 0.
+size_t assignment(const char* word);
+
+/// Replace $NAME and ${NAME} in 'word' and remove the quotes,
+/// the result is malloc'ed. Nothing is expanded inside single quotes.
+/// A command substitution $(cmd) is replaced by the output of cmd,
+/// see command_subst.
+char* expand_word(const char* word);
+
+/// Replace the variables in the body of a here-document. Quotes are
+/// kept, a backslash only escapes '$', '`', itself and a newline.
+char* expand_text(const char* text);
+
+/// Same as expand_word, but the result is a filename pattern:
+/// quoted wildcards are escaped with a backslash, and '*glob' tells
+/// whether an unquoted wildcard is left.
+char* expand_pattern(const char* word, int* glob);
\ No newline at end of file
@@ -0,0 +1,249 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "wildcard.h"
+#include "dircache.h"
+
+int has_wildcard(const char* pattern) {
+    for (const char* p = pattern; *p; ++p) {
+        if (*p == '\\' && p[1]) p++;
+        else if (*p == '*' || *p == '?' || *p == '[') return 1;
+    }
+    return 0;
+}
+
+void wildcard_unescape(char* pattern) {
+    char* out = pattern;
+    for (const char* p = pattern; *p; ++p) {
+        if (*p == '\\' && p[1]) p++;
+        *out++ = *p;
+    }
+    *out = '\0';
+}
+
+// Match 'c' against the bracket expression after the '['.
+// Returns 1 or 0 and moves '*pp' past the ']', or -1 if it is not closed.
+static int match_bracket(const char** pp, char c) {
+    const char* p = *pp;
+    int negate = 0;
+    int found = 0;
+    if (*p == '!' || *p == '^') {
+        negate = 1;
+        p++;
+    }
+    // A ']' right at the start is a member.
+    int first = 1;
+    while (*p && (*p != ']' || first)) {
+        first = 0;
+        char lo = *p;
+        if (lo == '\\' && p[1]) lo = *++p;
+        p++;
+        char hi = lo;
+        if (*p == '-' && p[1] && p[1] != ']') {
+            hi = p[1];
+            if (hi == '\\' && p[2]) {
+                hi = p[2];
+                p++;
+            }
+            p += 2;
+        }
+        if ((unsigned char)c >= (unsigned char)lo && (unsigned char)c <= (unsigned char)hi) {
+            found = 1;
+        }
+    }
+    if (*p != ']') return -1;
+    *pp = p + 1;
+    return found != negate;
+}
+
+// Iterative matching, on a mismatch only the last '*' is retried.
+int wildcard_match(const char* p, const char* s) {
+    const char* star_p = NULL;
+    const char* star_s = NULL;
+    while (*s) {
+        if (*p == '*') {
+            while (*p == '*') p++;
+            if (*p == '\0') return 1;
+            star_p = p;
+            star_s = s;
+            continue;
+        }
+        int ok;
+        if (*p == '?') {
+            ok = 1;
+            p++;
+        } else if (*p == '[') {
+            const char* q = p + 1;
+            int r = match_bracket(&q, *s);
+            if (r < 0) {
+                // Not a bracket expression, a plain '['.
+                ok = *s == '[';
+                p++;
+            } else {
+                ok = r;
+                p = q;
+            }
+        } else {
+            if (*p == '\\' && p[1]) p++;
+            ok = *p != '\0' && *p == *s;
+            p++;
+        }
+        if (ok) {
+            s++;
+        } else if (star_p != NULL) {
+            p = star_p;
+            s = ++star_s;
+        } else {
+            return 0;
+        }
+    }
+    while (*p == '*') p++;
+    return *p == '\0';
+}
+
+typedef struct {
+    char** v;
+    size_t n;
+    size_t cap;
+} Paths;
+
+static void add_path(Paths* paths, char* path) {
+    if (paths->n == paths->cap) {
+        paths->cap = paths->cap ? paths->cap * 2 : 16;
+        paths->v = realloc(paths->v, paths->cap * sizeof(char*));
+    }
+    paths->v[paths->n++] = path;
+}
+
+static char* join(const char* base, const char* name, size_t len) {
+    size_t n = strlen(base);
+    char* path = malloc(n + len + 1);
+    memcpy(path, base, n);
+    memcpy(path + n, name, len);
+    path[n + len] = '\0';
+    return path;
+}
+
+/// A pattern component prepared for matching a whole directory.
+typedef struct {
+    const char* pattern;
+    char* prefix;       // Literal text before the first wildcard.
+    const char* suffix; // Set if the pattern is '*' followed by literal text.
+    size_t suffix_len;
+} Component;
+
+static void prepare(Component* c, const char* pattern) {
+    c->pattern = pattern;
+    size_t n = 0;
+    while (pattern[n] && pattern[n] != '*' && pattern[n] != '?' && pattern[n] != '[') {
+        if (pattern[n] == '\\' && pattern[n + 1]) n++;
+        n++;
+    }
+    c->prefix = strndup(pattern, n);
+    wildcard_unescape(c->prefix);
+    c->suffix = NULL;
+    if (pattern[0] == '*' && !has_wildcard(pattern + 1) && strchr(pattern + 1, '\\') == NULL) {
+        c->suffix = pattern + 1;
+        c->suffix_len = strlen(pattern + 1);
+    }
+}
+
+static int component_match(const Component* c, const char* name) {
+    if (c->suffix != NULL) {
+        size_t len = strlen(name);
+        return len >= c->suffix_len && !memcmp(name + len - c->suffix_len, c->suffix, c->suffix_len);
+    }
+    return wildcard_match(c->pattern, name);
+}
+
+// Expand 'comps[k..n)' below 'base', which is empty or ends with a '/'.
+static void expand_from(const char* base, char** comps, size_t k, size_t n, Paths* out) {
+    if (k == n) {
+        add_path(out, strdup(base));
+        return;
+    }
+    if (comps[k][0] == '\0') {
+        // Trailing slash, 'base' is known to be a directory.
+        add_path(out, strdup(base));
+        return;
+    }
+
+    if (!has_wildcard(comps[k])) {
+        char* name = strdup(comps[k]);
+        wildcard_unescape(name);
+        char* path = join(base, name, strlen(name));
+        free(name);
+        struct stat st;
+        if (k + 1 == n) {
+            if (lstat(path, &st) == 0) add_path(out, path);
+            else free(path);
+        } else {
+            char* dir = join(path, "/", 1);
+            free(path);
+            expand_from(dir, comps, k + 1, n, out);
+            free(dir);
+        }
+        return;
+    }
+
+    const DirListing* dir = dircache_get(base[0] ? base : ".");
+    if (dir == NULL) return;
+
+    Component c;
+    prepare(&c, comps[k]);
+    int hidden = comps[k][0] == '.';
+    size_t plen = strlen(c.prefix);
+
+    // Copy the matches out, the listing may be evicted when descending.
+    Paths matches = {0};
+    for (size_t i = dircache_lower_bound(dir, c.prefix); i < dir->n; ++i) {
+        const DirEntry* e = dir->entries + i;
+        if (strncmp(e->name, c.prefix, plen)) break;
+        if (e->name[0] == '.' && !hidden) continue;
+        if (!component_match(&c, e->name)) continue;
+        if (k + 1 < n && !e->is_dir) continue;
+        add_path(&matches, join(base, e->name, strlen(e->name)));
+    }
+    free(c.prefix);
+
+    for (size_t i = 0; i < matches.n; ++i) {
+        if (k + 1 == n) {
+            add_path(out, matches.v[i]);
+        } else {
+            char* sub = join(matches.v[i], "/", 1);
+            expand_from(sub, comps, k + 1, n, out);
+            free(sub);
+            free(matches.v[i]);
+        }
+    }
+    free(matches.v);
+}
+
+size_t wildcard_expand(const char* pattern, char*** result) {
+    // Split on '/', an absolute pattern starts from the root.
+    char* copy = strdup(pattern);
+    char** comps = NULL;
+    size_t n = 0;
+    const char* base = "";
+    char* p = copy;
+    if (*p == '/') {
+        base = "/";
+        while (*p == '/') p++;
+    }
+    while (1) {
+        comps = realloc(comps, (n + 1) * sizeof(char*));
+        comps[n++] = p;
+        char* slash = strchr(p, '/');
+        if (slash == NULL) break;
+        *slash = '\0';
+        p = slash + 1;
+        while (*p == '/') p++;
+    }
+
+    Paths out = {0};
+    expand_from(base, comps, 0, n, &out);
+    free(comps);
+    free(copy);
+    *result = out.v;
+    return out.n;
+}
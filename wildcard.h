@@ -0,0 +1,19 @@
+#include <stddef.h>
+
+/// Filename patterns: '*', '?' and '[...]' ('!' or '^' negates).
+/// A backslash makes the next character literal.
+
+/// Whether 'pattern' contains an unescaped '*', '?' or '['.
+int has_wildcard(const char* pattern);
+
+/// Match a whole name against the pattern.
+int wildcard_match(const char* pattern, const char* name);
+
+/// Remove the escaping backslashes, in place.
+void wildcard_unescape(char* pattern);
+
+/// Expand the pattern into the sorted list of matching paths.
+/// Names starting with '.' only match a pattern starting with '.'.
+/// Directories are read through the directory cache.
+/// Returns the number of matches, '*matches' is malloc'ed.
+size_t wildcard_expand(const char* pattern, char*** matches);